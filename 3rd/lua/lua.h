@@ -469,6 +469,10 @@ LUA_API lua_State * skynet_sig_L;
 LUA_API void (lua_checksig_)(lua_State *L);
 #define lua_checksig(L) if (skynet_sig_L) { lua_checksig_(L); }
 
+/* called before (0) and after (1) each gc step or full gc, see lgc.c */
+typedef void (*lua_GCHook) (lua_State *L, int stop);
+LUA_API lua_GCHook skynet_gchook;
+
 /******************************************************************************
 * Copyright (C) 1994-2016 Lua.org, PUC-Rio.
 *
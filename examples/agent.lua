@@ -76,7 +76,9 @@ function CMD.start(conf)
 	send_request = host:attach(sprotoloader.load(2))
 	skynet.fork(function()
 		while true do
-			send_package(send_request "heartbeat")
+			if socket.writable(client_fd) then
+				send_package(send_request "heartbeat")
+			end
 			skynet.sleep(500)
 		end
 	end)
@@ -16,6 +16,8 @@ skynet.start(function()
 		port = 8888,
 		maxclient = max_client,
 		nodelay = true,
+		-- shard = 4,	-- spread the client sockets over 4 gate services
+		-- highwater = 1024 * 1024, waterpolicy = "close",	-- close the clients can't receive in time
 	})
 	skynet.error("Watchdog listen on", 8888)
 	skynet.exit()
@@ -475,6 +475,58 @@ lconcat(lua_State *L) {
 	return 2;
 }
 
+/*
+	string node
+	uint32_t/string addr
+	lightuserdata msg
+	uint32_t sz
+
+	return lightuserdata, sz for clustergate (See service-src/service_clustergate.c)
+		BYTE nodelen
+		STRING node
+		BYTE namelen (0 : addr is a DWORD)
+		DWORD addr / STRING name
+		PADDING msg
+ */
+static int
+lpackcall(lua_State *L) {
+	size_t nodelen = 0;
+	const char * node = luaL_checklstring(L, 1, &nodelen);
+	void *msg = lua_touserdata(L,3);
+	if (msg == NULL) {
+		return luaL_error(L, "Invalid request message");
+	}
+	uint32_t sz = (uint32_t)luaL_checkinteger(L,4);
+	size_t namelen = 0;
+	const char * name = NULL;
+	if (lua_type(L,2) != LUA_TNUMBER) {
+		name = lua_tolstring(L, 2, &namelen);
+		if (name == NULL || namelen < 1 || namelen > 255) {
+			skynet_free(msg);
+			return luaL_error(L, "name is too long %s", name);
+		}
+	}
+	if (nodelen < 1 || nodelen > 255) {
+		skynet_free(msg);
+		return luaL_error(L, "Invalid node name %s", node);
+	}
+	size_t hsz = 2 + nodelen + (name ? namelen : 4);
+	uint8_t * buf = skynet_malloc(hsz + sz);
+	buf[0] = (uint8_t)nodelen;
+	memcpy(buf+1, node, nodelen);
+	buf[1+nodelen] = (uint8_t)namelen;
+	if (name) {
+		memcpy(buf+2+nodelen, name, namelen);
+	} else {
+		fill_uint32(buf+2+nodelen, (uint32_t)lua_tointeger(L,2));
+	}
+	memcpy(buf+hsz, msg, sz);
+	skynet_free(msg);
+	lua_pushlightuserdata(L, buf);
+	lua_pushinteger(L, hsz + sz);
+	return 2;
+}
+
 int
 luaopen_cluster_core(lua_State *L) {
 	luaL_Reg l[] = {
@@ -483,6 +535,7 @@ luaopen_cluster_core(lua_State *L) {
 		{ "packresponse", lpackresponse },
 		{ "unpackresponse", lunpackresponse },
 		{ "concat", lconcat },
+		{ "packcall", lpackcall },
 		{ NULL, NULL },
 	};
 	luaL_checkversion(L);
@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include "atomic.h"
+#include "rwlock.h"
 
 struct mc_package {
 	int reference;
@@ -13,6 +14,133 @@ struct mc_package {
 	void *data;
 };
 
+/*
+	The channels of this node, shared by the services in the process. multicastd (service/multicastd.lua)
+	manages them, and the publishers of the channels created by this node push the messages to the
+	subscribers directly (mc_publish). Only the owner node of a channel has the remote nodes (the address of
+	their multicastd) which subscribe it, the other nodes have the local subscribers only.
+ */
+struct mc_channel {
+	struct mc_channel * next;
+	uint32_t id;
+	int n;
+	int cap;
+	uint32_t * subscriber;	// local services
+	int remote_n;
+	int remote_cap;
+	uint32_t * remote;	// multicastd of the remote nodes
+};
+
+struct mc_registry {
+	struct rwlock lock;
+	int n;
+	int cap;
+	struct mc_channel ** slot;
+};
+
+static struct mc_registry R;
+
+static struct mc_channel *
+channel_find(uint32_t id) {
+	if (R.cap == 0)
+		return NULL;
+	struct mc_channel * c = R.slot[(id >> 8) & (R.cap - 1)];
+	while (c) {
+		if (c->id == id)
+			return c;
+		c = c->next;
+	}
+	return NULL;
+}
+
+static void
+channel_rehash(int cap) {
+	struct mc_channel ** slot = skynet_malloc(cap * sizeof(*slot));
+	memset(slot, 0, cap * sizeof(*slot));
+	int i;
+	for (i=0;i<R.cap;i++) {
+		struct mc_channel * c = R.slot[i];
+		while (c) {
+			struct mc_channel * next = c->next;
+			int h = (c->id >> 8) & (cap - 1);
+			c->next = slot[h];
+			slot[h] = c;
+			c = next;
+		}
+	}
+	skynet_free(R.slot);
+	R.slot = slot;
+	R.cap = cap;
+}
+
+// call with write lock
+static struct mc_channel *
+channel_new(uint32_t id) {
+	struct mc_channel * c = channel_find(id);
+	if (c)
+		return c;
+	if (R.n >= R.cap) {
+		channel_rehash(R.cap ? R.cap * 2 : 64);
+	}
+	c = skynet_malloc(sizeof(*c));
+	memset(c, 0, sizeof(*c));
+	c->id = id;
+	int h = (id >> 8) & (R.cap - 1);
+	c->next = R.slot[h];
+	R.slot[h] = c;
+	++R.n;
+	return c;
+}
+
+static void
+channel_delete(uint32_t id) {
+	if (R.cap == 0)
+		return;
+	struct mc_channel ** p = &R.slot[(id >> 8) & (R.cap - 1)];
+	while (*p) {
+		struct mc_channel * c = *p;
+		if (c->id == id) {
+			*p = c->next;
+			--R.n;
+			skynet_free(c->subscriber);
+			skynet_free(c->remote);
+			skynet_free(c);
+			return;
+		}
+		p = &c->next;
+	}
+}
+
+static void
+set_insert(uint32_t **set, int *n, int *cap, uint32_t handle) {
+	int i;
+	for (i=0;i<*n;i++) {
+		if ((*set)[i] == handle)
+			return;
+	}
+	if (*n >= *cap) {
+		int newcap = *cap ? *cap * 2 : 8;
+		uint32_t * newset = skynet_malloc(newcap * sizeof(uint32_t));
+		if (*n)
+			memcpy(newset, *set, *n * sizeof(uint32_t));
+		skynet_free(*set);
+		*set = newset;
+		*cap = newcap;
+	}
+	(*set)[(*n)++] = handle;
+}
+
+static void
+set_remove(uint32_t *set, int *n, uint32_t handle) {
+	int i;
+	for (i=0;i<*n;i++) {
+		if (set[i] == handle) {
+			set[i] = set[--*n];
+			return;
+		}
+	}
+}
+
 static int
 pack(lua_State *L, void *data, size_t size) {
 	struct mc_package * pack = skynet_malloc(sizeof(struct mc_package));
@@ -131,9 +259,159 @@ mc_remote(lua_State *L) {
 	lua_pushlightuserdata(L, pack->data);
 	lua_pushinteger(L, (lua_Integer)(pack->size));
 	skynet_free(pack);
+	skynet_free(ptr);
 	return 2;
 }
 
+/*
+	integer channel
+	integer handle
+	boolean subscribe (or unsubscribe)
+	boolean remote : handle is the multicastd of a remote node
+
+	the local channel (created by this node, or subscribed by the local services) is created by the first
+	subscribe, and multicastd deletes it by mc_delchannel.
+ */
+static int
+mc_subscribe(lua_State *L) {
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	uint32_t handle = (uint32_t)luaL_checkinteger(L, 2);
+	int sub = lua_toboolean(L, 3);
+	int remote = lua_toboolean(L, 4);
+	rwlock_wlock(&R.lock);
+	struct mc_channel * c = sub ? channel_new(id) : channel_find(id);
+	if (c) {
+		if (remote) {
+			if (sub)
+				set_insert(&c->remote, &c->remote_n, &c->remote_cap, handle);
+			else
+				set_remove(c->remote, &c->remote_n, handle);
+		} else {
+			if (sub)
+				set_insert(&c->subscriber, &c->n, &c->cap, handle);
+			else
+				set_remove(c->subscriber, &c->n, handle);
+		}
+	}
+	rwlock_wunlock(&R.lock);
+	return 0;
+}
+
+static int
+mc_newchannel(lua_State *L) {
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	rwlock_wlock(&R.lock);
+	channel_new(id);
+	rwlock_wunlock(&R.lock);
+	return 0;
+}
+
+static int
+mc_delchannel(lua_State *L) {
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	rwlock_wlock(&R.lock);
+	channel_delete(id);
+	rwlock_wunlock(&R.lock);
+	return 0;
+}
+
+/*
+	Send the message (owned by the caller, skynet_malloc) to the local subscribers and the remote nodes
+	of the channel. The local subscribers share one package (see mc_unpacklocal), the remote nodes get
+	a copy for each. The channel id is the session of the messages.
+ */
+static void
+publish(struct skynet_context *ctx, uint32_t source, uint32_t id, void *data, uint32_t size) {
+	rwlock_rlock(&R.lock);
+	struct mc_channel * c = channel_find(id);
+	int i;
+	if (c) {
+		for (i=0;i<c->remote_n;i++) {
+			void * msg = skynet_malloc(size);
+			memcpy(msg, data, size);
+			skynet_send(ctx, source, c->remote[i], PTYPE_MULTICAST | PTYPE_TAG_DONTCOPY, (int)id, msg, size);
+		}
+	}
+	if (c == NULL || c->n == 0) {
+		rwlock_runlock(&R.lock);
+		skynet_free(data);
+		return;
+	}
+	struct mc_package * pack = skynet_malloc(sizeof(struct mc_package));
+	pack->reference = c->n;
+	pack->size = size;
+	pack->data = data;
+	int dead = 0;
+	for (i=0;i<c->n;i++) {
+		struct mc_package ** ptr = skynet_malloc(sizeof(*ptr));
+		*ptr = pack;
+		if (skynet_send(ctx, source, c->subscriber[i], PTYPE_MULTICAST | PTYPE_TAG_DONTCOPY, (int)id, ptr, sizeof(*ptr)) < 0) {
+			// the subscriber is dead, its message is freed
+			++dead;
+		}
+	}
+	rwlock_runlock(&R.lock);
+	if (dead && ATOM_SUB(&pack->reference, dead) == 0) {
+		skynet_free(pack->data);
+		skynet_free(pack);
+	}
+}
+
+/*
+	integer channel
+	lightuserdata message (skynet_malloc, the owner is changed on success)
+	integer size
+
+	Publish a message of the channel created by this node, without multicastd.
+	return false if the channel is created by another node, the message should be published by it.
+ */
+static int
+mc_publish(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	luaL_checktype(L, 2, LUA_TLIGHTUSERDATA);
+	void * data = lua_touserdata(L, 2);
+	size_t size = (size_t)luaL_checkinteger(L, 3);
+	if (size != (uint32_t)size) {
+		return luaL_error(L, "Size should be 32bit integer");
+	}
+	if (skynet_isremote(ctx, (id & 0xff) << 24, NULL)) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	publish(ctx, 0, id, data, (uint32_t)size);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*
+	integer channel
+	integer source
+	lightuserdata message
+	integer size
+	boolean own : the message is skynet_malloc and owned by mc_deliver, or copy it
+
+	multicastd publishes the message from a remote node (or by command PUB) to the subscribers.
+ */
+static int
+mc_deliver(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
+	uint32_t source = (uint32_t)luaL_checkinteger(L, 2);
+	void * data = lua_touserdata(L, 3);
+	size_t size = (size_t)luaL_checkinteger(L, 4);
+	if (size != (uint32_t)size) {
+		return luaL_error(L, "Size should be 32bit integer");
+	}
+	void * msg = data;
+	if (!lua_toboolean(L, 5)) {
+		msg = skynet_malloc(size);
+		memcpy(msg, data, size);
+	}
+	publish(ctx, source, id, msg, (uint32_t)size);
+	return 0;
+}
+
 static int
 mc_nextid(lua_State *L) {
 	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
@@ -153,9 +431,24 @@ luaopen_multicast_core(lua_State *L) {
 		{ "remote", mc_remote },
 		{ "packremote", mc_packremote },
 		{ "nextid", mc_nextid },
+		{ "subscribe", mc_subscribe },
+		{ "newchannel", mc_newchannel },
+		{ "delchannel", mc_delchannel },
+		{ NULL, NULL },
+	};
+	luaL_Reg l2[] = {
+		{ "publish", mc_publish },
+		{ "deliver", mc_deliver },
 		{ NULL, NULL },
 	};
 	luaL_checkversion(L);
 	luaL_newlib(L,l);
+
+	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context");
+	struct skynet_context *ctx = lua_touserdata(L,-1);
+	if (ctx == NULL) {
+		return luaL_error(L, "Init skynet context first");
+	}
+	luaL_setfuncs(L,l2,1);
 	return 1;
 }
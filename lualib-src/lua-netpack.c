@@ -1,5 +1,6 @@
 #include "skynet_malloc.h"
 
+#include "skynet.h"
 #include "skynet_socket.h"
 
 #include <lua.h>
@@ -38,11 +39,20 @@ struct uncomplete {
 	int header;
 };
 
+// the packages of fd are sent to agent directly, See lroute
+struct route {
+	int fd;
+	uint32_t agent;
+	uint32_t client;
+	struct route * next;
+};
+
 struct queue {
 	int cap;
 	int head;
 	int tail;
 	struct uncomplete * hash[HASHSIZE];
+	struct route * route[HASHSIZE];
 	struct netpack queue[QUEUESIZE];
 };
 
@@ -66,6 +76,13 @@ lclear(lua_State *L) {
 	for (i=0;i<HASHSIZE;i++) {
 		clear_list(q->hash[i]);
 		q->hash[i] = NULL;
+		struct route * r = q->route[i];
+		while (r) {
+			struct route * next = r->next;
+			skynet_free(r);
+			r = next;
+		}
+		q->route[i] = NULL;
 	}
 	if (q->head > q->tail) {
 		q->tail += q->cap;
@@ -122,6 +139,7 @@ get_queue(lua_State *L) {
 		int i;
 		for (i=0;i<HASHSIZE;i++) {
 			q->hash[i] = NULL;
+			q->route[i] = NULL;
 		}
 		lua_replace(L, 1);
 	}
@@ -136,6 +154,8 @@ expand_queue(lua_State *L, struct queue *q) {
 	nq->tail = q->cap;
 	memcpy(nq->hash, q->hash, sizeof(nq->hash));
 	memset(q->hash, 0, sizeof(q->hash));
+	memcpy(nq->route, q->route, sizeof(nq->route));
+	memset(q->route, 0, sizeof(q->route));
 	int i;
 	for (i=0;i<q->cap;i++) {
 		int idx = (q->head + i) % q->cap;
@@ -145,8 +165,56 @@ expand_queue(lua_State *L, struct queue *q) {
 	lua_replace(L,1);
 }
 
+static struct route *
+find_route(struct queue *q, int fd) {
+	if (q == NULL)
+		return NULL;
+	struct route * r = q->route[hash_fd(fd)];
+	while (r) {
+		if (r->fd == fd)
+			return r;
+		r = r->next;
+	}
+	return NULL;
+}
+
+static void
+remove_route(struct queue *q, int fd) {
+	if (q == NULL)
+		return;
+	struct route ** pr = &q->route[hash_fd(fd)];
+	while (*pr) {
+		struct route * r = *pr;
+		if (r->fd == fd) {
+			*pr = r->next;
+			skynet_free(r);
+			return;
+		}
+		pr = &r->next;
+	}
+}
+
+// send the package to the agent of fd without lua, returns 0 if fd is not routed
+static int
+route_data(lua_State *L, int fd, void *buffer, int size, int clone) {
+	struct route * r = find_route(lua_touserdata(L,1), fd);
+	if (r == NULL)
+		return 0;
+	if (clone) {
+		void * tmp = skynet_malloc(size);
+		memcpy(tmp, buffer, size);
+		buffer = tmp;
+	}
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(TYPE_WARNING + 1));
+	skynet_send(ctx, r->client, r->agent, PTYPE_CLIENT | PTYPE_TAG_DONTCOPY, 0, buffer, size);
+	return 1;
+}
+
 static void
 push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
+	if (route_data(L, fd, buffer, size, clone)) {
+		return;
+	}
 	if (clone) {
 		void * tmp = skynet_malloc(size);
 		memcpy(tmp, buffer, size);
@@ -222,6 +290,15 @@ close_uncomplete(lua_State *L, int fd) {
 	}
 }
 
+// the routed packages are not in queue, so report "more" only if the queue is not empty
+static int
+more_data(lua_State *L, struct queue *q) {
+	if (q == NULL || q->head == q->tail)
+		return 1;
+	lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
+	return 2;
+}
+
 static int
 filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 	struct queue *q = lua_touserdata(L,1);
@@ -252,6 +329,10 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		buffer += need;
 		size -= need;
 		if (size == 0) {
+			if (route_data(L, fd, uc->pack.buffer, uc->pack.size, 0)) {
+				skynet_free(uc);
+				return 1;
+			}
 			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
 			lua_pushinteger(L, fd);
 			lua_pushlightuserdata(L, uc->pack.buffer);
@@ -263,8 +344,7 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		push_data(L, fd, uc->pack.buffer, uc->pack.size, 0);
 		skynet_free(uc);
 		push_more(L, fd, buffer, size);
-		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
-		return 2;
+		return more_data(L, lua_touserdata(L,1));
 	} else {
 		if (size == 1) {
 			struct uncomplete * uc = save_uncomplete(L, fd);
@@ -286,6 +366,9 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		}
 		if (size == pack_size) {
 			// just one package
+			if (route_data(L, fd, buffer, size, 1)) {
+				return 1;
+			}
 			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
 			lua_pushinteger(L, fd);
 			void * result = skynet_malloc(pack_size);
@@ -299,8 +382,7 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		buffer += pack_size;
 		size -= pack_size;
 		push_more(L, fd, buffer, size);
-		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
-		return 2;
+		return more_data(L, lua_touserdata(L,1));
 	}
 }
 
@@ -358,6 +440,7 @@ lfilter(lua_State *L) {
 	case SKYNET_SOCKET_TYPE_CLOSE:
 		// no more data in fd (message->id)
 		close_uncomplete(L, message->id);
+		remove_route(lua_touserdata(L,1), message->id);
 		lua_pushvalue(L, lua_upvalueindex(TYPE_CLOSE));
 		lua_pushinteger(L, message->id);
 		return 3;
@@ -370,6 +453,7 @@ lfilter(lua_State *L) {
 	case SKYNET_SOCKET_TYPE_ERROR:
 		// no more data in fd (message->id)
 		close_uncomplete(L, message->id);
+		remove_route(lua_touserdata(L,1), message->id);
 		lua_pushvalue(L, lua_upvalueindex(TYPE_ERROR));
 		lua_pushinteger(L, message->id);
 		pushstring(L, buffer, size);
@@ -450,6 +534,42 @@ lpack(lua_State *L) {
 	return 2;
 }
 
+/*
+	userdata queue
+	integer fd
+	integer agent (nil to remove the route)
+	integer client
+
+	return userdata queue
+
+	The packages from fd are sent to agent (in PTYPE_CLIENT, the source is client) by netpack.filter directly,
+	and lua is only entered for other events.
+ */
+static int
+lroute(lua_State *L) {
+	int fd = luaL_checkinteger(L, 2);
+	if (lua_isnoneornil(L, 3)) {
+		remove_route(lua_touserdata(L,1), fd);
+		lua_settop(L, 1);
+		return 1;
+	}
+	uint32_t agent = (uint32_t)luaL_checkinteger(L, 3);
+	uint32_t client = (uint32_t)luaL_optinteger(L, 4, 0);
+	struct queue *q = get_queue(L);
+	struct route * r = find_route(q, fd);
+	if (r == NULL) {
+		int h = hash_fd(fd);
+		r = skynet_malloc(sizeof(*r));
+		r->fd = fd;
+		r->next = q->route[h];
+		q->route[h] = r;
+	}
+	r->agent = agent;
+	r->client = client;
+	lua_settop(L, 1);
+	return 1;
+}
+
 static int
 ltostring(lua_State *L) {
 	void * ptr = lua_touserdata(L, 1);
@@ -472,6 +592,7 @@ luaopen_netpack(lua_State *L) {
 		{ "pack", lpack },
 		{ "clear", lclear },
 		{ "tostring", ltostring },
+		{ "route", lroute },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
@@ -483,8 +604,10 @@ luaopen_netpack(lua_State *L) {
 	lua_pushliteral(L, "open");
 	lua_pushliteral(L, "close");
 	lua_pushliteral(L, "warning");
+	// the context for route_data
+	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context");
 
-	lua_pushcclosure(L, lfilter, 6); //6upvalueڰskynet socket typeתӦcmd string
+	lua_pushcclosure(L, lfilter, 7); //7upvalueڰskynet socket typeתӦcmd string
 	lua_setfield(L, -2, "filter");
 
 	return 1;
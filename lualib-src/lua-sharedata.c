@@ -4,6 +4,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "atomic.h"
 
 #define KEYTYPE_INTEGER 0
@@ -17,11 +23,13 @@
 #define VALUETYPE_INTEGER 5
 
 struct table;
+struct image;
 
 union value {
 	lua_Number n;
 	lua_Integer d;
 	struct table * tbl;
+	int index;	// the subtable in an image : the index of the table directory
 	int string;
 	int boolean;
 };
@@ -36,10 +44,18 @@ struct node {
 	uint8_t nocolliding;	// 0 means colliding slot
 };
 
+/*
+	A version of the conf has a root table and a lua state for its strings (with the state in slot 1).
+	The tables are immutable, so a new version shares the unchanged subtables of the old one (by
+	table.ref), and only the changed tables and their ancestors are new. A table keeps the strings
+	in the lua state where it's created, the lua state is closed after all of its tables are deleted
+	(state.tables).
+ */
 struct state {
 	int dirty;
 	int ref;
 	struct table * root;
+	int tables;	// the number of tables use this lua state
 };
 
 struct table {
@@ -49,12 +65,84 @@ struct table {
 	union value * array;
 	struct node * hash;
 	lua_State * L;
+	struct image * image;	// the image of the table (L is NULL), or NULL
+	int ref;	// the number of parents (or root), only the host changes it
 };
 
+/*
+	An image is a file of the tables (see ldumpconf), mapped read-only and shared by the processes.
+	The tables are used in place : the strings (values and keys) are the offsets of the strings in the file
+	(uint32_t length, bytes and '\0'), and the subtables are the indexes of the table directory.
+	It's position-independent and in the native byte order and layout, so an image can only be loaded by
+	the same build (version, value_size and node_size of the header). All the tables of an image use one
+	state, and the file is unmapped after the last one is deleted.
+
+	The file : image_header, image_table[tables], then the arraytype, array and hash of each table (aligned
+	to 8), and the strings. The content is trusted, only the header and the directory are checked when loading.
+ */
+#define IMAGE_MAGIC 0x4d494453	// "SDIM"
+#define IMAGE_VERSION 1
+#define IMAGE_ALIGN(sz) (((sz) + 7) & ~(size_t)7)
+
+struct image_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t value_size;
+	uint32_t node_size;
+	uint32_t tables;
+	uint32_t reserved;
+	uint64_t size;	// size of file
+};
+
+struct image_table {
+	int32_t sizearray;
+	int32_t sizehash;
+	int32_t ref;	// the number of parents in the image (1 for root)
+	int32_t reserved;
+	uint64_t arraytype;	// offsets in the file
+	uint64_t array;
+	uint64_t hash;
+};
+
+struct image {
+	struct state s;
+	void * base;
+	size_t size;
+	struct table tables[1];	// root is tables[0]
+};
+
+static inline struct state *
+getstate(struct table *tbl) {
+	if (tbl->image)
+		return &tbl->image->s;
+	return lua_touserdata(tbl->L, 1);
+}
+
+static inline const char *
+getstring(struct table *tbl, int id, size_t *sz) {
+	if (tbl->image) {
+		const char * str = (const char *)tbl->image->base + id;
+		uint32_t len;
+		memcpy(&len, str, sizeof(len));
+		*sz = len;
+		return str + sizeof(len);
+	}
+	return lua_tolstring(tbl->L, id, sz);
+}
+
+static inline struct table *
+subtable(struct table *tbl, const union value *v) {
+	if (tbl->image)
+		return &tbl->image->tables[v->index];
+	return v->tbl;
+}
+
 struct context {
 	lua_State * L;
 	struct table * tbl;
+	struct table * old;	// the table at the same place in the old version, or NULL
 	int string_index;
+	int tables;
 };
 
 struct ctrl {
@@ -119,8 +207,28 @@ stringindex(struct context *ctx, const char * str, size_t sz) {
 
 static int convtable(lua_State *L);
 
+static int same_table(lua_State *L, int index, struct table *t);
+
+/*
+	Reuse the old subtable if the new one isn't changed : it isn't in the dirty set (convtable arg 3),
+	or the same as the old one when there is no dirty set.
+ */
+static int
+reusable(lua_State *L, int index, struct table *old) {
+	if (old == NULL)
+		return 0;
+	if (lua_istable(L, 3)) {
+		int unchanged;
+		lua_pushvalue(L, index);
+		unchanged = lua_rawget(L, 3) == LUA_TNIL;
+		lua_pop(L, 1);
+		return unchanged;
+	}
+	return same_table(L, index, old);
+}
+
 static void
-setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
+setvalue(struct context * ctx, lua_State *L, int index, struct node *n, struct table *old) {
 	int vt = lua_type(L, index);
 	switch(vt) {
 	case LUA_TNIL:
@@ -148,6 +256,14 @@ setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 		break;
 	case LUA_TTABLE: {
 		struct table *tbl = ctx->tbl;
+		struct table *oldtbl = ctx->old;
+		int absidx = lua_absindex(L, index);
+		if (reusable(L, absidx, old)) {
+			++old->ref;
+			n->v.tbl = old;
+			n->valuetype = VALUETYPE_TABLE;
+			break;
+		}
 		ctx->tbl = (struct table *)malloc(sizeof(struct table));
 		if (ctx->tbl == NULL) {
 			ctx->tbl = tbl;
@@ -155,18 +271,22 @@ setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 			// never get here
 		}
 		memset(ctx->tbl, 0, sizeof(struct table));
-		int absidx = lua_absindex(L, index);
+		ctx->tbl->ref = 1;
+		ctx->old = old;
+		++ctx->tables;
 
 		lua_pushcfunction(L, convtable);
 		lua_pushvalue(L, absidx);
 		lua_pushlightuserdata(L, ctx);
+		lua_pushvalue(L, 3);
 
-		lua_call(L, 2, 0);
+		lua_call(L, 3, 0);
 
 		n->v.tbl = ctx->tbl;
 		n->valuetype = VALUETYPE_TABLE;
 
 		ctx->tbl = tbl;
+		ctx->old = oldtbl;
 
 		break;
 	}
@@ -176,10 +296,43 @@ setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 	}
 }
 
+static struct table *
+old_arraytable(struct context *ctx, int key) {
+	struct table *old = ctx->old;
+	if (old && key > 0 && key <= old->sizearray && old->arraytype[key-1] == VALUETYPE_TABLE)
+		return subtable(old, &old->array[key-1]);
+	return NULL;
+}
+
+static struct node * lookup_key(struct table *tbl, uint32_t keyhash, int key, int keytype, const char *str, size_t sz);
+
+// the old subtable of the key (at index), when the value (at index+1) is a table
+static struct table *
+old_subtable(struct context *ctx, lua_State *L, int index) {
+	struct table *old = ctx->old;
+	struct node *n;
+	if (old == NULL || lua_type(L, index + 1) != LUA_TTABLE)
+		return NULL;
+	if (lua_type(L, index) == LUA_TNUMBER) {
+		int key = (int)lua_tointeger(L, index);
+		if (key > 0 && key <= old->sizearray) {
+			return old_arraytable(ctx, key);
+		}
+		n = lookup_key(old, (uint32_t)key, key, KEYTYPE_INTEGER, NULL, 0);
+	} else {
+		size_t sz = 0;
+		const char * str = lua_tolstring(L, index, &sz);
+		n = lookup_key(old, calchash(str, sz), 0, KEYTYPE_STRING, str, sz);
+	}
+	if (n && n->valuetype == VALUETYPE_TABLE)
+		return subtable(old, &n->v);
+	return NULL;
+}
+
 static void
-setarray(struct context *ctx, lua_State *L, int index, int key) {
+setarray(struct context *ctx, lua_State *L, int index, int key, struct table *old) {
 	struct node n;
-	setvalue(ctx, L, index, &n);
+	setvalue(ctx, L, index, &n, old);
 	struct table *tbl = ctx->tbl;
 	--key;	// base 0
 	tbl->arraytype[key] = n.valuetype;
@@ -216,7 +369,7 @@ fillnocolliding(lua_State *L, struct context *ctx) {
 		int keytype;
 		uint32_t keyhash;
 		if (!ishashkey(ctx, L, -2, &key, &keyhash, &keytype)) {
-			setarray(ctx, L, -1, key);
+			setarray(ctx, L, -1, key, old_subtable(ctx, L, -2));
 		} else {
 			struct node * n = &tbl->hash[keyhash % tbl->sizehash];
 			if (n->valuetype == VALUETYPE_NIL) {
@@ -225,7 +378,7 @@ fillnocolliding(lua_State *L, struct context *ctx) {
 				n->keyhash = keyhash;
 				n->next = -1;
 				n->nocolliding = 1;
-				setvalue(ctx, L, -1, n);	// set n->v , n->valuetype
+				setvalue(ctx, L, -1, n, old_subtable(ctx, L, -2));	// set n->v , n->valuetype
 			}
 		}
 		lua_pop(L,1);
@@ -262,7 +415,7 @@ fillcolliding(lua_State *L, struct context *ctx) {
 				n->keytype = keytype;
 				n->keyhash = keyhash;
 				n->nocolliding = 0;
-				setvalue(ctx, L, -1, n);	// set n->v , n->valuetype
+				setvalue(ctx, L, -1, n, old_subtable(ctx, L, -2));	// set n->v , n->valuetype
 			}
 		}
 		lua_pop(L,1);
@@ -271,6 +424,7 @@ fillcolliding(lua_State *L, struct context *ctx) {
 
 // table need convert
 // struct context * ctx
+// dirty set (or nil)
 static int
 convtable(lua_State *L) {
 	int i;
@@ -312,7 +466,7 @@ convtable(lua_State *L) {
 		int i;
 		for (i=1;i<=sizearray;i++) {
 			lua_rawgeti(L, 1, i);
-			setarray(ctx, L, -1, i);
+			setarray(ctx, L, -1, i, lua_istable(L, -1) ? old_arraytable(ctx, i) : NULL);
 			lua_pop(L,1);
 		}
 	}
@@ -322,22 +476,40 @@ memerror:
 	return luaL_error(L, "memory error");
 }
 
+// building is the lua state of a failed conversion, which is closed already
 static void
-delete_tbl(struct table *tbl) {
+delete_tbl(struct table *tbl, lua_State *building) {
 	int i;
+	struct state *s;
+	if (--tbl->ref > 0)
+		return;
 	for (i=0;i<tbl->sizearray;i++) {
 		if (tbl->arraytype[i] == VALUETYPE_TABLE) {
-			delete_tbl(tbl->array[i].tbl);
+			delete_tbl(subtable(tbl, &tbl->array[i]), building);
 		}
 	}
 	for (i=0;i<tbl->sizehash;i++) {
 		if (tbl->hash[i].valuetype == VALUETYPE_TABLE) {
-			delete_tbl(tbl->hash[i].v.tbl);
+			delete_tbl(subtable(tbl, &tbl->hash[i].v), building);
+		}
+	}
+	if (tbl->image) {
+		struct image *img = tbl->image;
+		if (--img->s.tables == 0) {
+			munmap(img->base, img->size);
+			free(img);
 		}
+		return;
 	}
 	free(tbl->arraytype);
 	free(tbl->array);
 	free(tbl->hash);
+	if (tbl->L && tbl->L != building) {
+		s = lua_touserdata(tbl->L, 1);
+		if (--s->tables == 0) {
+			lua_close(tbl->L);
+		}
+	}
 	free(tbl);
 }
 
@@ -356,8 +528,9 @@ pconv(lua_State *L) {
 	lua_pushcfunction(pL, convtable);
 	lua_pushvalue(pL,1);
 	lua_pushlightuserdata(pL, ctx);
+	lua_pushvalue(pL,3);
 
-	ret = lua_pcall(pL, 2, 0, 0);
+	ret = lua_pcall(pL, 3, 0, 0);
 	if (ret != LUA_OK) {
 		size_t sz = 0;
 		const char * error = lua_tolstring(pL, -1, &sz);
@@ -382,6 +555,7 @@ convert_stringmap(struct context *ctx, struct table *tbl) {
 	s->dirty = 0;
 	s->ref = 0;
 	s->root = tbl;
+	s->tables = ctx->tables;
 	lua_replace(L, 1);
 	lua_replace(L, -2);
 
@@ -399,15 +573,32 @@ convert_stringmap(struct context *ctx, struct table *tbl) {
 	lua_gc(L, LUA_GCCOLLECT, 0);
 }
 
+/*
+	table source
+	lightuserdata old version (optional)
+	table dirty set (optional) : the changed tables of source since the old version, and their ancestors
+
+	Share the subtables of the old version which aren't in the dirty set. If there is no dirty set,
+	share the ones which have the same content.
+ */
 static int
 lnewconf(lua_State *L) {
 	int ret;
 	struct context ctx;
 	struct table * tbl = NULL;
 	luaL_checktype(L,1,LUA_TTABLE);
+	if (!lua_isnoneornil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TLIGHTUSERDATA);
+	}
+	if (!lua_isnoneornil(L, 3)) {
+		luaL_checktype(L, 3, LUA_TTABLE);
+	}
+	lua_settop(L, 3);
 	ctx.L = luaL_newstate();
 	ctx.tbl = NULL;
+	ctx.old = lua_touserdata(L, 2);
 	ctx.string_index = 1;	// 1 reserved for dirty flag
+	ctx.tables = 1;	// root
 	if (ctx.L == NULL) {
 		lua_pushliteral(L, "memory error");
 		goto error;
@@ -421,6 +612,7 @@ lnewconf(lua_State *L) {
 		goto error;
 	}
 	memset(tbl, 0, sizeof(struct table));
+	tbl->ref = 1;
 	ctx.tbl = tbl;
 
 	lua_pushcfunction(ctx.L, pconv);
@@ -446,7 +638,7 @@ error:
 		lua_close(ctx.L);
 	}
 	if (tbl) {
-		delete_tbl(tbl);
+		delete_tbl(tbl, ctx.L);
 	}
 	lua_error(L);
 	return -1;
@@ -461,16 +653,310 @@ get_table(lua_State *L, int index) {
 	return tbl;
 }
 
+// the lua state is closed with the last table which uses it
 static int
 ldeleteconf(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	lua_close(tbl->L);
-	delete_tbl(tbl);
+	delete_tbl(tbl, NULL);
 	return 0;
 }
 
+// the index of the string in the string map (at index 3), add it if it's new
+static uint32_t
+dump_string(lua_State *L, struct table *tbl, int id, size_t *poolsize) {
+	size_t sz = 0;
+	const char * str = getstring(tbl, id, &sz);
+	uint32_t offset;
+	lua_pushlstring(L, str, sz);
+	if (lua_rawget(L, 3) == LUA_TNUMBER) {
+		offset = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		return offset;
+	}
+	lua_pop(L, 1);
+	if (sz > UINT32_MAX) {
+		luaL_error(L, "String is too long");
+	}
+	offset = (uint32_t)*poolsize;
+	*poolsize += (sizeof(uint32_t) + sz + 1 + 3) & ~(size_t)3;
+	lua_pushlstring(L, str, sz);
+	lua_pushinteger(L, offset);
+	lua_rawset(L, 3);
+	lua_pushlstring(L, str, sz);
+	lua_rawseti(L, 4, lua_rawlen(L, 4) + 1);
+	return offset;
+}
+
+// the index of the table in the table map (at index 2), add it if it's new, and count the reference (n != NULL)
+static int
+dump_table(lua_State *L, struct table *tbl, int *n) {
+	int index;
+	lua_pushlightuserdata(L, tbl);
+	if (lua_rawget(L, 2) == LUA_TNUMBER) {
+		index = (int)lua_tointeger(L, -1);
+	} else {
+		assert(n);
+		index = (*n)++;
+		lua_pushlightuserdata(L, tbl);
+		lua_pushinteger(L, index);
+		lua_rawset(L, 2);
+		lua_pushlightuserdata(L, tbl);
+		lua_rawseti(L, 5, index + 1);
+	}
+	lua_pop(L, 1);
+	if (n) {
+		lua_rawgeti(L, 6, index + 1);
+		lua_pushinteger(L, lua_tointeger(L, -1) + 1);
+		lua_rawseti(L, 6, index + 1);
+		lua_pop(L, 1);
+	}
+	return index;
+}
+
+static struct table *
+dump_get(lua_State *L, int i) {
+	struct table *tbl;
+	lua_rawgeti(L, 5, i + 1);
+	tbl = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return tbl;
+}
+
+static void
+dump_value(lua_State *L, struct table *tbl, uint8_t vt, const union value *v, union value *out, size_t *poolsize, int *n) {
+	switch (vt) {
+	case VALUETYPE_REAL:
+		out->n = v->n;
+		break;
+	case VALUETYPE_INTEGER:
+		out->d = v->d;
+		break;
+	case VALUETYPE_BOOLEAN:
+		out->boolean = v->boolean;
+		break;
+	case VALUETYPE_STRING:
+		out->string = (int)dump_string(L, tbl, v->string, poolsize);
+		break;
+	case VALUETYPE_TABLE:
+		out->index = dump_table(L, subtable(tbl, v), n);
+		break;
+	}
+}
+
+/*
+	lightuserdata conf
+	return string : the image of conf, see struct image_header. load it by lloadconf.
+ */
+static int
+ldumpconf(lua_State *L) {
+	struct table *root = get_table(L, 1);
+	size_t poolsize = 0;
+	size_t size, offset, stroffset;
+	int n = 0;
+	int i, j;
+	lua_settop(L, 1);
+	lua_newtable(L);	// 2 : table -> index
+	lua_newtable(L);	// 3 : string -> offset in the strings
+	lua_newtable(L);	// 4 : strings
+	lua_newtable(L);	// 5 : tables
+	lua_newtable(L);	// 6 : refs of tables
+
+	// collect the tables and strings, and the layout
+	dump_table(L, root, &n);
+	size = sizeof(struct image_header);
+	for (i=0;i<n;i++) {
+		struct table *tbl = dump_get(L, i);
+		union value tmp;
+		for (j=0;j<tbl->sizearray;j++) {
+			dump_value(L, tbl, tbl->arraytype[j], &tbl->array[j], &tmp, &poolsize, &n);
+		}
+		for (j=0;j<tbl->sizehash;j++) {
+			struct node *node = &tbl->hash[j];
+			if (node->keytype == KEYTYPE_STRING) {
+				dump_string(L, tbl, node->key, &poolsize);
+			}
+			dump_value(L, tbl, node->valuetype, &node->v, &tmp, &poolsize, &n);
+		}
+	}
+	size += IMAGE_ALIGN(n * sizeof(struct image_table));
+	for (i=0;i<n;i++) {
+		struct table *tbl = dump_get(L, i);
+		size += IMAGE_ALIGN(tbl->sizearray);
+		size += tbl->sizearray * sizeof(union value);
+		size += tbl->sizehash * sizeof(struct node);
+	}
+	stroffset = size;
+	size += poolsize;
+	if (size > INT_MAX) {
+		return luaL_error(L, "The image is too large (%d MB)", (int)(size >> 20));
+	}
+
+	luaL_Buffer b;
+	char * buf = luaL_buffinitsize(L, &b, size);
+	memset(buf, 0, size);
+	struct image_header *h = (struct image_header *)buf;
+	h->magic = IMAGE_MAGIC;
+	h->version = IMAGE_VERSION;
+	h->value_size = sizeof(union value);
+	h->node_size = sizeof(struct node);
+	h->tables = n;
+	h->size = size;
+	struct image_table *dir = (struct image_table *)(buf + sizeof(struct image_header));
+	offset = sizeof(struct image_header) + IMAGE_ALIGN(n * sizeof(struct image_table));
+	for (i=0;i<n;i++) {
+		struct table *tbl = dump_get(L, i);
+		struct image_table *t = &dir[i];
+		t->sizearray = tbl->sizearray;
+		t->sizehash = tbl->sizehash;
+		lua_rawgeti(L, 6, i + 1);
+		t->ref = (int32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+
+		t->arraytype = offset;
+		if (tbl->sizearray)
+			memcpy(buf + offset, tbl->arraytype, tbl->sizearray);
+		offset += IMAGE_ALIGN(tbl->sizearray);
+
+		t->array = offset;
+		union value * array = (union value *)(buf + offset);
+		for (j=0;j<tbl->sizearray;j++) {
+			dump_value(L, tbl, tbl->arraytype[j], &tbl->array[j], &array[j], &poolsize, NULL);
+			if (tbl->arraytype[j] == VALUETYPE_STRING)
+				array[j].string += stroffset;
+		}
+		offset += tbl->sizearray * sizeof(union value);
+
+		t->hash = offset;
+		struct node * hash = (struct node *)(buf + offset);
+		for (j=0;j<tbl->sizehash;j++) {
+			struct node *src = &tbl->hash[j];
+			struct node *dst = &hash[j];
+			dst->key = src->key;
+			if (src->keytype == KEYTYPE_STRING)
+				dst->key = (int)(dump_string(L, tbl, src->key, &poolsize) + stroffset);
+			dst->next = src->next;
+			dst->keyhash = src->keyhash;
+			dst->keytype = src->keytype;
+			dst->valuetype = src->valuetype;
+			dst->nocolliding = src->nocolliding;
+			dump_value(L, tbl, src->valuetype, &src->v, &dst->v, &poolsize, NULL);
+			if (src->valuetype == VALUETYPE_STRING)
+				dst->v.string += stroffset;
+		}
+		offset += tbl->sizehash * sizeof(struct node);
+	}
+	assert(offset == stroffset);
+	// strings
+	int nstr = lua_rawlen(L, 4);
+	for (i=1;i<=nstr;i++) {
+		size_t sz = 0;
+		lua_rawgeti(L, 4, i);
+		const char * str = lua_tolstring(L, -1, &sz);
+		uint32_t len = (uint32_t)sz;
+		memcpy(buf + offset, &len, sizeof(len));
+		memcpy(buf + offset + sizeof(len), str, sz);
+		offset += (sizeof(uint32_t) + sz + 1 + 3) & ~(size_t)3;
+		lua_pop(L, 1);
+	}
+	assert(offset == size);
+	luaL_pushresultsize(&b, size);
+
+	return 1;
+}
+
+static const char *
+check_image(const char *base, size_t size) {
+	const struct image_header *h = (const struct image_header *)base;
+	size_t i;
+	if (size < sizeof(*h) || h->magic != IMAGE_MAGIC)
+		return "Not a sharedata image";
+	if (h->version != IMAGE_VERSION || h->value_size != sizeof(union value) || h->node_size != sizeof(struct node))
+		return "The image is built by another version";
+	if (h->size != size)
+		return "The image is truncated";
+	if (h->tables == 0 || (size - sizeof(*h)) / sizeof(struct image_table) < h->tables)
+		return "Invalid table directory";
+	const struct image_table *dir = (const struct image_table *)(base + sizeof(*h));
+	for (i=0;i<h->tables;i++) {
+		const struct image_table *t = &dir[i];
+		if (t->sizearray < 0 || t->sizehash < 0 || t->ref <= 0
+			|| t->arraytype > size || size - t->arraytype < (size_t)t->sizearray
+			|| t->array % 8 != 0 || t->array > size || (size - t->array) / sizeof(union value) < (size_t)t->sizearray
+			|| t->hash % 8 != 0 || t->hash > size || (size - t->hash) / sizeof(struct node) < (size_t)t->sizehash) {
+			return "Invalid table directory";
+		}
+	}
+	return NULL;
+}
+
+/*
+	string filename : the image made by ldumpconf
+	return lightuserdata conf
+
+	The tables are used in place in the file mapped, so the pages are shared with the other processes
+	which load the same file. Replace the file by rename rather than writing it, the running processes
+	may use it.
+ */
+static int
+lloadconf(lua_State *L) {
+	const char * filename = luaL_checkstring(L, 1);
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return luaL_error(L, "Can't open %s : %s", filename, strerror(errno));
+	}
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return luaL_error(L, "Can't stat %s : %s", filename, strerror(errno));
+	}
+	size_t size = st.st_size;
+	if (size < sizeof(struct image_header)) {
+		close(fd);
+		return luaL_error(L, "%s : Not a sharedata image", filename);
+	}
+	char * base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return luaL_error(L, "Can't map %s : %s", filename, strerror(errno));
+	}
+	const char * err = check_image(base, size);
+	if (err) {
+		munmap(base, size);
+		return luaL_error(L, "%s : %s", filename, err);
+	}
+	const struct image_header *h = (const struct image_header *)base;
+	const struct image_table *dir = (const struct image_table *)(base + sizeof(*h));
+	int n = h->tables;
+	struct image * img = malloc(sizeof(*img) + (n - 1) * sizeof(struct table));
+	if (img == NULL) {
+		munmap(base, size);
+		return luaL_error(L, "memory error");
+	}
+	img->s.dirty = 0;
+	img->s.ref = 0;
+	img->s.root = &img->tables[0];
+	img->s.tables = n;
+	img->base = base;
+	img->size = size;
+	int i;
+	for (i=0;i<n;i++) {
+		struct table *tbl = &img->tables[i];
+		tbl->sizearray = dir[i].sizearray;
+		tbl->sizehash = dir[i].sizehash;
+		tbl->arraytype = (uint8_t *)(base + dir[i].arraytype);
+		tbl->array = (union value *)(base + dir[i].array);
+		tbl->hash = (struct node *)(base + dir[i].hash);
+		tbl->L = NULL;
+		tbl->image = img;
+		tbl->ref = dir[i].ref;
+	}
+	lua_pushlightuserdata(L, &img->tables[0]);
+
+	return 1;
+}
+
 static void
-pushvalue(lua_State *L, lua_State *sL, uint8_t vt, union value *v) {
+pushvalue(lua_State *L, struct table *tbl, uint8_t vt, union value *v) {
 	switch(vt) {
 	case VALUETYPE_REAL:
 		lua_pushnumber(L, v->n);
@@ -480,7 +966,7 @@ pushvalue(lua_State *L, lua_State *sL, uint8_t vt, union value *v) {
 		break;
 	case VALUETYPE_STRING: {
 		size_t sz = 0;
-		const char *str = lua_tolstring(sL, v->string, &sz);
+		const char *str = getstring(tbl, v->string, &sz);
 		lua_pushlstring(L, str, sz);
 		break;
 	}
@@ -488,7 +974,7 @@ pushvalue(lua_State *L, lua_State *sL, uint8_t vt, union value *v) {
 		lua_pushboolean(L, v->boolean);
 		break;
 	case VALUETYPE_TABLE:
-		lua_pushlightuserdata(L, v->tbl);
+		lua_pushlightuserdata(L, subtable(tbl, v));
 		break;
 	default:
 		lua_pushnil(L);
@@ -513,7 +999,7 @@ lookup_key(struct table *tbl, uint32_t keyhash, int key, int keytype, const char
 				// n->keytype == KEYTYPE_STRING
 				if (keytype == KEYTYPE_STRING) {
 					size_t sz2 = 0;
-					const char * str2 = lua_tolstring(tbl->L, n->key, &sz2);
+					const char * str2 = getstring(tbl, n->key, &sz2);
 					if (sz == sz2 && memcmp(str,str2,sz) == 0) {
 						return n;
 					}
@@ -527,6 +1013,92 @@ lookup_key(struct table *tbl, uint32_t keyhash, int key, int keytype, const char
 	}
 }
 
+static int
+same_value(lua_State *L, int index, uint8_t vt, union value *v, struct table *t) {
+	switch (lua_type(L, index)) {
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, index)) {
+			return vt == VALUETYPE_INTEGER && v->d == lua_tointeger(L, index);
+		} else {
+			return vt == VALUETYPE_REAL && v->n == lua_tonumber(L, index);
+		}
+	case LUA_TSTRING: {
+		size_t sz = 0, sz2 = 0;
+		const char * str;
+		const char * str2;
+		if (vt != VALUETYPE_STRING)
+			return 0;
+		str = lua_tolstring(L, index, &sz);
+		str2 = getstring(t, v->string, &sz2);
+		return sz == sz2 && memcmp(str, str2, sz) == 0;
+	}
+	case LUA_TBOOLEAN:
+		return vt == VALUETYPE_BOOLEAN && v->boolean == lua_toboolean(L, index);
+	case LUA_TTABLE:
+		return vt == VALUETYPE_TABLE && same_table(L, lua_absindex(L, index), subtable(t, v));
+	default:
+		return 0;
+	}
+}
+
+// compare the lua table at index with the table of the old version
+static int
+same_table(lua_State *L, int index, struct table *t) {
+	int sizearray = lua_rawlen(L, index);
+	int narray = 0, nhash = 0;
+	int i;
+	if (sizearray != t->sizearray)
+		return 0;
+	luaL_checkstack(L, 3, NULL);
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		uint8_t vt = VALUETYPE_NIL;
+		union value *v = NULL;
+		struct node *n = NULL;
+		int kt = lua_type(L, -2);
+		if (kt == LUA_TNUMBER) {
+			int key;
+			if (!lua_isinteger(L, -2)) {
+				lua_pop(L, 2);
+				return 0;
+			}
+			key = (int)lua_tointeger(L, -2);
+			if (key > 0 && key <= sizearray) {
+				++narray;
+				vt = t->arraytype[key-1];
+				v = &t->array[key-1];
+			} else {
+				++nhash;
+				n = lookup_key(t, (uint32_t)key, key, KEYTYPE_INTEGER, NULL, 0);
+			}
+		} else if (kt == LUA_TSTRING) {
+			size_t sz = 0;
+			const char * str = lua_tolstring(L, -2, &sz);
+			++nhash;
+			n = lookup_key(t, calchash(str, sz), 0, KEYTYPE_STRING, str, sz);
+		} else {
+			lua_pop(L, 2);
+			return 0;
+		}
+		if (n) {
+			vt = n->valuetype;
+			v = &n->v;
+		}
+		if (v == NULL || !same_value(L, -1, vt, v, t)) {
+			lua_pop(L, 2);
+			return 0;
+		}
+		lua_pop(L, 1);
+	}
+	if (nhash != t->sizehash)
+		return 0;
+	for (i=0;i<sizearray;i++) {
+		if (t->arraytype[i] != VALUETYPE_NIL)
+			--narray;
+	}
+	return narray == 0;
+}
+
 static int
 lindexconf(lua_State *L) {
 	struct table *tbl = get_table(L,1);
@@ -543,7 +1115,7 @@ lindexconf(lua_State *L) {
 		key = (int)lua_tointeger(L, 2);
 		if (key > 0 && key <= tbl->sizearray) {
 			--key;
-			pushvalue(L, tbl->L, tbl->arraytype[key], &tbl->array[key]);
+			pushvalue(L, tbl, tbl->arraytype[key], &tbl->array[key]);
 			return 1;
 		}
 		keytype = KEYTYPE_INTEGER;
@@ -556,7 +1128,7 @@ lindexconf(lua_State *L) {
 
 	struct node *n = lookup_key(tbl, keyhash, key, keytype, str, sz);
 	if (n) {
-		pushvalue(L, tbl->L, n->valuetype, &n->v);
+		pushvalue(L, tbl, n->valuetype, &n->v);
 		return 1;
 	} else {
 		return 0;
@@ -564,12 +1136,12 @@ lindexconf(lua_State *L) {
 }
 
 static void
-pushkey(lua_State *L, lua_State *sL, struct node *n) {
+pushkey(lua_State *L, struct table *tbl, struct node *n) {
 	if (n->keytype == KEYTYPE_INTEGER) {
 		lua_pushinteger(L, n->key);
 	} else {
 		size_t sz = 0;
-		const char * str = lua_tolstring(sL, n->key, &sz);
+		const char * str = getstring(tbl, n->key, &sz);
 		lua_pushlstring(L, str, sz);
 	}
 }
@@ -577,7 +1149,7 @@ pushkey(lua_State *L, lua_State *sL, struct node *n) {
 static int
 pushfirsthash(lua_State *L, struct table * tbl) {
 	if (tbl->sizehash) {
-		pushkey(L, tbl->L, &tbl->hash[0]);
+		pushkey(L, tbl, &tbl->hash[0]);
 		return 1;
 	} else {
 		return 0;
@@ -636,7 +1208,7 @@ lnextkey(lua_State *L) {
 		if (index == tbl->sizehash) {
 			return 0;
 		}
-		pushkey(L, tbl->L, n);
+		pushkey(L, tbl, n);
 		return 1;
 	} else {
 		return 0;
@@ -661,7 +1233,7 @@ static int
 releaseobj(lua_State *L) {
 	struct ctrl *c = lua_touserdata(L, 1);
 	struct table *tbl = c->root;
-	struct state *s = lua_touserdata(tbl->L, 1);
+	struct state *s = getstate(tbl);
 	ATOM_DEC(&s->ref);
 	c->root = NULL;
 	c->update = NULL;
@@ -672,7 +1244,7 @@ releaseobj(lua_State *L) {
 static int
 lboxconf(lua_State *L) {
 	struct table * tbl = get_table(L,1);	
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = getstate(tbl);
 	ATOM_INC(&s->ref);
 
 	struct ctrl * c = lua_newuserdata(L, sizeof(*c));
@@ -690,7 +1262,7 @@ lboxconf(lua_State *L) {
 static int
 lmarkdirty(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = getstate(tbl);
 	s->dirty = 1;
 	return 0;
 }
@@ -698,7 +1270,7 @@ lmarkdirty(lua_State *L) {
 static int
 lisdirty(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = getstate(tbl);
 	int d = s->dirty;
 	lua_pushboolean(L, d);
 	
@@ -708,7 +1280,7 @@ lisdirty(lua_State *L) {
 static int
 lgetref(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = getstate(tbl);
 	lua_pushinteger(L , s->ref);
 
 	return 1;
@@ -717,7 +1289,7 @@ lgetref(lua_State *L) {
 static int
 lincref(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = getstate(tbl);
 	int ref = ATOM_INC(&s->ref);
 	lua_pushinteger(L , ref);
 
@@ -727,7 +1299,7 @@ lincref(lua_State *L) {
 static int
 ldecref(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	struct state * s = lua_touserdata(tbl->L, 1);
+	struct state * s = getstate(tbl);
 	int ref = ATOM_DEC(&s->ref);
 	lua_pushinteger(L , ref);
 
@@ -768,6 +1340,8 @@ luaopen_sharedata_core(lua_State *L) {
 		// used by host
 		{ "new", lnewconf },
 		{ "delete", ldeleteconf },
+		{ "dump", ldumpconf },
+		{ "load", lloadconf },
 		{ "markdirty", lmarkdirty },
 		{ "getref", lgetref },
 		{ "incref", lincref },
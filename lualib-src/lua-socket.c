@@ -280,7 +280,7 @@ lreadall(lua_State *L) {
 	}
 	luaL_checktype(L,2,LUA_TTABLE);
 	luaL_Buffer b;
-	luaL_buffinit(L, &b);
+	luaL_buffinit(L, &b);
 	while(sb->head) {
 		struct buffer_node *current = sb->head;
 		luaL_addlstring(&b, current->msg + sb->offset, current->sz - sb->offset);
@@ -579,6 +579,32 @@ lsendlow(lua_State *L) {
 	return 0;
 }
 
+/*
+	socketdriver.broadcast(ids, buffer [, sz])
+	send one buffer to all the sockets in ids, the buffer is shared by them in socket thread.
+ */
+static int
+lbroadcast(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int n = lua_rawlen(L, 1);
+	int *ids = lua_newuserdata(L, (n > 0 ? n : 1) * sizeof(int));
+	int i;
+	for (i=0;i<n;i++) {
+		lua_rawgeti(L, 1, i+1);
+		int isnum;
+		ids[i] = lua_tointegerx(L, -1, &isnum);
+		if (!isnum) {
+			return luaL_error(L, "Invalid socket id at [%d]", i+1);
+		}
+		lua_pop(L, 1);
+	}
+	int sz = 0;
+	void *buffer = get_buffer(L, 2, &sz);
+	skynet_socket_broadcast(ctx, ids, n, buffer, sz);
+	return 0;
+}
+
 /* socketdriver.bind */
 static int
 lbind(lua_State *L) {
@@ -607,6 +633,39 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+/*
+	socketdriver.setwater(id, high, low [, policy])
+	policy is "drop" (default), "close" or "pause", see SOCKET_WATER_* in socket_server.h
+ */
+static int
+lsetwater(lua_State *L) {
+	static const char * policies[] = { "drop", "close", "pause", NULL };
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int high = luaL_checkinteger(L, 2);
+	int low = luaL_optinteger(L, 3, high / 2);
+	int policy = luaL_checkoption(L, 4, "drop", policies);
+	skynet_socket_setwater(ctx, id, high, low, policy);
+	return 0;
+}
+
+static int
+lreadsize(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int sz = luaL_checkinteger(L, 2);
+	skynet_socket_readsize(ctx, id, sz);
+	return 0;
+}
+
+static int
+lwritable(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	lua_pushboolean(L, skynet_socket_writable(ctx, id));
+	return 1;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -712,9 +771,13 @@ luaopen_socketdriver(lua_State *L) {
 		{ "listen", llisten },
 		{ "send", lsend },
 		{ "lsend", lsendlow },
+		{ "broadcast", lbroadcast },
 		{ "bind", lbind },
 		{ "start", lstart },
 		{ "nodelay", lnodelay },
+		{ "setwater", lsetwater },
+		{ "writable", lwritable },
+		{ "readsize", lreadsize },
 		{ "udp", ludp },
 		{ "udp_connect", ludp_connect },
 		{ "udp_send", ludp_send },
@@ -5,12 +5,16 @@
 #include <assert.h>
 #include <string.h>
 
-#include "rwlock.h"
 #include "skynet_malloc.h"
 #include "atomic.h"
 
+/*
+	The readers don't lock : a reader protects the copy by a hazard pointer (one for each thread) when it
+	gets the reference of the current copy, and the copy is freed after no hazard pointer points to it.
+	The writer of an object is the only one changes obj->copy.
+ */
+
 struct stm_object {
-	struct rwlock lock;
 	int reference;
 	struct stm_copy * copy;
 };
@@ -21,6 +25,39 @@ struct stm_copy {
 	void * msg;
 };
 
+struct hazard {
+	struct stm_copy * copy;
+	struct hazard * next;
+	char padding[64 - 2 * sizeof(void *)];	// one cache line for each thread
+};
+
+static struct hazard * H = NULL;	// the hazard pointers of all the threads, never freed
+static __thread struct hazard * T = NULL;
+
+static struct hazard *
+hazard_get() {
+	struct hazard * h = T;
+	if (h == NULL) {
+		h = skynet_malloc(sizeof(*h));
+		h->copy = NULL;
+		do {
+			h->next = H;
+		} while (!ATOM_CAS_POINTER(&H, h->next, h));
+		T = h;
+	}
+	return h;
+}
+
+// wait for the readers which are getting the reference of copy
+static void
+hazard_wait(struct stm_copy *copy) {
+	struct hazard * h = __atomic_load_n(&H, __ATOMIC_ACQUIRE);
+	while (h) {
+		while (__atomic_load_n(&h->copy, __ATOMIC_ACQUIRE) == copy) {}
+		h = h->next;
+	}
+}
+
 // msg should alloc by skynet_malloc 
 static struct stm_copy *
 stm_newcopy(void * msg, int32_t sz) {
@@ -35,7 +72,6 @@ stm_newcopy(void * msg, int32_t sz) {
 static struct stm_object *
 stm_new(void * msg, int32_t sz) {
 	struct stm_object * obj = skynet_malloc(sizeof(*obj));
-	rwlock_init(&obj->lock);
 	obj->reference = 1;
 	obj->copy = stm_newcopy(msg, sz);
 
@@ -47,6 +83,7 @@ stm_releasecopy(struct stm_copy *copy) {
 	if (copy == NULL)
 		return;
 	if (ATOM_DEC(&copy->reference) == 0) {
+		hazard_wait(copy);
 		skynet_free(copy->msg);
 		skynet_free(copy);
 	}
@@ -55,48 +92,56 @@ stm_releasecopy(struct stm_copy *copy) {
 static void
 stm_release(struct stm_object *obj) {
 	assert(obj->copy);
-	rwlock_wlock(&obj->lock);
 	// writer release the stm object, so release the last copy .
-	stm_releasecopy(obj->copy);
-	obj->copy = NULL;
-	if (--obj->reference > 0) {
-		// stm object grab by readers, reset the copy to NULL.
-		rwlock_wunlock(&obj->lock);
-		return;
+	struct stm_copy * copy = __atomic_exchange_n(&obj->copy, NULL, __ATOMIC_SEQ_CST);
+	stm_releasecopy(copy);
+	if (ATOM_DEC(&obj->reference) == 0) {
+		skynet_free(obj);
 	}
-	// no one grab the stm object, no need to unlock wlock.
-	skynet_free(obj);
 }
 
 static void
 stm_releasereader(struct stm_object *obj) {
-	rwlock_rlock(&obj->lock);
 	if (ATOM_DEC(&obj->reference) == 0) {
-		// last reader, no writer. so no need to unlock
+		// last reader, no writer.
 		assert(obj->copy == NULL);
 		skynet_free(obj);
-		return;
 	}
-	rwlock_runlock(&obj->lock);
 }
 
 static void
 stm_grab(struct stm_object *obj) {
-	rwlock_rlock(&obj->lock);
 	int ref = ATOM_FINC(&obj->reference);
-	rwlock_runlock(&obj->lock);
 	assert(ref > 0);
 }
 
+static inline struct stm_copy *
+stm_current(struct stm_object *obj) {
+	return __atomic_load_n(&obj->copy, __ATOMIC_SEQ_CST);
+}
+
+// get the reference of the current copy
 static struct stm_copy *
 stm_copy(struct stm_object *obj) {
-	rwlock_rlock(&obj->lock);
-	struct stm_copy * ret = obj->copy;
-	if (ret) {
-		int ref = ATOM_FINC(&ret->reference);
-		assert(ref > 0);
+	struct hazard * h = hazard_get();
+	struct stm_copy * ret;
+	for (;;) {
+		ret = stm_current(obj);
+		if (ret == NULL)
+			break;
+		__atomic_store_n(&h->copy, ret, __ATOMIC_SEQ_CST);
+		// ret can't be freed if it's still the current copy after the hazard pointer is set
+		if (stm_current(obj) != ret)
+			continue;
+		int ref = ret->reference;
+		while (ref > 0 && !ATOM_CAS(&ret->reference, ref, ref + 1)) {
+			ref = ret->reference;
+		}
+		if (ref > 0)
+			break;
+		// the writer released it just now
 	}
-	rwlock_runlock(&obj->lock);
+	__atomic_store_n(&h->copy, NULL, __ATOMIC_RELEASE);
 	
 	return ret;
 }
@@ -104,10 +149,7 @@ stm_copy(struct stm_object *obj) {
 static void
 stm_update(struct stm_object *obj, void *msg, int32_t sz) {
 	struct stm_copy *copy = stm_newcopy(msg, sz);
-	rwlock_wlock(&obj->lock);
-	struct stm_copy *oldcopy = obj->copy;
-	obj->copy = copy;
-	rwlock_wunlock(&obj->lock);
+	struct stm_copy *oldcopy = __atomic_exchange_n(&obj->copy, copy, __ATOMIC_SEQ_CST);
 
 	stm_releasecopy(oldcopy);
 }
@@ -205,6 +247,11 @@ lread(lua_State *L) {
 	struct boxreader * box = lua_touserdata(L, 1);
 	luaL_checktype(L, 2, LUA_TFUNCTION);
 
+	// the reader keeps the reference of lastcopy, so it can't be another copy at the same address
+	if (stm_current(box->obj) == box->lastcopy) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
 	struct stm_copy * copy = stm_copy(box->obj);
 	if (copy == box->lastcopy) {
 		// not update
@@ -232,6 +279,73 @@ lread(lua_State *L) {
 	}
 }
 
+/*
+	function f, reader1, reader2, ...
+	return false if none of them is updated, or true, f(msg1, sz1), f(msg2, sz2), ... (the first result,
+	or nil for the deleted object)
+
+	The copies are a consistent snapshot : get all the copies, and retry if any of them isn't current.
+	Each copy is current from the time it's got to the time it's checked, so they're current at the same time.
+ */
+static int
+lreadall(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	int n = lua_gettop(L) - 1;
+	int i;
+	for (i=2;i<=n+1;i++) {
+		if (!lua_getmetatable(L, i) || !lua_rawequal(L, -1, lua_upvalueindex(1))) {
+			return luaL_argerror(L, i, "Need a stm reader");
+		}
+		lua_pop(L, 1);
+	}
+	luaL_checkstack(L, n + 3, NULL);
+	struct stm_copy ** copies = lua_newuserdata(L, n * sizeof(struct stm_copy *));
+	int changed;
+	for (;;) {
+		for (i=0;i<n;i++) {
+			struct boxreader * box = lua_touserdata(L, i + 2);
+			copies[i] = stm_copy(box->obj);
+		}
+		for (i=0;i<n;i++) {
+			struct boxreader * box = lua_touserdata(L, i + 2);
+			if (stm_current(box->obj) != copies[i])
+				break;
+		}
+		if (i == n)
+			break;
+		for (i=0;i<n;i++) {
+			stm_releasecopy(copies[i]);
+		}
+	}
+	changed = 0;
+	for (i=0;i<n;i++) {
+		struct boxreader * box = lua_touserdata(L, i + 2);
+		if (copies[i] != box->lastcopy) {
+			changed = 1;
+		}
+		stm_releasecopy(box->lastcopy);
+		box->lastcopy = copies[i];
+	}
+	if (!changed) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	lua_pushboolean(L, 1);
+	for (i=0;i<n;i++) {
+		struct boxreader * box = lua_touserdata(L, i + 2);
+		struct stm_copy * copy = box->lastcopy;
+		if (copy) {
+			lua_pushvalue(L, 1);
+			lua_pushlightuserdata(L, copy->msg);
+			lua_pushinteger(L, copy->sz);
+			lua_call(L, 2, 1);
+		} else {
+			lua_pushnil(L);
+		}
+	}
+	return n + 1;
+}
+
 int
 luaopen_stm(lua_State *L) {
 	luaL_checkversion(L);
@@ -253,6 +367,7 @@ luaopen_stm(lua_State *L) {
 
 	luaL_Reg reader[] = {
 		{ "newcopy", lnewreader },
+		{ "readall", lreadall },
 		{ NULL, NULL },
 	};
 	lua_createtable(L, 0, 2);
@@ -5,6 +5,8 @@
 #include "lua.h"
 #include "lauxlib.h"
 #include "sproto.h"
+#include "spinlock.h"
+#include "atomic.h"
 
 #define MAX_GLOBALSPROTO 16
 #define ENCODE_BUFFERSIZE 2050
@@ -102,142 +104,328 @@ lquerytype(lua_State *L) {
 	return 0;
 }
 
-//encodeû
-struct encode_ud {
-	lua_State *L;
-	struct sproto_type *st;//
-	int tbl_index;//ָʼ͵table
-	const char * array_tag;//ָfield name
-	int array_index;//е
-	int deep;//
-	int iter_index;//
-};
+/*
+	The encoder and decoder walk the fields of sproto_type (sproto_fields) and read or write the lua table directly,
+	instead of sproto_encode/sproto_decode with a callback for each field. The wire format is the same as sproto.c.
+	The field names are the strings in sproto object, the pointers never change, so lua_getfield/lua_setfield find
+	the interned lua strings by the string cache of lua api.
+ */
+
+#define SIZEOF_LENGTH 4
+#define SIZEOF_HEADER 2
+#define SIZEOF_FIELD 2
+
+static inline int
+fill_size(uint8_t * data, int sz) {
+	data[0] = sz & 0xff;
+	data[1] = (sz >> 8) & 0xff;
+	data[2] = (sz >> 16) & 0xff;
+	data[3] = (sz >> 24) & 0xff;
+	return sz + SIZEOF_LENGTH;
+}
+
+static inline void
+write_uint32(uint8_t * buffer, uint32_t v) {
+	buffer[0] = v & 0xff;
+	buffer[1] = (v >> 8) & 0xff;
+	buffer[2] = (v >> 16) & 0xff;
+	buffer[3] = (v >> 24) & 0xff;
+}
+
+static inline void
+write_uint64(uint8_t * buffer, uint64_t v) {
+	write_uint32(buffer, (uint32_t)v);
+	write_uint32(buffer + 4, (uint32_t)(v >> 32));
+}
 
-//
+static inline void
+uint32_to_uint64(int negative, uint8_t *buffer) {
+	uint8_t v = negative ? 0xff : 0;
+	buffer[4] = v;
+	buffer[5] = v;
+	buffer[6] = v;
+	buffer[7] = v;
+}
+
+static int encode_struct(lua_State *L, const struct sproto_type *st, int tbl, uint8_t * buffer, int size, int deep);
+
+// return the size of content (without the length), -1 means the buffer is too small
 static int
-encode(const struct sproto_arg *args) {
-	struct encode_ud *self = args->ud;
-	lua_State *L = self->L;
-	if (self->deep >= ENCODE_DEEPLEVEL)//Ƕײ
-		return luaL_error(L, "The table is too deep");
-	if (args->index > 0) {//
-		if (args->tagname != self->array_tag) {//ʼһµ
-			// a new array
-			self->array_tag = args->tagname;//ֵ
-			lua_getfield(L, self->tbl_index, args->tagname);//ȡtable
-			if (lua_isnil(L, -1)) {//
-				if (self->array_index) {
-					lua_replace(L, self->array_index);
-				}
-				self->array_index = 0;
-				return SPROTO_CB_NOARRAY;
-			}
-			if (!lua_istable(L, -1)) {
-				return luaL_error(L, ".*%s(%d) should be a table (Is a %s)",
-					args->tagname, args->index, lua_typename(L, lua_type(L, -1)));
-			}
-			if (self->array_index) {
-				lua_replace(L, self->array_index);
-			} else {
-				self->array_index = lua_gettop(L);
-			}
+encode_integer_array(lua_State *L, const struct sproto_field *f, int arr, uint8_t *buffer, int size) {
+	uint8_t * header = buffer;
+	int intlen = sizeof(uint32_t);
+	int index;
+	if (size < 1)
+		return -1;
+	buffer++;
+	size--;
+	for (index = 1;; index++) {
+		lua_Integer v, vh;
+		int isnum;
+		lua_geti(L, arr, index);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			break;
+		}
+		v = lua_tointegerx(L, -1, &isnum);
+		if (!isnum) {
+			return luaL_error(L, ".%s[%d] is not an integer (Is a %s)",
+				f->name, index, lua_typename(L, lua_type(L, -1)));
 		}
-		if (args->mainindex >= 0) {
-			// use lua_next to iterate the table
-			// todo: check the key is equal to mainindex value
-
-			lua_pushvalue(L,self->iter_index);
-			if (!lua_next(L, self->array_index)) {
-				// iterate end
-				lua_pushnil(L);
-				lua_replace(L, self->iter_index);
-				return SPROTO_CB_NIL;
+		lua_pop(L, 1);
+		if (size < (int)sizeof(uint64_t))
+			return -1;
+		// notice: in lua 5.2, lua_Integer maybe 52bit
+		vh = v >> 31;
+		if (vh == 0 || vh == -1) {
+			write_uint32(buffer, (uint32_t)v);
+			if (intlen == sizeof(uint64_t)) {
+				uint32_to_uint64(v < 0, buffer);
 			}
-			lua_insert(L, -2);
-			lua_replace(L, self->iter_index);
 		} else {
-			lua_geti(L, self->array_index, args->index);
+			if (intlen == sizeof(uint32_t)) {
+				int i;
+				// rearrange
+				size -= (index-1) * sizeof(uint32_t);
+				if (size < (int)sizeof(uint64_t))
+					return -1;
+				buffer += (index-1) * sizeof(uint32_t);
+				for (i=index-2;i>=0;i--) {
+					int negative;
+					memcpy(header+1+i*sizeof(uint64_t), header+1+i*sizeof(uint32_t), sizeof(uint32_t));
+					negative = header[1+i*sizeof(uint64_t)+3] & 0x80;
+					uint32_to_uint64(negative, header+1+i*sizeof(uint64_t));
+				}
+				intlen = sizeof(uint64_t);
+			}
+			write_uint64(buffer, (uint64_t)v);
 		}
-	} else {//һֶ
-		lua_getfield(L, self->tbl_index, args->tagname);//ȡֶεֵ
+		size -= intlen;
+		buffer += intlen;
 	}
-	if (lua_isnil(L, -1)) {
-		lua_pop(L,1);
-		return SPROTO_CB_NIL;
+	if (buffer == header + 1) {
+		return 0;
 	}
-	switch (args->type) {
-	case SPROTO_TINTEGER: {
-		lua_Integer v;
-		lua_Integer vh;
-		int isnum;
-		v = lua_tointegerx(L, -1, &isnum);//ת
-		if(!isnum) {
-			return luaL_error(L, ".%s[%d] is not an integer (Is a %s)", 
-				args->tagname, args->index, lua_typename(L, lua_type(L, -1)));
-		}
-		lua_pop(L,1);
-		// notice: in lua 5.2, lua_Integer maybe 52bit
-		vh = v >> 31;
-		if (vh == 0 || vh == -1) {
-			*(uint32_t *)args->value = (uint32_t)v;
-			return 4;
+	*header = (uint8_t)intlen;
+	return buffer - header;
+}
+
+// encode the string or struct at the top of stack (and pop it) with length, -1 means the buffer is too small
+static int
+encode_object(lua_State *L, const struct sproto_field *f, int index, uint8_t *data, int size, int deep) {
+	int sz;
+	if (size < SIZEOF_LENGTH)
+		return -1;
+	if ((f->type & ~SPROTO_TARRAY) == SPROTO_TSTRING) {
+		size_t len = 0;
+		const char * str;
+		if (!lua_isstring(L, -1)) {
+			return luaL_error(L, ".%s[%d] is not a string (Is a %s)",
+				f->name, index, lua_typename(L, lua_type(L, -1)));
 		}
-		else {
-			*(uint64_t *)args->value = (uint64_t)v;
-			return 8;
+		str = lua_tolstring(L, -1, &len);
+		if (len > size - SIZEOF_LENGTH)
+			return -1;
+		memcpy(data + SIZEOF_LENGTH, str, len);
+		sz = (int)len;
+	} else {
+		if (!lua_istable(L, -1)) {
+			return luaL_error(L, ".%s[%d] is not a table (Is a %s)",
+				f->name, index, lua_typename(L, lua_type(L, -1)));
 		}
+		sz = encode_struct(L, f->st, lua_gettop(L), data + SIZEOF_LENGTH, size - SIZEOF_LENGTH, deep + 1);
+		if (sz < 0)
+			return -1;
 	}
-	case SPROTO_TBOOLEAN: {
-		int v = lua_toboolean(L, -1);
-		if (!lua_isboolean(L,-1)) {
-			return luaL_error(L, ".%s[%d] is not a boolean (Is a %s)",
-				args->tagname, args->index, lua_typename(L, lua_type(L, -1)));
+	lua_pop(L, 1);
+	return fill_size(data, sz);
+}
+
+// the array (table) is at the top of stack
+static int
+encode_array(lua_State *L, const struct sproto_field *f, uint8_t *data, int size, int deep) {
+	int arr = lua_gettop(L);
+	uint8_t * buffer;
+	int index;
+	if (size < SIZEOF_LENGTH)
+		return -1;
+	size -= SIZEOF_LENGTH;
+	buffer = data + SIZEOF_LENGTH;
+	switch (f->type & ~SPROTO_TARRAY) {
+	case SPROTO_TINTEGER: {
+		int sz = encode_integer_array(L, f, arr, buffer, size);
+		if (sz < 0)
+			return -1;
+		buffer += sz;
+		break;
+	}
+	case SPROTO_TBOOLEAN:
+		for (index = 1;; index++) {
+			lua_geti(L, arr, index);
+			if (lua_isnil(L, -1)) {
+				lua_pop(L, 1);
+				break;
+			}
+			if (!lua_isboolean(L, -1)) {
+				return luaL_error(L, ".%s[%d] is not a boolean (Is a %s)",
+					f->name, index, lua_typename(L, lua_type(L, -1)));
+			}
+			if (size < 1)
+				return -1;
+			buffer[0] = lua_toboolean(L, -1) ? 1 : 0;
+			lua_pop(L, 1);
+			size -= 1;
+			buffer += 1;
 		}
-		*(int *)args->value = v;
-		lua_pop(L,1);
-		return 4;
+		break;
+	default:
+		if (f->key >= 0) {
+			// map, iterate the table by lua_next
+			index = 1;
+			lua_pushnil(L);
+			while (lua_next(L, arr)) {
+				int sz = encode_object(L, f, index, buffer, size, deep);
+				if (sz < 0)
+					return -1;
+				buffer += sz;
+				size -= sz;
+				++index;
+			}
+		} else {
+			for (index = 1;; index++) {
+				int sz;
+				lua_geti(L, arr, index);
+				if (lua_isnil(L, -1)) {
+					lua_pop(L, 1);
+					break;
+				}
+				sz = encode_object(L, f, index, buffer, size, deep);
+				if (sz < 0)
+					return -1;
+				buffer += sz;
+				size -= sz;
+			}
+		}
+		break;
 	}
+	return fill_size(data, buffer - (data + SIZEOF_LENGTH));
+}
 
-	case SPROTO_TSTRING: {//ַ
-		size_t sz = 0;
-		const char * str;
-		if (!lua_isstring(L, -1)) {
-			return luaL_error(L, ".%s[%d] is not a string (Is a %s)", 
-				args->tagname, args->index, lua_typename(L, lua_type(L, -1)));
+static int
+encode_struct(lua_State *L, const struct sproto_type *st, int tbl, uint8_t * buffer, int size, int deep) {
+	uint8_t * header = buffer;
+	uint8_t * data;
+	int n, maxn;
+	const struct sproto_field * fields = sproto_fields(st, &n, &maxn);
+	int header_sz = SIZEOF_HEADER + maxn * SIZEOF_FIELD;
+	int i;
+	int index;
+	int lasttag;
+	int datasz;
+	if (deep >= ENCODE_DEEPLEVEL)
+		return luaL_error(L, "The table is too deep");
+	if (size < header_sz)
+		return -1;
+	data = header + header_sz;
+	size -= header_sz;
+	index = 0;
+	lasttag = -1;
+	for (i=0;i<n;i++) {
+		const struct sproto_field *f = &fields[i];
+		int value = 0;
+		int sz = -1;
+		lua_getfield(L, tbl, f->name);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			continue;
+		}
+		if (f->type & SPROTO_TARRAY) {
+			if (!lua_istable(L, -1)) {
+				return luaL_error(L, ".*%s should be a table (Is a %s)",
+					f->name, lua_typename(L, lua_type(L, -1)));
+			}
+			sz = encode_array(L, f, data, size, deep);
+			lua_pop(L, 1);
 		} else {
-			str = lua_tolstring(L, -1, &sz);
+			switch (f->type) {
+			case SPROTO_TINTEGER: {
+				lua_Integer v, vh;
+				int isnum;
+				v = lua_tointegerx(L, -1, &isnum);
+				if (!isnum) {
+					return luaL_error(L, ".%s[0] is not an integer (Is a %s)",
+						f->name, lua_typename(L, lua_type(L, -1)));
+				}
+				lua_pop(L, 1);
+				vh = v >> 31;
+				if (vh == 0 || vh == -1) {
+					uint32_t u32 = (uint32_t)v;
+					if (u32 < 0x7fff) {
+						value = (u32+1) * 2;
+						sz = 2;	// sz can be any number > 0
+					} else if (size >= SIZEOF_LENGTH + (int)sizeof(uint32_t)) {
+						write_uint32(data + SIZEOF_LENGTH, u32);
+						sz = fill_size(data, sizeof(uint32_t));
+					}
+				} else if (size >= SIZEOF_LENGTH + (int)sizeof(uint64_t)) {
+					write_uint64(data + SIZEOF_LENGTH, (uint64_t)v);
+					sz = fill_size(data, sizeof(uint64_t));
+				}
+				break;
+			}
+			case SPROTO_TBOOLEAN:
+				if (!lua_isboolean(L, -1)) {
+					return luaL_error(L, ".%s[0] is not a boolean (Is a %s)",
+						f->name, lua_typename(L, lua_type(L, -1)));
+				}
+				value = lua_toboolean(L, -1) ? 4 : 2;
+				sz = 2;
+				lua_pop(L, 1);
+				break;
+			case SPROTO_TSTRING:
+			case SPROTO_TSTRUCT:
+				sz = encode_object(L, f, 0, data, size, deep);
+				break;
+			default:
+				return luaL_error(L, "Invalid field type %d", f->type);
+			}
 		}
-		if (sz > args->length)
-			return SPROTO_CB_ERROR;
-		memcpy(args->value, str, sz);//copyس
-		lua_pop(L,1);
-		return sz;
-	}
-	case SPROTO_TSTRUCT: {//struct
-		struct encode_ud sub;
-		int r;
-		int top = lua_gettop(L);
-		if (!lua_istable(L, top)) {
-			return luaL_error(L, ".%s[%d] is not a table (Is a %s)", 
-				args->tagname, args->index, lua_typename(L, lua_type(L, -1)));
+		if (sz < 0)
+			return -1;
+		if (sz > 0) {
+			uint8_t * record;
+			int tag;
+			if (value == 0) {
+				data += sz;
+				size -= sz;
+			}
+			record = header+SIZEOF_HEADER+SIZEOF_FIELD*index;
+			tag = f->tag - lasttag - 1;
+			if (tag > 0) {
+				// skip tag
+				tag = (tag - 1) * 2 + 1;
+				if (tag > 0xffff)
+					return -1;
+				record[0] = tag & 0xff;
+				record[1] = (tag >> 8) & 0xff;
+				++index;
+				record += SIZEOF_FIELD;
+			}
+			++index;
+			record[0] = value & 0xff;
+			record[1] = (value >> 8) & 0xff;
+			lasttag = f->tag;
 		}
-		sub.L = L;
-		sub.st = args->subtype;
-		sub.tbl_index = top;
-		sub.array_tag = NULL;
-		sub.array_index = 0;
-		sub.deep = self->deep + 1;
-		lua_pushnil(L);	// prepare an iterator slot
-		sub.iter_index = sub.tbl_index + 1;
-		r = sproto_encode(args->subtype, args->value, args->length, encode, &sub);//ݹ
-		lua_settop(L, top-1);	// pop the value
-		if (r < 0) 
-			return SPROTO_CB_ERROR;
-		return r;
 	}
-	default:
-		return luaL_error(L, "Invalid field type %d", args->type);
+	header[0] = index & 0xff;
+	header[1] = (index >> 8) & 0xff;
+
+	datasz = data - (header + header_sz);
+	data = header + header_sz;
+	if (index != maxn) {
+		memmove(header + SIZEOF_HEADER + index * SIZEOF_FIELD, data, datasz);
 	}
+	return SIZEOF_HEADER + index * SIZEOF_FIELD + datasz;
 }
 
 static void *
@@ -265,7 +453,6 @@ expand_buffer(lua_State *L, int osz, int nsz) {
  */
 static int
 lencode(lua_State *L) {
-	struct encode_ud self;
 	void * buffer = lua_touserdata(L, lua_upvalueindex(1));//buffer 
 	int sz = lua_tointeger(L, lua_upvalueindex(2));//bufferĳ
 	int tbl_index = 2;
@@ -274,21 +461,11 @@ lencode(lua_State *L) {
 		return luaL_argerror(L, 1, "Need a sproto_type object");
 	}
 	luaL_checktype(L, tbl_index, LUA_TTABLE);//ڶΪtableʼsproto_typeֵ
-	luaL_checkstack(L, ENCODE_DEEPLEVEL*2 + 8, NULL);
-	self.L = L;
-	self.st = st;//sproto type
-	self.tbl_index = tbl_index; //table
+	luaL_checkstack(L, ENCODE_DEEPLEVEL*3 + 8, NULL);
 	for (;;) {
 		int r;
-		self.array_tag = NULL;
-		self.array_index = 0;
-		self.deep = 0;//㼶
-
 		lua_settop(L, tbl_index);
-		lua_pushnil(L);	// for iterator (stack slot 3) ѹһnilֵ
-		self.iter_index = tbl_index+1;//ʼ
-
-		r = sproto_encode(st, buffer, sz, encode, &self);//ʼ
+		r = encode_struct(L, st, tbl_index, buffer, sz, 0);//ʼ
 		if (r<0) {
 			buffer = expand_buffer(L, sz, sz*2);
 			sz *= 2;
@@ -299,114 +476,247 @@ lencode(lua_State *L) {
 	}
 }
 
-struct decode_ud {
-	lua_State *L;
-	const char * array_tag;
-	int array_index;
-	int result_index;
-	int deep;
-	int mainindex_tag;
-	int key_index;
-};
+static inline int
+toword(const uint8_t * p) {
+	return p[0] | p[1]<<8;
+}
 
-static int
-decode(const struct sproto_arg *args) {
-	struct decode_ud * self = args->ud;
-	lua_State *L = self->L;
-	if (self->deep >= ENCODE_DEEPLEVEL)
-		return luaL_error(L, "The table is too deep");
-	if (args->index != 0) {
-		// It's array
-		if (args->tagname != self->array_tag) {
-			self->array_tag = args->tagname;
-			lua_newtable(L);
-			lua_pushvalue(L, -1);
-			lua_setfield(L, self->result_index, args->tagname);
-			if (self->array_index) {
-				lua_replace(L, self->array_index);
-			} else {
-				self->array_index = lua_gettop(L);
-			}
-			if (args->index < 0) {
-				// It's a empty array, return now.
-				return 0;
-			}
-		}
-	}
-	switch (args->type) {
-	case SPROTO_TINTEGER: {
-		// notice: in lua 5.2, 52bit integer support (not 64)
-		lua_Integer v = *(uint64_t*)args->value;
-		lua_pushinteger(L, v);
-		break;
-	}
-	case SPROTO_TBOOLEAN: {
-		int v = *(uint64_t*)args->value;
-		lua_pushboolean(L,v);
-		break;
+static inline uint32_t
+todword(const uint8_t *p) {
+	return p[0] | p[1]<<8 | p[2]<<16 | p[3]<<24;
+}
+
+static inline lua_Integer
+expand64(uint32_t v) {
+	uint64_t value = v;
+	if (value & 0x80000000) {
+		value |= (uint64_t)~0  << 32 ;
 	}
-	case SPROTO_TSTRING: {
-		lua_pushlstring(L, args->value, args->length);
-		break;
+	return (lua_Integer)value;
+}
+
+static int decode_struct(lua_State *L, const struct sproto_type *st, const uint8_t * data, int size, int deep, int mainindex_tag, int key_index);
+
+// the number of records in header is the size hint of the table
+static inline void
+new_struct_table(lua_State *L, const uint8_t * data, uint32_t size) {
+	lua_createtable(L, 0, size >= SIZEOF_HEADER ? toword(data) : 0);
+}
+
+static int
+count_array_object(const uint8_t * stream, uint32_t sz) {
+	int n = 0;
+	while (sz >= SIZEOF_LENGTH) {
+		uint32_t hsz = todword(stream);
+		if (hsz > sz - SIZEOF_LENGTH)
+			break;
+		stream += SIZEOF_LENGTH + hsz;
+		sz -= SIZEOF_LENGTH + hsz;
+		++n;
 	}
-	case SPROTO_TSTRUCT: {
-		struct decode_ud sub;
-		int r;
-		lua_newtable(L);
-		sub.L = L;
-		sub.result_index = lua_gettop(L);
-		sub.deep = self->deep + 1;
-		sub.array_index = 0;
-		sub.array_tag = NULL;
-		if (args->mainindex >= 0) {
+	return n;
+}
+
+// decode the elements of a string or struct array into the table at the top of stack
+static int
+decode_array_object(lua_State *L, const struct sproto_field *f, const uint8_t * stream, uint32_t sz, int deep) {
+	int arr = lua_gettop(L);
+	int index = 1;
+	while (sz > 0) {
+		uint32_t hsz;
+		if (sz < SIZEOF_LENGTH)
+			return -1;
+		hsz = todword(stream);
+		stream += SIZEOF_LENGTH;
+		sz -= SIZEOF_LENGTH;
+		if (hsz > sz)
+			return -1;
+		if ((f->type & ~SPROTO_TARRAY) == SPROTO_TSTRING) {
+			lua_pushlstring(L, (const char *)stream, hsz);
+			lua_seti(L, arr, index);
+		} else if (f->key >= 0) {
 			// This struct will set into a map, so mark the main index tag.
-			sub.mainindex_tag = args->mainindex;
+			int key_index;
 			lua_pushnil(L);
-			sub.key_index = lua_gettop(L);
-
-			r = sproto_decode(args->subtype, args->value, args->length, decode, &sub);
-			if (r < 0)
-				return SPROTO_CB_ERROR;
-			if (r != args->length)
-				return r;
-			lua_pushvalue(L, sub.key_index);
-			if (lua_isnil(L, -1)) {
-				luaL_error(L, "Can't find main index (tag=%d) in [%s]", args->mainindex, args->tagname);
+			key_index = lua_gettop(L);
+			new_struct_table(L, stream, hsz);
+			if (decode_struct(L, f->st, stream, hsz, deep + 1, f->key, key_index) != (int)hsz)
+				return -1;
+			if (lua_isnil(L, key_index)) {
+				return luaL_error(L, "Can't find main index (tag=%d) in [%s]", f->key, f->name);
 			}
-			lua_pushvalue(L, sub.result_index);
-			lua_settable(L, self->array_index);
-			lua_settop(L, sub.result_index-1);
-			return 0;
+			lua_pushvalue(L, key_index);
+			lua_insert(L, -2);
+			lua_settable(L, arr);
+			lua_settop(L, arr);
 		} else {
-			sub.mainindex_tag = -1;
-			sub.key_index = 0;
-			r = sproto_decode(args->subtype, args->value, args->length, decode, &sub);
-			if (r < 0)
-				return SPROTO_CB_ERROR;
-			if (r != args->length)
-				return r;
-			lua_settop(L, sub.result_index);
-			break;
+			new_struct_table(L, stream, hsz);
+			if (decode_struct(L, f->st, stream, hsz, deep + 1, -1, 0) != (int)hsz)
+				return -1;
+			lua_seti(L, arr, index);
 		}
+		sz -= hsz;
+		stream += hsz;
+		++index;
 	}
-	default:
-		luaL_error(L, "Invalid type");
-	}
-	if (args->index > 0) {
-		lua_seti(L, self->array_index, args->index);
+	return 0;
+}
+
+// set result[f->name] to the array
+static int
+decode_array(lua_State *L, const struct sproto_field *f, const uint8_t * stream, int result, int deep) {
+	uint32_t sz = todword(stream);
+	uint32_t i;
+	if (sz == 0) {
+		lua_newtable(L);
 	} else {
-		if (self->mainindex_tag == args->tagid) {
-			// This tag is marked, save the value to key_index
-			// assert(self->key_index > 0);
-			lua_pushvalue(L,-1);
-			lua_replace(L, self->key_index);
+		stream += SIZEOF_LENGTH;
+		switch (f->type & ~SPROTO_TARRAY) {
+		case SPROTO_TINTEGER: {
+			int len = *stream;
+			++stream;
+			--sz;
+			lua_createtable(L, sz / (len > 0 ? len : 1), 0);
+			if (len == sizeof(uint32_t)) {
+				if (sz % sizeof(uint32_t) != 0)
+					return -1;
+				for (i=0;i<sz/sizeof(uint32_t);i++) {
+					lua_pushinteger(L, expand64(todword(stream + i*sizeof(uint32_t))));
+					lua_seti(L, -2, i+1);
+				}
+			} else if (len == sizeof(uint64_t)) {
+				if (sz % sizeof(uint64_t) != 0)
+					return -1;
+				for (i=0;i<sz/sizeof(uint64_t);i++) {
+					uint64_t low = todword(stream + i*sizeof(uint64_t));
+					uint64_t hi = todword(stream + i*sizeof(uint64_t) + sizeof(uint32_t));
+					lua_pushinteger(L, (lua_Integer)(low | hi << 32));
+					lua_seti(L, -2, i+1);
+				}
+			} else {
+				return -1;
+			}
+			break;
+		}
+		case SPROTO_TBOOLEAN:
+			lua_createtable(L, sz, 0);
+			for (i=0;i<sz;i++) {
+				lua_pushboolean(L, stream[i]);
+				lua_seti(L, -2, i+1);
+			}
+			break;
+		case SPROTO_TSTRING:
+		case SPROTO_TSTRUCT:
+			if (f->key >= 0) {
+				lua_createtable(L, 0, count_array_object(stream, sz));
+			} else {
+				lua_createtable(L, count_array_object(stream, sz), 0);
+			}
+			if (decode_array_object(L, f, stream, sz, deep))
+				return -1;
+			break;
+		default:
+			return -1;
 		}
-		lua_setfield(L, self->result_index, args->tagname);
 	}
-
+	lua_setfield(L, result, f->name);
 	return 0;
 }
 
+// decode into the table at the top of stack, returns the size of data used or -1
+static int
+decode_struct(lua_State *L, const struct sproto_type *st, const uint8_t * data, int size, int deep, int mainindex_tag, int key_index) {
+	int result = lua_gettop(L);
+	int total = size;
+	const uint8_t * stream;
+	const uint8_t * datastream;
+	int fn;
+	int i;
+	int tag;
+	if (deep >= ENCODE_DEEPLEVEL)
+		return luaL_error(L, "The table is too deep");
+	if (size < SIZEOF_HEADER)
+		return -1;
+	stream = data;
+	fn = toword(stream);
+	stream += SIZEOF_HEADER;
+	size -= SIZEOF_HEADER;
+	if (size < fn * SIZEOF_FIELD)
+		return -1;
+	datastream = stream + fn * SIZEOF_FIELD;
+	size -= fn * SIZEOF_FIELD;
+
+	tag = -1;
+	for (i=0;i<fn;i++) {
+		const uint8_t * currentdata;
+		const struct sproto_field * f;
+		uint32_t sz = 0;
+		int value = toword(stream + i * SIZEOF_FIELD);
+		++ tag;
+		if (value & 1) {
+			tag += value/2;
+			continue;
+		}
+		value = value/2 - 1;
+		currentdata = datastream;
+		if (value < 0) {
+			if (size < SIZEOF_LENGTH)
+				return -1;
+			sz = todword(datastream);
+			if (sz > (uint32_t)(size - SIZEOF_LENGTH))
+				return -1;
+			datastream += sz+SIZEOF_LENGTH;
+			size -= sz+SIZEOF_LENGTH;
+		}
+		f = sproto_findtag(st, tag);
+		if (f == NULL)
+			continue;
+		if (value < 0) {
+			if (f->type & SPROTO_TARRAY) {
+				if (decode_array(L, f, currentdata, result, deep))
+					return -1;
+				continue;
+			}
+			switch (f->type) {
+			case SPROTO_TINTEGER:
+				if (sz == sizeof(uint32_t)) {
+					lua_pushinteger(L, expand64(todword(currentdata + SIZEOF_LENGTH)));
+				} else if (sz == sizeof(uint64_t)) {
+					uint64_t low = todword(currentdata + SIZEOF_LENGTH);
+					uint64_t hi = todword(currentdata + SIZEOF_LENGTH + sizeof(uint32_t));
+					lua_pushinteger(L, (lua_Integer)(low | hi << 32));
+				} else {
+					return -1;
+				}
+				break;
+			case SPROTO_TSTRING:
+				lua_pushlstring(L, (const char *)currentdata + SIZEOF_LENGTH, sz);
+				break;
+			case SPROTO_TSTRUCT:
+				new_struct_table(L, currentdata + SIZEOF_LENGTH, sz);
+				if (decode_struct(L, f->st, currentdata + SIZEOF_LENGTH, sz, deep + 1, -1, 0) != (int)sz)
+					return -1;
+				break;
+			default:
+				return -1;
+			}
+		} else if (f->type == SPROTO_TINTEGER) {
+			lua_pushinteger(L, value);
+		} else if (f->type == SPROTO_TBOOLEAN) {
+			lua_pushboolean(L, value);
+		} else {
+			return -1;
+		}
+		if (mainindex_tag == f->tag) {
+			// This tag is marked, save the value to key_index
+			lua_pushvalue(L, -1);
+			lua_replace(L, key_index);
+		}
+		lua_setfield(L, result, f->name);
+	}
+	return total - size;
+}
+
 static const void *
 getbuffer(lua_State *L, int index, size_t *sz) {
 	const void * buffer = NULL;
@@ -433,8 +743,8 @@ static int
 ldecode(lua_State *L) {
 	struct sproto_type * st = lua_touserdata(L, 1);
 	const void * buffer;
-	struct decode_ud self;
 	size_t sz;
+	int result;
 	int r;
 	if (st == NULL) {
 		return luaL_argerror(L, 1, "Need a sproto_type object");
@@ -442,21 +752,15 @@ ldecode(lua_State *L) {
 	sz = 0;
 	buffer = getbuffer(L, 2, &sz);
 	if (!lua_istable(L, -1)) {
-		lua_newtable(L);
+		new_struct_table(L, buffer, sz);
 	}
 	luaL_checkstack(L, ENCODE_DEEPLEVEL*3 + 8, NULL);
-	self.L = L;
-	self.result_index = lua_gettop(L);
-	self.array_index = 0;
-	self.array_tag = NULL;
-	self.deep = 0;
-	self.mainindex_tag = -1;
-	self.key_index = 0;
-	r = sproto_decode(st, buffer, (int)sz, decode, &self);
+	result = lua_gettop(L);
+	r = decode_struct(L, st, buffer, (int)sz, 0, -1, 0);
 	if (r < 0) {
 		return luaL_error(L, "decode error");
 	}
-	lua_settop(L, self.result_index);
+	lua_settop(L, result);
 	lua_pushinteger(L, r);
 	return 2;
 }
@@ -517,6 +821,19 @@ lunpack(lua_State *L) {
 	return 1;
 }
 
+/*
+	string name (optional) : "scalar", "ssse3" or "avx2"
+	return the name of the pack implementation in use, or nil if the name isn't supported
+ */
+static int
+lpackimpl(lua_State *L) {
+	const char * name = sproto_packimpl(luaL_optstring(L, 1, NULL));
+	if (name == NULL)
+		return 0;
+	lua_pushstring(L, name);
+	return 1;
+}
+
 static void
 pushfunction_withbuffer(lua_State *L, const char * name, lua_CFunction func) {
 	lua_newuserdata(L, ENCODE_BUFFERSIZE);
@@ -569,39 +886,125 @@ lprotocol(lua_State *L) {
 	return 3;//3
 }
 
-/* global sproto pointer for multi states
-   NOTICE : It is not thread safe
+/* global sproto objects for multi states, each slot keeps the newest version.
+   A state holds a reference of the version it loads (the handle userdata), so a version
+   replaced by saveproto is released after all the states drop it.
  */
-static struct sproto * G_sproto[MAX_GLOBALSPROTO];
+struct shared_sproto {
+	struct sproto * sp;
+	int ref;
+	int version;
+};
+
+struct sproto_slot {
+	struct spinlock lock;
+	struct shared_sproto * s;
+	int version;
+};
+
+static struct sproto_slot G_sproto[MAX_GLOBALSPROTO];
+
+static void
+shared_release(struct shared_sproto *s) {
+	if (ATOM_DEC(&s->ref) == 0) {
+		sproto_release(s->sp);
+		free(s);
+	}
+}
 
 static int
-lsaveproto(lua_State *L) {
-	struct sproto * sp = lua_touserdata(L, 1);
-	int index = luaL_optinteger(L, 2, 0);
-	if (index < 0 || index >= MAX_GLOBALSPROTO) {
-		return luaL_error(L, "Invalid global slot index %d", index);
+lreleasehandle(lua_State *L) {
+	struct shared_sproto ** h = lua_touserdata(L, 1);
+	if (*h) {
+		shared_release(*h);
+		*h = NULL;
 	}
-	/* TODO : release old object (memory leak now, but thread safe)*/
-	G_sproto[index] = sp;
 	return 0;
 }
 
+static struct sproto_slot *
+getslot(lua_State *L, int index) {
+	if (index < 0 || index >= MAX_GLOBALSPROTO) {
+		luaL_error(L, "Invalid global slot index %d", index);
+	}
+	return &G_sproto[index];
+}
 
-//sproto.core.loadproto(index)
+/*
+	lightuserdata sproto (the slot owns it after saving)
+	integer index
+	return version
+ */
+static int
+lsaveproto(lua_State *L) {
+	struct sproto * sp = lua_touserdata(L, 1);
+	struct sproto_slot * slot = getslot(L, luaL_optinteger(L, 2, 0));
+	struct shared_sproto * s;
+	struct shared_sproto * old;
+	int version;
+	if (sp == NULL) {
+		return luaL_argerror(L, 1, "Need a sproto object");
+	}
+	s = malloc(sizeof(*s));
+	if (s == NULL)
+		return luaL_error(L, "Out of memory");
+	s->sp = sp;
+	s->ref = 1;	// the slot's
+
+	spinlock_lock(&slot->lock);
+	old = slot->s;
+	version = slot->version + 1;
+	s->version = version;
+	slot->s = s;
+	slot->version = version;
+	spinlock_unlock(&slot->lock);
+
+	if (old) {
+		shared_release(old);
+	}
+	lua_pushinteger(L, version);
+	return 1;
+}
+
+/*
+	integer index
+	return lightuserdata sproto, handle (keep it alive while using the sproto), version
+ */
 static int
 lloadproto(lua_State *L) {
 	int index = luaL_optinteger(L, 1, 0);
-	struct sproto * sp;
-	if (index < 0 || index >= MAX_GLOBALSPROTO) {
-		return luaL_error(L, "Invalid global slot index %d", index);
+	struct sproto_slot * slot = getslot(L, index);
+	struct shared_sproto ** h = lua_newuserdata(L, sizeof(*h));
+	struct shared_sproto * s;
+	*h = NULL;
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_setmetatable(L, -2);
+
+	spinlock_lock(&slot->lock);
+	s = slot->s;
+	if (s) {
+		ATOM_INC(&s->ref);
 	}
-	sp = G_sproto[index];
-	if (sp == NULL) {
+	spinlock_unlock(&slot->lock);
+
+	if (s == NULL) {
 		return luaL_error(L, "nil sproto at index %d", index);
 	}
+	*h = s;
+	lua_pushlightuserdata(L, s->sp);
+	lua_insert(L, -2);
+	lua_pushinteger(L, s->version);
+	return 3;
+}
 
-	lua_pushlightuserdata(L, sp);
-
+/*
+	integer index
+	return the version of the slot, 0 for empty
+ */
+static int
+lprotoversion(lua_State *L) {
+	struct sproto_slot * slot = getslot(L, luaL_optinteger(L, 1, 0));
+	lua_pushinteger(L, slot->version);
 	return 1;
 }
 
@@ -679,12 +1082,18 @@ luaopen_sproto_core(lua_State *L) {
 		{ "querytype", lquerytype },
 		{ "decode", ldecode },
 		{ "protocol", lprotocol },
-		{ "loadproto", lloadproto },
 		{ "saveproto", lsaveproto },
+		{ "protoversion", lprotoversion },
 		{ "default", ldefault },
+		{ "packimpl", lpackimpl },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, lreleasehandle);
+	lua_setfield(L, -2, "__gc");
+	lua_pushcclosure(L, lloadproto, 1);
+	lua_setfield(L, -2, "loadproto");
 	pushfunction_withbuffer(L, "encode", lencode);//buffer
 	pushfunction_withbuffer(L, "pack", lpack);
 	pushfunction_withbuffer(L, "unpack", lunpack);
@@ -6,20 +6,12 @@
 
 #include "sproto.h"
 
-#define SPROTO_TARRAY 0x80
 #define CHUNK_SIZE 1000
 #define SIZEOF_LENGTH 4
 #define SIZEOF_HEADER 2
 #define SIZEOF_FIELD 2
-
-/* fieldṹ */
-struct field {
-	int tag;//index
-	int type;//ͣΪSPROTO_TSTRUCTstֶָtypeͣfieldΪSPROTO_TARRAY
-	const char * name;//ֶ
-	struct sproto_type * st;
-	int key;//fieldָtype͵ֶ
-};
+// the max range of the tags which has a direct index, for n tags
+#define SPARSE_INDEX_MAX(n) ((n) * 16 + 1024)
 
 /* type͵Ľṹ */
 struct sproto_type {
@@ -27,7 +19,9 @@ struct sproto_type {
 	int n;//filed nums
 	int base;//ʼindex
 	int maxn;//Чfiled numsindexԾnĻϼ1
-	struct field *f;
+	struct sproto_field *f;
+	uint16_t *index;	// sparse tags : tag - f[0].tag -> index+1 of f, 0 for none (NULL if the range is too wide)
+	int index_n;
 };
 
 struct protocol {
@@ -53,6 +47,14 @@ struct sproto {
 	int protocol_n;//protocolĳ
 	struct sproto_type * type;//typeָ
 	struct protocol * proto;//protocolָ
+	// hash index of the names (open addressing), slot is index+1 of type/proto, 0 for empty
+	int type_mask;
+	int proto_mask;
+	int * type_index;
+	int * proto_index;
+	// tag -> index+1 of proto, 0 for none (NULL if the tags are too sparse)
+	int * proto_tag;
+	int proto_tag_n;
 };
 
 static void
@@ -187,7 +189,7 @@ import_string(struct sproto *s, const uint8_t * stream) {
 
 //field
 static const uint8_t *
-import_field(struct sproto *s, struct field *f, const uint8_t * stream) {
+import_field(struct sproto *s, struct sproto_field *f, const uint8_t * stream) {
 	uint32_t sz;
 	const uint8_t * result;
 	int fn;
@@ -310,10 +312,10 @@ import_type(struct sproto *s, struct sproto_type *t, const uint8_t * stream) {
 	maxn = n;
 	last = -1;
 	t->n = n;
-	t->f = pool_alloc(&s->memory, sizeof(struct field) * n);//nfiledڴ
+	t->f = pool_alloc(&s->memory, sizeof(struct sproto_field) * n);//nfiledڴ
 	for (i=0;i<n;i++) { //νfiled 
 		int tag;
-		struct field *f = &t->f[i];
+		struct sproto_field *f = &t->f[i];
 		stream = import_field(s, f, stream);
 		if (stream == NULL)
 			return NULL;
@@ -330,6 +332,17 @@ import_type(struct sproto *s, struct sproto_type *t, const uint8_t * stream) {
 	n = t->f[n-1].tag - t->base + 1;
 	if (n != t->n) {
 		t->base = -1;
+		if (n <= SPARSE_INDEX_MAX(t->n)) {
+			// direct index for sparse tags, or findtag uses binary search
+			t->index = pool_alloc(&s->memory, n * sizeof(uint16_t));
+			if (t->index == NULL)
+				return NULL;
+			memset(t->index, 0, n * sizeof(uint16_t));
+			for (i=0;i<t->n;i++) {
+				t->index[t->f[i].tag - t->f[0].tag] = i + 1;
+			}
+			t->index_n = n;
+		}
 	}
 	return result;
 }
@@ -400,6 +413,41 @@ import_protocol(struct sproto *s, struct protocol *p, const uint8_t * stream) {
 	return result;
 }
 
+static inline uint32_t
+name_hash(const char * name) {
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	while (*name) {
+		h ^= (uint8_t)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// the size of index is a power of 2 and twice as n at least, so the probe is short
+static int *
+create_index(struct sproto *s, int n, int *mask) {
+	int sz = 4;
+	int * index;
+	while (sz < n * 2)
+		sz *= 2;
+	index = pool_alloc(&s->memory, sz * sizeof(int));
+	if (index == NULL)
+		return NULL;
+	memset(index, 0, sz * sizeof(int));
+	*mask = sz - 1;
+	return index;
+}
+
+static void
+insert_index(int *index, int mask, const char * name, int i) {
+	uint32_t h = name_hash(name) & mask;
+	while (index[h] != 0) {
+		h = (h + 1) & mask;
+	}
+	index[h] = i + 1;
+}
+
 /* ݶtypeԼpackageֽԭʹsproto */
 static struct sproto *
 create_from_bundle(struct sproto *s, const uint8_t * stream, size_t sz) {
@@ -451,6 +499,34 @@ create_from_bundle(struct sproto *s, const uint8_t * stream, size_t sz) {
 		}
 	}
 
+	s->type_index = create_index(s, s->type_n, &s->type_mask);
+	s->proto_index = create_index(s, s->protocol_n, &s->proto_mask);
+	if (s->type_index == NULL || s->proto_index == NULL)
+		return NULL;
+	for (i=0;i<s->type_n;i++) {
+		insert_index(s->type_index, s->type_mask, s->type[i].name, i);
+	}
+	for (i=0;i<s->protocol_n;i++) {
+		insert_index(s->proto_index, s->proto_mask, s->proto[i].name, i);
+	}
+	if (s->protocol_n > 0) {
+		int n = 0;
+		for (i=0;i<s->protocol_n;i++) {
+			if (s->proto[i].tag >= n)
+				n = s->proto[i].tag + 1;
+		}
+		if (n <= SPARSE_INDEX_MAX(s->protocol_n)) {
+			s->proto_tag = pool_alloc(&s->memory, n * sizeof(int));
+			if (s->proto_tag == NULL)
+				return NULL;
+			memset(s->proto_tag, 0, n * sizeof(int));
+			for (i=0;i<s->protocol_n;i++) {
+				s->proto_tag[s->proto[i].tag] = i + 1;
+			}
+			s->proto_tag_n = n;
+		}
+	}
+
 	return s;
 }
 
@@ -494,7 +570,7 @@ sproto_dump(struct sproto *s) {
 		for (j=0;j<t->n;j++) {
 			char array[2] = { 0, 0 };
 			const char * type_name = NULL;
-			struct field *f = &t->f[j];
+			struct sproto_field *f = &t->f[j];
 			if (f->type & SPROTO_TARRAY) {
 				array[0] = '*';
 			} else {
@@ -534,11 +610,13 @@ sproto_dump(struct sproto *s) {
 // query Э飬nameΪЭ
 int
 sproto_prototag(const struct sproto *sp, const char * name) {
+	uint32_t h = name_hash(name) & sp->proto_mask;
 	int i;
-	for (i=0;i<sp->protocol_n;i++) {
-		if (strcmp(name, sp->proto[i].name) == 0) {
-			return sp->proto[i].tag;
+	while ((i = sp->proto_index[h]) != 0) {
+		if (strcmp(name, sp->proto[i-1].name) == 0) {
+			return sp->proto[i-1].tag;
 		}
+		h = (h + 1) & sp->proto_mask;
 	}
 	return -1;
 }
@@ -547,6 +625,13 @@ sproto_prototag(const struct sproto *sp, const char * name) {
 static struct protocol *
 query_proto(const struct sproto *sp, int tag) {
 	int begin = 0, end = sp->protocol_n;
+	if (sp->proto_tag) {
+		int i;
+		if (tag < 0 || tag >= sp->proto_tag_n)
+			return NULL;
+		i = sp->proto_tag[tag];
+		return i ? &sp->proto[i-1] : NULL;
+	}
 	while(begin<end) {
 		int mid = (begin+end)/2;
 		int t = sp->proto[mid].tag;
@@ -586,11 +671,13 @@ sproto_protoname(const struct sproto *sp, int proto) {
 
 struct sproto_type *
 sproto_type(const struct sproto *sp, const char * type_name) {
+	uint32_t h = name_hash(type_name) & sp->type_mask;
 	int i;
-	for (i=0;i<sp->type_n;i++) {
-		if (strcmp(type_name, sp->type[i].name) == 0) {
-			return &sp->type[i];
+	while ((i = sp->type_index[h]) != 0) {
+		if (strcmp(type_name, sp->type[i-1].name) == 0) {
+			return &sp->type[i-1];
 		}
+		h = (h + 1) & sp->type_mask;
 	}
 	return NULL;
 }
@@ -600,7 +687,7 @@ sproto_name(struct sproto_type * st) {
 	return st->name;
 }
 
-static struct field *
+static const struct sproto_field *
 findtag(const struct sproto_type *st, int tag) {
 	int begin, end;
 	if (st->base >=0 ) {
@@ -609,11 +696,19 @@ findtag(const struct sproto_type *st, int tag) {
 			return NULL;
 		return &st->f[tag];
 	}
+	if (st->index) {
+		int i;
+		tag -= st->f[0].tag;
+		if (tag < 0 || tag >= st->index_n)
+			return NULL;
+		i = st->index[tag];
+		return i ? &st->f[i-1] : NULL;
+	}
 	begin = 0;
 	end = st->n;
 	while (begin < end) {
 		int mid = (begin+end)/2;
-		struct field *f = &st->f[mid];
+		struct sproto_field *f = &st->f[mid];
 		int t = f->tag;
 		if (t == tag) {
 			return f;
@@ -627,6 +722,18 @@ findtag(const struct sproto_type *st, int tag) {
 	return NULL;
 }
 
+const struct sproto_field *
+sproto_fields(const struct sproto_type *st, int *n, int *maxn) {
+	*n = st->n;
+	*maxn = st->maxn;
+	return st->f;
+}
+
+const struct sproto_field *
+sproto_findtag(const struct sproto_type *st, int tag) {
+	return findtag(st, tag);
+}
+
 // encode & decode
 // sproto_callback(void *ud, int tag, int type, struct sproto_type *, void *value, int length)
 //	  return size, -1 means error
@@ -901,7 +1008,7 @@ sproto_encode(const struct sproto_type *st, void * buffer, int size, sproto_call
 	index = 0;
 	lasttag = -1;
 	for (i=0;i<st->n;i++) {//αfield
-		struct field *f = &st->f[i];
+		struct sproto_field *f = &st->f[i];
 		int type = f->type;
 		int value = 0;
 		int sz = -1;
@@ -1113,7 +1220,7 @@ sproto_decode(const struct sproto_type *st, const void * data, int size, sproto_
 	tag = -1;
 	for (i=0;i<fn;i++) {
 		uint8_t * currentdata;
-		struct field * f;
+		const struct sproto_field * f;
 		int value = toword(stream + i * SIZEOF_FIELD);
 		++ tag;
 		if (value & 1) {
@@ -1194,6 +1301,24 @@ sproto_decode(const struct sproto_type *st, const void * data, int size, sproto_
 
 // 0 pack
 
+/*
+	A segment is 8 bytes. The header of a segment is the bitmap of the non-zero bytes, and only the
+	non-zero bytes follow it. The segments without zero (or with 1-2 zeros after such a segment) are
+	copied as they are, by runs of up to 256 segments : 0xff, count-1, segments.
+
+	There are three implementations of the inner loops, selected at runtime (see sproto_packimpl) :
+	scalar, ssse3 and avx2. The vectorized ones compute the headers by compare and movemask (16 or 32
+	bytes at once), and move the bytes with pshufb by the tables of 256 shuffle masks, one per header.
+	All of them write the same output.
+ */
+
+static inline int
+popcount8(uint8_t x) {
+	x = x - ((x >> 1) & 0x55);
+	x = (x & 0x33) + ((x >> 2) & 0x33);
+	return (x + (x >> 4)) & 0x0f;
+}
+
 static int
 pack_seg(const uint8_t *src, uint8_t * buffer, int sz, int n) {
 	uint8_t header = 0;
@@ -1245,67 +1370,123 @@ write_ff(const uint8_t * src, uint8_t * des, int n) {
 	}
 }
 
-int
-sproto_pack(const void * srcv, int srcsz, void * bufferv, int bufsz) {
-	uint8_t tmp[8];
+// The scalar one passes NULL for these functions, and packs by pack_seg.
+// bit i of the result is set when src[i] != 0, for 32 bytes
+typedef uint32_t (*pack_mask_func)(const uint8_t *src);
+// write the non-zero bytes of src (8 bytes) selected by header to des, it may write 8 bytes
+typedef void (*pack_compress_func)(const uint8_t *src, uint8_t header, uint8_t *des);
+// the reverse of compress, read popcount(header) bytes from src (src must have 8 bytes), write 8 bytes to des
+typedef void (*unpack_expand_func)(const uint8_t *src, uint8_t header, uint8_t *des);
+
+struct pack_state {
+	const uint8_t * ff_srcstart;
+	uint8_t * ff_desstart;
+	int ff_n;
+	uint8_t * buffer;
+	int bufsz;
+	int size;
+};
+
+static inline uint8_t
+segment_header(const uint8_t *src) {
+	uint8_t header = 0;
 	int i;
-	const uint8_t * ff_srcstart = NULL;
-	uint8_t * ff_desstart = NULL;
-	int ff_n = 0;
-	int size = 0;
-	const uint8_t * src = srcv;
-	uint8_t * buffer = bufferv;
-	for (i=0;i<srcsz;i+=8) {
-		int n;
-		int padding = i+8 - srcsz;
-		if (padding > 0) {
-			int j;
-			memcpy(tmp, src, 8-padding);
-			for (j=0;j<padding;j++) {
-				tmp[7-j] = 0;
+	for (i=0;i<8;i++) {
+		if (src[i] != 0)
+			header |= 1<<i;
+	}
+	return header;
+}
+
+// the same as pack_seg, when the buffer has 10 bytes at least
+static inline int
+pack_seg_header(const uint8_t *src, uint8_t header, uint8_t * buffer, int n, pack_compress_func compress) {
+	int notzero = popcount8(header);
+	if ((notzero == 7 || notzero == 6) && n > 0) {
+		notzero = 8;
+	}
+	if (notzero == 8) {
+		// the segment will be copied by write_ff
+		return n > 0 ? 8 : 10;
+	}
+	buffer[0] = header;
+	compress(src, header, buffer + 1);
+	return notzero + 1;
+}
+
+static inline void
+pack_step(struct pack_state *ps, const uint8_t *src, uint8_t header, pack_compress_func compress) {
+	int n;
+	if (compress && ps->bufsz >= 10) {
+		n = pack_seg_header(src, header, ps->buffer, ps->ff_n, compress);
+	} else {
+		n = pack_seg(src, ps->buffer, ps->bufsz, ps->ff_n);
+	}
+	ps->bufsz -= n;
+	if (n == 10) {
+		// first FF
+		ps->ff_srcstart = src;
+		ps->ff_desstart = ps->buffer;
+		ps->ff_n = 1;
+	} else if (n==8 && ps->ff_n>0) {
+		++ps->ff_n;
+		if (ps->ff_n == 256) {
+			if (ps->bufsz >= 0) {
+				write_ff(ps->ff_srcstart, ps->ff_desstart, 256*8);
 			}
-			src = tmp;
+			ps->ff_n = 0;
 		}
-		n = pack_seg(src, buffer, bufsz, ff_n);
-		bufsz -= n;
-		if (n == 10) {
-			// first FF
-			ff_srcstart = src;
-			ff_desstart = buffer;
-			ff_n = 1;
-		} else if (n==8 && ff_n>0) {
-			++ff_n;
-			if (ff_n == 256) {
-				if (bufsz >= 0) {
-					write_ff(ff_srcstart, ff_desstart, 256*8);
-				}
-				ff_n = 0;
-			}
-		} else {
-			if (ff_n > 0) {
-				if (bufsz >= 0) {
-					write_ff(ff_srcstart, ff_desstart, ff_n*8);
-				}
-				ff_n = 0;
+	} else {
+		if (ps->ff_n > 0) {
+			if (ps->bufsz >= 0) {
+				write_ff(ps->ff_srcstart, ps->ff_desstart, ps->ff_n*8);
 			}
+			ps->ff_n = 0;
 		}
-		src += 8;
-		buffer += n;
-		size += n;
 	}
-	if(bufsz >= 0){
-		if(ff_n == 1)
-			write_ff(ff_srcstart, ff_desstart, 8);
-		else if (ff_n > 1)
-			write_ff(ff_srcstart, ff_desstart, srcsz - (intptr_t)(ff_srcstart - (const uint8_t*)srcv));
+	ps->buffer += n;
+	ps->size += n;
+}
+
+static inline int
+pack_loop(const uint8_t * src, int srcsz, uint8_t * buffer, int bufsz, pack_mask_func mask, pack_compress_func compress) {
+	struct pack_state ps;
+	uint8_t tmp[8];
+	int i;
+	ps.ff_srcstart = NULL;
+	ps.ff_desstart = NULL;
+	ps.ff_n = 0;
+	ps.buffer = buffer;
+	ps.bufsz = bufsz;
+	ps.size = 0;
+	for (i=0;mask && i+32<=srcsz;i+=32) {
+		uint32_t m = mask(src + i);
+		pack_step(&ps, src + i, (uint8_t)m, compress);
+		pack_step(&ps, src + i + 8, (uint8_t)(m >> 8), compress);
+		pack_step(&ps, src + i + 16, (uint8_t)(m >> 16), compress);
+		pack_step(&ps, src + i + 24, (uint8_t)(m >> 24), compress);
 	}
-	return size;
+	for (;i<srcsz;i+=8) {
+		const uint8_t * seg = src + i;
+		int padding = i+8 - srcsz;
+		if (padding > 0) {
+			memcpy(tmp, seg, 8-padding);
+			memset(tmp + 8 - padding, 0, padding);
+			seg = tmp;
+		}
+		pack_step(&ps, seg, compress ? segment_header(seg) : 0, compress);
+	}
+	if(ps.bufsz >= 0){
+		if(ps.ff_n == 1)
+			write_ff(ps.ff_srcstart, ps.ff_desstart, 8);
+		else if (ps.ff_n > 1)
+			write_ff(ps.ff_srcstart, ps.ff_desstart, srcsz - (intptr_t)(ps.ff_srcstart - src));
+	}
+	return ps.size;
 }
 
-int
-sproto_unpack(const void * srcv, int srcsz, void * bufferv, int bufsz) {
-	const uint8_t * src = srcv;
-	uint8_t * buffer = bufferv;
+static inline int
+unpack_loop(const uint8_t * src, int srcsz, uint8_t * buffer, int bufsz, unpack_expand_func expand) {
 	int size = 0;
 	while (srcsz > 0) {
 		uint8_t header = src[0];
@@ -1328,6 +1509,14 @@ sproto_unpack(const void * srcv, int srcsz, void * bufferv, int bufsz) {
 			buffer += n;
 			src += n;
 			size += n;
+		} else if (expand && srcsz >= 8 && bufsz >= 8) {
+			int n = popcount8(header);
+			expand(src, header, buffer);
+			src += n;
+			srcsz -= n;
+			buffer += 8;
+			bufsz -= 8;
+			size += 8;
 		} else {
 			int i;
 			for (i=0;i<8;i++) {
@@ -1355,3 +1544,171 @@ sproto_unpack(const void * srcv, int srcsz, void * bufferv, int bufsz) {
 	}
 	return size;
 }
+
+static int
+pack_scalar(const void * src, int srcsz, void * buffer, int bufsz) {
+	return pack_loop(src, srcsz, buffer, bufsz, NULL, NULL);
+}
+
+static int
+unpack_scalar(const void * src, int srcsz, void * buffer, int bufsz) {
+	return unpack_loop(src, srcsz, buffer, bufsz, NULL);
+}
+
+struct pack_impl {
+	const char * name;
+	int (*pack)(const void * src, int srcsz, void * buffer, int bufsz);
+	int (*unpack)(const void * src, int srcsz, void * buffer, int bufsz);
+	int (*supported)(void);
+};
+
+static int
+supported_always(void) {
+	return 1;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+#define SPROTO_PACK_SIMD
+
+// shuffle masks indexed by header : the non-zero bytes to the front, and the reverse
+static uint8_t compress_shuffle[256][8];
+static uint8_t expand_shuffle[256][8];
+
+__attribute__((constructor)) static void
+init_shuffle(void) {
+	int h,i;
+	for (h=0;h<256;h++) {
+		int n = 0;
+		for (i=0;i<8;i++) {
+			compress_shuffle[h][i] = 0x80;
+			if (h & (1<<i)) {
+				compress_shuffle[h][n] = i;
+				expand_shuffle[h][i] = n;
+				++n;
+			} else {
+				expand_shuffle[h][i] = 0x80;
+			}
+		}
+	}
+}
+
+__attribute__((target("ssse3"))) static uint32_t
+mask_ssse3(const uint8_t *src) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+	uint32_t z = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero))
+		| (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, zero)) << 16;
+	return ~z;
+}
+
+__attribute__((target("ssse3"))) static inline void
+compress_ssse3(const uint8_t *src, uint8_t header, uint8_t *des) {
+	__m128i v = _mm_loadl_epi64((const __m128i *)src);
+	__m128i s = _mm_loadl_epi64((const __m128i *)compress_shuffle[header]);
+	_mm_storel_epi64((__m128i *)des, _mm_shuffle_epi8(v, s));
+}
+
+__attribute__((target("ssse3"))) static inline void
+expand_ssse3(const uint8_t *src, uint8_t header, uint8_t *des) {
+	__m128i v = _mm_loadl_epi64((const __m128i *)src);
+	__m128i s = _mm_loadl_epi64((const __m128i *)expand_shuffle[header]);
+	_mm_storel_epi64((__m128i *)des, _mm_shuffle_epi8(v, s));
+}
+
+__attribute__((target("avx2"))) static uint32_t
+mask_avx2(const uint8_t *src) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)src);
+	return ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+}
+
+__attribute__((target("ssse3"))) static int
+pack_ssse3(const void * src, int srcsz, void * buffer, int bufsz) {
+	return pack_loop(src, srcsz, buffer, bufsz, mask_ssse3, compress_ssse3);
+}
+
+__attribute__((target("ssse3"))) static int
+unpack_ssse3(const void * src, int srcsz, void * buffer, int bufsz) {
+	return unpack_loop(src, srcsz, buffer, bufsz, expand_ssse3);
+}
+
+__attribute__((target("avx2"))) static int
+pack_avx2(const void * src, int srcsz, void * buffer, int bufsz) {
+	return pack_loop(src, srcsz, buffer, bufsz, mask_avx2, compress_ssse3);
+}
+
+static int
+supported_ssse3(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3");
+}
+
+static int
+supported_avx2(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+// the better one is in the back
+static const struct pack_impl pack_impls[] = {
+	{ "scalar", pack_scalar, unpack_scalar, supported_always },
+#ifdef SPROTO_PACK_SIMD
+	{ "ssse3", pack_ssse3, unpack_ssse3, supported_ssse3 },
+	// expanding 8 bytes can't use the wider registers, so unpack is the same as ssse3
+	{ "avx2", pack_avx2, unpack_ssse3, supported_avx2 },
+#endif
+};
+
+#define PACK_IMPLS (int)(sizeof(pack_impls) / sizeof(pack_impls[0]))
+
+static const struct pack_impl * P = NULL;
+
+static const struct pack_impl *
+pack_impl_best(void) {
+	int i;
+	for (i=PACK_IMPLS-1;i>0;i--) {
+		if (pack_impls[i].supported())
+			return &pack_impls[i];
+	}
+	return &pack_impls[0];
+}
+
+const char *
+sproto_packimpl(const char * name) {
+	int i;
+	if (name == NULL) {
+		if (P == NULL)
+			P = pack_impl_best();
+		return P->name;
+	}
+	for (i=0;i<PACK_IMPLS;i++) {
+		if (strcmp(pack_impls[i].name, name) == 0) {
+			if (!pack_impls[i].supported())
+				return NULL;
+			P = &pack_impls[i];
+			return P->name;
+		}
+	}
+	return NULL;
+}
+
+int
+sproto_pack(const void * srcv, int srcsz, void * bufferv, int bufsz) {
+	if (P == NULL) {
+		P = pack_impl_best();
+	}
+	return P->pack(srcv, srcsz, bufferv, bufsz);
+}
+
+int
+sproto_unpack(const void * srcv, int srcsz, void * bufferv, int bufsz) {
+	if (P == NULL) {
+		P = pack_impl_best();
+	}
+	return P->unpack(srcv, srcsz, bufferv, bufsz);
+}
@@ -13,6 +13,7 @@ struct sproto_type;
 #define SPROTO_TBOOLEAN 1
 #define SPROTO_TSTRING 2
 #define SPROTO_TSTRUCT 3
+#define SPROTO_TARRAY 0x80
 
 #define SPROTO_CB_ERROR -1
 #define SPROTO_CB_NIL -2
@@ -30,6 +31,10 @@ struct sproto_type * sproto_type(const struct sproto *, const char * type_name);
 
 int sproto_pack(const void * src, int srcsz, void * buffer, int bufsz);
 int sproto_unpack(const void * src, int srcsz, void * buffer, int bufsz);
+// Select the implementation of sproto_pack/sproto_unpack for all threads ("scalar", "ssse3" or "avx2"),
+// they have the same output. NULL queries the one in use (the best one the cpu supports by default).
+// Return NULL if the name is unknown or not supported by the cpu.
+const char * sproto_packimpl(const char * name);
 
 /* encodeĲṹ */
 struct sproto_arg {
@@ -49,6 +54,20 @@ typedef int (*sproto_callback)(const struct sproto_arg *args);
 int sproto_decode(const struct sproto_type *, const void * data, int size, sproto_callback cb, void *ud);
 int sproto_encode(const struct sproto_type *, void * buffer, int size, sproto_callback cb, void *ud);
 
+/* fieldṹ */
+struct sproto_field {
+	int tag;//index
+	int type;//ͣΪSPROTO_TSTRUCTstֶָtypeͣfieldΪSPROTO_TARRAY
+	const char * name;//ֶ
+	struct sproto_type * st;
+	int key;//fieldָtype͵ֶ
+};
+
+// The fields of a type (sorted by tag), for the encoder and decoder which walk the type directly (see lsproto.c).
+// maxn is the max number of records in the header, includes the records of skipped tags.
+const struct sproto_field * sproto_fields(const struct sproto_type *, int *n, int *maxn);
+const struct sproto_field * sproto_findtag(const struct sproto_type *, int tag);
+
 // for debug use
 void sproto_dump(struct sproto *);
 const char * sproto_name(struct sproto_type *);
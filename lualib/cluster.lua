@@ -1,12 +1,14 @@
 local skynet = require "skynet"
+local core = require "cluster.core"
 
 local clusterd
+local gate
 local cluster = {}
 
 --Զ̵ãӦ
 function cluster.call(node, address, ...)
-	-- skynet.pack(...) will free by cluster.core.packrequest
-	return skynet.call(clusterd, "lua", "req", node, address, skynet.pack(...))
+	-- skynet.pack(...) will free by cluster.core.packcall
+	return skynet.unpack(skynet.rawcall(gate, "lua", core.packcall(node, address, skynet.pack(...))))
 end
 
 --Զ̶˿
@@ -43,11 +45,12 @@ function cluster.register(name, addr)
 end
 
 function cluster.query(node, name)
-	return skynet.call(clusterd, "lua", "req", node, 0, skynet.pack(name))
+	return skynet.unpack(skynet.rawcall(gate, "lua", core.packcall(node, 0, skynet.pack(name))))
 end
 
 skynet.init(function()
 	clusterd = skynet.uniqueservice("clusterd")
+	gate = skynet.call(clusterd, "lua", "gateway")
 end)
 
 return cluster
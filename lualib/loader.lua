@@ -4,6 +4,12 @@ for word in string.gmatch(..., "%S+") do  --�Կո�ָ��ַ�����
 	table.insert(args, word)
 end
 
+-- "@warm name" : instance of launcher's service pool, see service/launcher.lua
+local warm = args[1] == "@warm"
+if warm then
+	table.remove(args, 1)
+end
+
 SERVICE_NAME = args[1] --������������'bootstrap'
 
 local main, pattern
@@ -48,5 +54,45 @@ if LUA_PRELOAD then
 	LUA_PRELOAD = nil
 end
 
+if warm then
+	-- load lualib now, and run main when the launcher sends the start parameters
+	local skynet = require "skynet"
+	local c = require "skynet.core"
+	local callback = c.callback
+	local dispatch
+	-- the first callback stays on the stack of the main thread (see lua-skynet.c), so forward to the one main sets
+	c.callback = function(f, forward)
+		dispatch = f
+		callback(f, forward)
+	end
+	callback(function(prototype, msg, sz, session, source)
+		if dispatch then
+			return dispatch(prototype, msg, sz, session, source)
+		end
+		if prototype ~= skynet.PTYPE_LUA or session ~= 0 then
+			if session ~= 0 then
+				c.send(source, skynet.PTYPE_ERROR, session, "")
+			end
+			return
+		end
+		local param = skynet.unpack(msg, sz)
+		args = {}
+		for word in string.gmatch(param, "%S+") do
+			table.insert(args, word)
+		end
+		local ok, err = xpcall(main, debug.traceback, select(2, table.unpack(args)))
+		if debug.getregistry().memlimit then
+			skynet.error("memlimit is ignored in warm instance, set it in preload")
+		end
+		if not ok then
+			skynet.error("lua loader error : " .. tostring(err))
+			skynet.send(".launcher", "lua", "ERROR")
+			c.command("EXIT")
+		end
+	end)
+	skynet.send(".launcher", "lua", "WARMOK")
+	return
+end
+
 --执行lua服务
 main(select(2, table.unpack(args))) --ִ��bootstrap.lua
@@ -46,9 +46,13 @@ function chan:delete()
 	self.__subscribe = nil
 end
 
+-- push the message to the subscribers directly if the channel is created by this node (see mc.publish)
 function chan:publish(...)
 	local c = assert(self.channel)
-	skynet.call(multicastd, "lua", "PUB", c, mc.pack(self.__pack(...)))
+	local msg, sz = self.__pack(...)
+	if not mc.publish(c, msg, sz) then
+		skynet.call(multicastd, "lua", "PUB", c, mc.pack(msg, sz))
+	end
 end
 
 function chan:subscribe()
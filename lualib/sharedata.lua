@@ -44,6 +44,16 @@ function sharedata.update(name, v, ...)
 	skynet.call(service, "lua", "update", name, v, ...)
 end
 
+-- merge set into the data, and remove the paths in remove, see sharedatad CMD.patch
+function sharedata.patch(name, set, remove)
+	skynet.call(service, "lua", "patch", name, set, remove)
+end
+
+-- new or update by an image file made by sharedata.compile, see service/sharedatad.lua
+function sharedata.load(name, filename)
+	skynet.call(service, "lua", "load", name, filename)
+end
+
 function sharedata.delete(name)
 	skynet.call(service, "lua", "delete", name)
 end
@@ -0,0 +1,68 @@
+--[[
+	Compile the data of sharedata into an image file, sharedata.load(name, filename) maps the file and
+	uses the tables in place : there is no parsing, and the processes on a host share the pages.
+
+	3rd/lua/lua lualib/sharedata/compile.lua source.lua image [args...]
+
+	The source is loaded as sharedata.new(name, "@source.lua", ...) does : the table it returns, or the
+	globals it sets. In a service, require "sharedata.compile" returns compile(source, filename, ...),
+	the source is a table or a filename.
+
+	The image can only be loaded by the same build of sharedata.core, compile it again after upgrade.
+]]
+
+local modname = ...
+
+if modname ~= "sharedata.compile" then
+	-- from command line, find luaclib by the path of the script
+	local root = arg and arg[0] and arg[0]:match "^(.-)lualib[/\\]sharedata[/\\]compile%.lua$"
+	if root then
+		package.cpath = (root == "" and "./" or root) .. "luaclib/?.so;" .. package.cpath
+	end
+end
+
+local core = require "sharedata.core"
+
+local env_mt = { __index = _ENV }
+
+local function load_source(filename, ...)
+	local env = setmetatable({}, env_mt)
+	local f = assert(loadfile(filename, "bt", env))
+	local ret = f(...)
+	setmetatable(env, nil)
+	if type(ret) == "table" then
+		return ret
+	end
+	return env
+end
+
+local function compile(source, filename, ...)
+	if type(source) == "string" then
+		source = load_source(source, ...)
+	end
+	local cobj = core.new(source)
+	local ok, image = pcall(core.dump, cobj)
+	core.delete(cobj)
+	if not ok then
+		error(image)
+	end
+	-- the running processes may map the old file, replace it
+	local tmp = filename .. ".tmp"
+	local f = assert(io.open(tmp, "wb"))
+	f:write(image)
+	f:close()
+	assert(os.rename(tmp, filename))
+	return #image
+end
+
+if modname == "sharedata.compile" then
+	return compile
+end
+
+local source, filename = ...
+if not source or not filename then
+	print "Usage : lua compile.lua source.lua image [args...]"
+	os.exit(1)
+end
+local size = compile(source, filename, select(3, ...))
+print(string.format("%s : %d bytes", filename, size))
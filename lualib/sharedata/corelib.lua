@@ -7,6 +7,7 @@ local conf = {}
 
 conf.host = {
 	new = core.new,
+	load = core.load,
 	delete = core.delete,
 	getref = core.getref,
 	markdirty = core.markdirty,
@@ -21,26 +22,42 @@ local index = core.index
 local needupdate = core.needupdate
 local len = core.len
 
-local function findroot(self)
-	while self.__parent do
-		self = self.__parent
-	end
-	return self
+--[[
+	A proxy of the subtable (or root) is { __obj, __root, __version, __parent, __key, __cache (the child proxies) }.
+	The __index of its metatable is a value cache (the fields read before, and the child proxies), and the
+	cache's __index reads the c object. So the second read of a field doesn't call any function.
+
+	The reader switches to a new version only after conf.update (called by the monitor of sharedata), which
+	drops the value caches of the proxies filled before (root.__caches). The root keeps the reference
+	of the version (__gcobj), a proxy binds to the new version when it's used (__version is changed), so the
+	unchanged subtables (shared by the versions) keep the pointer.
+]]
+
+local value_mt = {}
+local owner = setmetatable({}, { __mode = "k" })	-- value cache -> proxy
+
+local function newcache(proxy)
+	local cache = setmetatable({}, value_mt)
+	owner[cache] = proxy
+	return cache
 end
 
-local function update(root, cobj, gcobj)
-	root.__obj = cobj
-	root.__gcobj = gcobj
-	local children = root.__cache
-	if children then
-		for k,v in pairs(children) do
-			local pointer = index(cobj, k)
-			if type(pointer) == "userdata" then
-				update(v, pointer, gcobj)
-			else
-				children[k] = nil
-			end
-		end
+local function newproxy(proxy)
+	setmetatable(proxy, {
+		__index = newcache(proxy),
+		__len = meta.__len,
+		__pairs = meta.__pairs,
+	})
+	return proxy
+end
+
+local function invalidate(root)
+	local filled = root.__caches
+	for i = 1, #filled do
+		local proxy = filled[i]
+		filled[i] = nil
+		proxy.__filled = false
+		getmetatable(proxy).__index = newcache(proxy)
 	end
 end
 
@@ -54,41 +71,52 @@ local function genkey(self)
 end
 
 local function getcobj(self)
-	local obj = self.__obj
-	if isdirty(obj) then
-		local newobj, newtbl = needupdate(self.__gcobj)
+	local root = self.__root
+	if root.__update then
+		root.__update = false
+		local newobj, newtbl = needupdate(root.__gcobj)
 		if newobj then
-			local newgcobj = newtbl.__gcobj
-			local root = findroot(self)
-			update(root, newobj, newgcobj)
-			if obj == self.__obj then
-				error ("The key [" .. genkey(self) .. "] doesn't exist after update")
-			end
-			obj = self.__obj
+			root.__obj = newobj
+			root.__gcobj = newtbl.__gcobj
+			root.__version = root.__version + 1
+		end
+	end
+	local version = root.__version
+	if self.__version ~= version then
+		local v = index(getcobj(self.__parent), self.__key)
+		if type(v) ~= "userdata" then
+			error ("The key [" .. genkey(self) .. "] doesn't exist after update")
 		end
+		self.__obj = v
+		self.__version = version
 	end
-	return obj
+	return self.__obj
 end
 
-function meta:__index(key)
+local function fetch(self, key)
 	local obj = getcobj(self)
 	local v = index(obj, key)
 	if type(v) == "userdata" then
 		local children = self.__cache
-		if children == nil then
+		if not children then
 			children = {}
 			self.__cache = children
 		end
 		local r = children[key]
 		if r then
+			r.__obj = v
+			r.__version = self.__version
 			return r
 		end
-		r = setmetatable({
+		r = newproxy {
 			__obj = v,
-			__gcobj = self.__gcobj,
+			__root = self.__root,
+			__version = self.__version,
 			__parent = self,
 			__key = key,
-		}, meta)
+			__cache = false,
+			__filled = false,
+		}
 		children[key] = r
 		return r
 	else
@@ -96,6 +124,20 @@ function meta:__index(key)
 	end
 end
 
+function value_mt:__index(key)
+	local proxy = owner[self]
+	local v = fetch(proxy, key)
+	if v ~= nil then
+		rawset(self, key, v)
+		if not proxy.__filled then
+			proxy.__filled = true
+			local filled = proxy.__root.__caches
+			filled[#filled+1] = proxy
+		end
+	end
+	return v
+end
+
 function meta:__len()
 	return len(getcobj(self))
 end
@@ -114,18 +156,27 @@ end
 
 function conf.box(obj)
 	local gcobj = core.box(obj)
-	return setmetatable({
+	local root = newproxy {
 		__parent = false,
 		__obj = obj,
 		__gcobj = gcobj,
+		__version = 0,
 		__key = "",
-	} , meta)
+		__cache = false,
+		__filled = false,
+		__update = false,
+	}
+	root.__root = root
+	root.__caches = {}
+	return root
 end
 
 function conf.update(self, pointer)
 	local cobj = self.__obj
 	assert(isdirty(cobj), "Only dirty object can be update")
 	core.update(self.__gcobj, pointer, { __gcobj = core.box(pointer) })
+	self.__update = true
+	invalidate(self)
 end
 
 function conf.flush(obj)
@@ -26,6 +26,7 @@ local skynet = {
 	PTYPE_DEBUG = 9,
 	PTYPE_LUA = 10,
 	PTYPE_SNAX = 11,
+	PTYPE_TOPIC = 12,
 }
 
 -- code cache
@@ -54,6 +55,7 @@ local watching_service = {}
 local watching_session = {}
 local dead_service = {}
 local error_queue = {}
+local error_message = {}
 local fork_queue = {}
 
 -- suspend is function
@@ -71,11 +73,14 @@ local function dispatch_error_queue()
 	if session then
 		local co = session_id_coroutine[session]
 		session_id_coroutine[session] = nil
-		return suspend(co, coroutine_resume(co, false))
+		local err = error_message[session]
+		error_message[session] = nil
+		return suspend(co, coroutine_resume(co, false, err))
 	end
 end
 
-local function _error_dispatch(error_session, error_source)
+-- PTYPE_ERROR may carry an error message (ie. the remote error of cluster), it's raised by the call
+local function _error_dispatch(error_session, error_source, msg, sz)
 	if error_session == 0 then
 		-- service is down
 		--  Don't remove from watching_service , because user may call dead service
@@ -90,6 +95,9 @@ local function _error_dispatch(error_session, error_source)
 	else
 		-- capture an error for error_session
 		if watching_session[error_session] then
+			if sz and sz > 0 then
+				error_message[error_session] = c.tostring(msg, sz)
+			end
 			table.insert(error_queue, error_session)
 		end
 	end
@@ -394,7 +402,7 @@ local function yield_call(service, session)
 	local succ, msg, sz = coroutine_yield("CALL", session) --profile.yield���ж�Э�̣�����true��"CALL"��session
 	watching_session[session] = nil
 	if not succ then
-		error "call failed"
+		error(msg and ("call failed : " .. msg) or "call failed")
 	end
 	return msg,sz
 end
@@ -526,6 +534,35 @@ local function raw_dispatch_message(prototype, msg, sz, session, source)
 	end
 end
 
+local gc_idle	-- kb of each gc step in idle mode, see skynet.gcmode
+local gc_busy = 0
+local IDLE_GC_BUSY = 100	-- do a step after so many messages even if the queue is never empty
+
+local function idle_gc()
+	gc_busy = gc_busy + 1
+	if gc_busy >= IDLE_GC_BUSY or c.intcommand "MQLEN" == 0 then
+		gc_busy = 0
+		collectgarbage("step", gc_idle)
+	end
+end
+
+-- mode "incremental" : the default automatic gc of lua
+-- mode "idle" : stop the automatic gc, and run a step of n kb (0 for a basic step) when the message queue is empty
+-- returns the previous mode and step
+function skynet.gcmode(mode, step)
+	local old_mode, old_step = gc_idle and "idle" or "incremental", gc_idle
+	if mode == "idle" then
+		gc_idle = tonumber(step) or 0
+		collectgarbage "stop"
+	elseif mode == "incremental" then
+		gc_idle = nil
+		collectgarbage "restart"
+	else
+		assert(mode == nil, "Invalid gc mode")
+	end
+	return old_mode, old_step
+end
+
 --[[ lua服务的消息处理函数，在skynet.start函数中设置
      参数依次为@1消息type @2:msg指针 @3:msg‘s length @4：session @5：source handle
 --]] 
@@ -547,6 +584,9 @@ function skynet.dispatch_message(...)
 			end
 		end
 	end
+	if gc_idle then
+		idle_gc()
+	end
 	assert(succ, tostring(err))
 end
 
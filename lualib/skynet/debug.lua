@@ -23,6 +23,38 @@ local function init(skynet, export)
 			collectgarbage "collect"
 		end
 
+		local function gcstat()
+			local stat = require("skynet.gcstat").stat()
+			stat.mem = collectgarbage "count"
+			stat.mode, stat.idlestep = skynet.gcmode()
+			-- lua can't query pause and stepmul without setting them
+			stat.pause = collectgarbage("setpause", 200)
+			collectgarbage("setpause", stat.pause)
+			stat.stepmul = collectgarbage("setstepmul", 200)
+			collectgarbage("setstepmul", stat.stepmul)
+			return stat
+		end
+
+		function dbgcmd.GCSTAT(reset)
+			local stat = gcstat()
+			if reset then
+				require("skynet.gcstat").reset()
+			end
+			skynet.ret(skynet.pack(stat))
+		end
+
+		-- GCSET("mode", "incremental"/"idle", idle step), GCSET("pause", n), GCSET("stepmul", n)
+		function dbgcmd.GCSET(key, value, step)
+			if key == "mode" then
+				skynet.gcmode(value, step)
+			elseif key == "pause" or key == "stepmul" then
+				collectgarbage("set" .. key, assert(tonumber(value), "Need a number"))
+			else
+				error("Invalid gc option " .. tostring(key))
+			end
+			skynet.ret(skynet.pack(gcstat()))
+		end
+
 		function dbgcmd.STAT()
 			local stat = {}
 			stat.mqlen = skynet.mqlen()
@@ -10,6 +10,12 @@ local maxclient	-- max client
 local client_number = 0
 local CMD = setmetatable({}, { __gc = function() netpack.clear(queue) end })
 local nodelay = false
+local shards	-- sharded gate : the services own the client sockets
+
+-- socket ids are not spread evenly (ie. the client and server sockets interleave), so hash them
+local function shard_of(fd)
+	return shards[(((fd * 0x9e3779b1) & 0xffffffff) >> 16) % #shards + 1]
+end
 
 local connection = {}
 
@@ -19,10 +25,25 @@ function gateserver.openclient(fd)
 	end
 end
 
+-- the packages of fd are sent to agent (in "client" protocol) by netpack directly, handler.message won't be called.
+-- gateserver.route(fd) removes the route, and so does gateserver.closeclient(fd).
+function gateserver.route(fd, agent, client)
+	if agent and not connection[fd] then
+		return
+	end
+	queue = netpack.route(queue, fd, agent, client)
+end
+
+-- false when the send buffer of fd reached conf.highwater (and not drained below conf.lowwater yet) or fd is closed.
+-- It's cheap, the agents can call socketdriver.writable(fd) directly as well, to stop generating updates for a choking client.
+gateserver.writable = socketdriver.writable
+
 function gateserver.closeclient(fd)
 	local c = connection[fd]
 	if c then
 		connection[fd] = false
+		-- the packages arrived before the close event are dropped, not sent to the agent
+		queue = netpack.route(queue, fd)
 		socketdriver.close(fd)
 	end
 end
@@ -30,21 +51,61 @@ end
 function gateserver.start(handler)
 	assert(handler.message)
 	assert(handler.connect)
+	local fdcommand = handler.fdcommand or {}
 
+	-- conf.shard = N : spawn N services of the same gate, the accepted sockets are spread over them by fd.
+	-- The commands in the set handler.fdcommand take a fd as the first argument, they are forwarded to the owner,
+	-- so the callers needn't know the shards.
 	function CMD.open( source, conf )
 		assert(not socket)
 		local address = conf.address or "0.0.0.0" --ipַ
 		local port = assert(conf.port)            --˿ں
 		maxclient = conf.maxclient or 1024        --ͻ
 		nodelay = conf.nodelay
+		local n = conf.shard or 1
+		if n > 1 then
+			shards = {}
+			local shard_conf = {}
+			for k,v in pairs(conf) do
+				shard_conf[k] = v
+			end
+			shard_conf.shard = nil
+			shard_conf.maxclient = (maxclient + n - 1) // n
+			for i = 1, n do
+				shards[i] = skynet.newservice(SERVICE_NAME)
+				skynet.call(shards[i], "lua", "openshard", shard_conf, source)
+			end
+		end
 		skynet.error(string.format("Listen on %s:%d", address, port))
 		socket = socketdriver.listen(address, port) --
+		-- conf.highwater/lowwater (bytes) and conf.waterpolicy ("drop", "close" or "pause") are inherited by the client sockets
+		if conf.highwater then
+			socketdriver.setwater(socket, conf.highwater, conf.lowwater, conf.waterpolicy)
+		end
+		-- conf.readsize : the initial read buffer size of the client sockets, it adapts to the traffic later
+		if conf.readsize then
+			socketdriver.readsize(socket, conf.readsize)
+		end
 		socketdriver.start(socket)
 		if handler.open then
 			return handler.open(source, conf)
 		end
 	end
 
+	-- open a shard of gate, source is the service who opens the gate
+	function CMD.openshard( _, conf, source )
+		maxclient = conf.maxclient
+		nodelay = conf.nodelay
+		if handler.open then
+			return handler.open(source, conf)
+		end
+	end
+
+	-- call handler.command in shard with the real source
+	function CMD.shardcommand( _, cmd, source, ...)
+		return handler.command(cmd, source, ...)
+	end
+
 	function CMD.close()
 		assert(socket)
 		socketdriver.close(socket)
@@ -80,6 +141,11 @@ function gateserver.start(handler)
 
 	--ͻϢ
 	function MSG.open(fd, msg) 
+		if shards then
+			-- the shard starts the socket, and then the socket messages go to the shard
+			skynet.send(shard_of(fd), "lua", "shardaccept", fd, msg)
+			return
+		end
 		if client_number >= maxclient then --ͻӳ
 			socketdriver.close(fd)
 			return
@@ -100,7 +166,16 @@ function gateserver.start(handler)
 		end
 	end
 
+	-- accepted by the master of shards, the socket will be started by this shard (gateserver.openclient)
+	function CMD.shardaccept(_, fd, addr)
+		MSG.open(fd, addr)
+	end
+
 	function MSG.close(fd)
+		if shards and fd ~= socket then
+			-- the socket is closed before a shard starts it
+			return
+		end
 		if fd ~= socket then
 			if handler.disconnect then
 				handler.disconnect(fd)
@@ -112,6 +187,9 @@ function gateserver.start(handler)
 	end
 
 	function MSG.error(fd, msg)
+		if shards and fd ~= socket then
+			return
+		end
 		if fd == socket then
 			socketdriver.close(fd)
 			skynet.error(msg)
@@ -143,13 +221,26 @@ function gateserver.start(handler)
 		end
 	}
 
+	local function shard_command(cmd, address, fd, ...)
+		if shards and fdcommand[cmd] then
+			return skynet.call(shard_of(fd), "lua", "shardcommand", cmd, address, fd, ...)
+		end
+		return handler.command(cmd, address, fd, ...)
+	end
+
 	skynet.start(function()
-		skynet.dispatch("lua", function (_, address, cmd, ...) --luaϢĴ
+		skynet.dispatch("lua", function (session, address, cmd, ...) --luaϢĴ
 			local f = CMD[cmd]
-			if f then
+			if session == 0 then
+				if f then
+					f(address, ...)
+				else
+					shard_command(cmd, address, ...)
+				end
+			elseif f then
 				skynet.ret(skynet.pack(f(address, ...)))
 			else
-				skynet.ret(skynet.pack(handler.command(cmd, address, ...)))
+				skynet.ret(skynet.pack(shard_command(cmd, address, ...)))
 			end
 		end)
 	end)
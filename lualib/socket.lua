@@ -365,6 +365,10 @@ end
 
 socket.write = assert(driver.send)
 socket.lwrite = assert(driver.lsend)
+socket.broadcast = assert(driver.broadcast)
+socket.setwater = assert(driver.setwater)
+socket.writable = assert(driver.writable)
+socket.readsize = assert(driver.readsize)
 socket.header = assert(driver.header)
 
 function socket.invalid(id)
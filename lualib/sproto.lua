@@ -24,15 +24,33 @@ function sproto.new(bin)
 	return setmetatable(self, sproto_mt)
 end
 
-function sproto.sharenew(cobj)
+-- handle, slot and version are given by sprotoloader.load
+function sproto.sharenew(cobj, handle, slot, version)
 	local self = {
 		__cobj = cobj,
 		__tcache = setmetatable( {} , weak_mt ),
 		__pcache = setmetatable( {} , weak_mt ),
+		__handle = handle,
+		__slot = slot,
+		__version = version,
 	}
 	return setmetatable(self, sproto_nogc)
 end
 
+-- Switch a sproto of sprotoloader to the newest version saved in its slot, return true if it's changed.
+-- The types are valid while the handle of their version is alive, so the protocols (see queryproto) and the
+-- hosts keep the handle with the types.
+function sproto:update()
+	local slot = self.__slot
+	if slot == nil or core.protoversion(slot) == self.__version then
+		return false
+	end
+	self.__cobj, self.__handle, self.__version = core.loadproto(slot)
+	self.__tcache = setmetatable( {} , weak_mt )
+	self.__pcache = setmetatable( {} , weak_mt )
+	return true
+end
+
 function sproto.parse(ptext)
 	local parser = require "sprotoparser"
 	local pbin = parser.parse(ptext)
@@ -45,11 +63,27 @@ function sproto:host( packagename )
 	local obj = {
 		__proto = self,
 		__package = assert(core.querytype(self.__cobj, packagename), "type package not found"),--ָpackagenameӦsproto_type
+		__packagename = packagename,
+		__version = self.__version,
+		__handle = self.__handle,	-- keep the version of __package alive
 		__session = {},
 	}
 	return setmetatable(obj, host_mt)
 end
 
+-- follow the new version of the shared sproto
+local function host_update(self)
+	local sp = self.__proto
+	if sp.__slot then
+		sp:update()
+		if sp.__version ~= self.__version then
+			self.__package = assert(core.querytype(sp.__cobj, self.__packagename), "type package not found")
+			self.__version = sp.__version
+			self.__handle = sp.__handle
+		end
+	end
+end
+
 local function querytype(self, typename)
 	local v = self.__tcache[typename]
 	if not v then
@@ -103,6 +137,7 @@ local function queryproto(self, pname)
 			response =resp,
 			name = pname,
 			tag = tag,
+			handle = self.__handle,	-- keep the version of request and response alive
 		}
 		self.__pcache[pname] = v --
 		self.__pcache[tag]  = v
@@ -182,12 +217,14 @@ end
 
 local header_tmp = {}
 
-local function gen_response(self, response, session)
+-- proto (and its handle) is kept by the closure, the version may be swapped before the response
+local function gen_response(self, proto, session)
 	return function(args, ud)
 		header_tmp.type = nil
 		header_tmp.session = session
 		header_tmp.ud = ud
 		local header = core.encode(self.__package, header_tmp)
+		local response = proto.response
 		if response then
 			local content = core.encode(response, args)
 			return core.pack(header .. content)
@@ -198,6 +235,7 @@ local function gen_response(self, response, session)
 end
 
 function host:dispatch(...)
+	host_update(self)
 	local bin = core.unpack(...)
 	header_tmp.type = nil
 	header_tmp.session = nil
@@ -212,19 +250,19 @@ function host:dispatch(...)
 			result = core.decode(proto.request, content)
 		end
 		if header_tmp.session then
-			return "REQUEST", proto.name, result, gen_response(self, proto.response, header_tmp.session), header.ud
+			return "REQUEST", proto.name, result, gen_response(self, proto, header_tmp.session), header.ud
 		else
 			return "REQUEST", proto.name, result, nil, header.ud
 		end
 	else
 		-- response
 		local session = assert(header_tmp.session, "session not found")
-		local response = assert(self.__session[session], "Unknown session")
+		local proto = assert(self.__session[session], "Unknown session")
 		self.__session[session] = nil
-		if response == true then
+		if proto == true then
 			return "RESPONSE", session, nil, header.ud
 		else
-			local result = core.decode(response, content)
+			local result = core.decode(proto.response, content)
 			return "RESPONSE", session, result, header.ud
 		end
 	end
@@ -234,6 +272,10 @@ end
 function host:attach(sp)
     --nameΪЭargsΪݵʵݣsessionΪţudΪ
 	return function(name, args, session, ud)
+		host_update(self)
+		if sp.__slot then
+			sp:update()
+		end
 		local proto = queryproto(sp, name) --Э飬ЭϢ
 		header_tmp.type = proto.tag --ЭindexΪ
 		header_tmp.session = session --Ϣ
@@ -241,7 +283,8 @@ function host:attach(sp)
 		local header = core.encode(self.__package, header_tmp) --ͷ
 
 		if session then
-			self.__session[session] = proto.response or true
+			-- proto keeps the version of the response type
+			self.__session[session] = proto.response and proto or true
 		end
 
 		if args then
@@ -4,23 +4,31 @@ local sproto = require "sproto"
 
 local loader = {}
 
+-- register/save a new version of the slot, return the version.
+-- The sprotos loaded from the slot switch to the new version (see sproto:update),
+-- and the old one is released after nobody uses it.
 function loader.register(filename, index)
 	local f = assert(io.open(filename), "Can't open sproto file")
 	local data = f:read "a"
 	f:close()
 	local sp = core.newproto(parser.parse(data))
-	core.saveproto(sp, index)
+	return core.saveproto(sp, index)
 end
 
 function loader.save(bin, index)
 	local sp = core.newproto(bin)
-	core.saveproto(sp, index)
+	return core.saveproto(sp, index)
 end
 
 function loader.load(index)
-	local sp = core.loadproto(index)
-	--  no __gc in metatable
-	return sproto.sharenew(sp)
+	index = index or 0
+	local sp, handle, version = core.loadproto(index)
+	--  no __gc in metatable, the handle keeps the reference of the shared object
+	return sproto.sharenew(sp, handle, index, version)
+end
+
+function loader.version(index)
+	return core.protoversion(index or 0)
 end
 
 return loader
@@ -412,9 +412,7 @@ local function packgroup(t,p)
 				fields[type_fields.name] = type_fields.tag --field.age=2 ֶ-index
 			end
 		end
-		alltypes[name] = { id = idx - 1, fields = fields }  --{ [1] = "get.request", [2] = "get.response", ["get.response"] = { ["id"] = 1, ["fields"] = { ["result"] = 0 }}, ["get.request"] = { ["id"] = 0,["fields"] = {["what"] = 0} }
-}
-
+		alltypes[name] = { id = idx - 1, fields = fields }  --{ [1] = "get.request", [2] = "get.response", ["get.response"] = { ["id"] = 1, ["fields"] = { ["result"] = 0 }}, ["get.request"] = { ["id"] = 0,["fields"] = {["what"] = 0} }}
 	end
 
 	tt = {}
@@ -431,8 +429,6 @@ local function packgroup(t,p)
 			tbl.name = name
 		end
 		table.sort(tmp, function(a,b) return a.tag < b.tag end)
-		logger.debug("test")
-		logger.debug(dump.dump(tmp))
 		tp = {}
 		for _, tbl in ipairs(tmp) do
 			table.insert(tp, packproto(tbl.name, tbl, alltypes)) --Эֽ
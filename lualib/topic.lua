@@ -0,0 +1,67 @@
+local skynet = require "skynet"
+local mc = require "multicast"
+
+--[[
+	Publish and subscribe by topic : the words separated by '.', ie. "scene.12.combat" .
+	The pattern of subscribe can use '*' for one word, and '#' (the last word only) for zero or more words,
+	ie. "scene.*.combat" or "scene.#" . See service/topicd.lua .
+
+	topic.publish(name, ...)
+	topic.subscribe(pattern, function(name, ...) end) returns the id for topic.unsubscribe(id)
+
+	The events are delivered in batches, the order of the events of a publisher is kept.
+]]
+
+local topicd
+local channel
+local handler = {}	-- id -> function
+local topic = {}
+
+function topic.publish(name, ...)
+	if channel == nil then
+		channel = mc.new { channel = skynet.call(topicd, "lua", "CHANNEL") }
+	end
+	channel:publish(name, skynet.packstring(...))
+end
+
+function topic.subscribe(pattern, f)
+	assert(type(f) == "function")
+	local id = skynet.call(topicd, "lua", "SUB", pattern)
+	handler[id] = f
+	return id
+end
+
+function topic.unsubscribe(id)
+	if handler[id] then
+		handler[id] = nil
+		skynet.send(topicd, "lua", "USUB", id)
+	end
+end
+
+local function dispatch_batch(_, _, events)
+	for i = 1, #events, 3 do
+		local f = handler[events[i]]
+		-- maybe unsubscribe first, drop the event
+		if f then
+			local name = events[i+1]
+			local ok, err = pcall(f, name, skynet.unpack(events[i+2]))
+			if not ok then
+				skynet.error(string.format("topic %s : %s", name, err))
+			end
+		end
+	end
+end
+
+local function init()
+	topicd = skynet.uniqueservice "topicd"
+	skynet.register_protocol {
+		name = "topic",
+		id = skynet.PTYPE_TOPIC,
+		unpack = skynet.unpack,
+		dispatch = dispatch_batch,
+	}
+end
+
+skynet.init(init, "topic")
+
+return topic
@@ -36,5 +36,7 @@ linux freebsd : SKYNET_LIBS += -lrt
 macosx : MALLOC_STATICLIB :=
 macosx : SKYNET_DEFINES :=-DNOUSE_JEMALLOC
 
+# Use io_uring instead of epoll on linux 6.0+ (multishot recv and provided buffer ring) : make linux SKYNET_DEFINES=-DUSE_IO_URING
+
 linux macosx freebsd :
 	$(MAKE) all PLAT=$@ SKYNET_LIBS="$(SKYNET_LIBS)" SHARED="$(SHARED)" EXPORT="$(EXPORT)" MALLOC_STATICLIB="$(MALLOC_STATICLIB)" SKYNET_DEFINES="$(SKYNET_DEFINES)"
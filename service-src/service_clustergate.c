@@ -0,0 +1,934 @@
+#include "skynet.h"
+#include "skynet_socket.h"
+#include "databuffer.h"
+#include "hashid.h"
+
+/*
+	clustergate handles the cluster wire protocol (See lualib-src/lua-cluster.c) without lua.
+
+	clustergate listen the PTYPE_TEXT from clusterd (control) :
+	node name host:port : set (or reset) the address of node
+	listen host port : accept the requests from other nodes, the caller gets an error if it fails
+
+	PTYPE_LUA : request from local service, packed by cluster.core.packcall
+		BYTE nodelen
+		STRING node
+		BYTE namelen (0 means address is a DWORD handle)
+		DWORD addr / STRING name
+		PADDING msg
+	The response (or error) is sent back to the caller with its session.
+
+	Requests from remote nodes are forwarded to the local services with the sessions allocated by
+	clustergate, and the responses are sent back with the remote sessions.
+	The name query (address 0) is forwarded to clusterd in PTYPE_TEXT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+
+#define BACKLOG 32
+#define MAX_CONNECTION 4096
+#define HASH_SIZE 4096
+#define MULTI_PART 0x8000
+
+#define CONN_LISTEN 1
+#define CONN_ACCEPT 2
+#define CONN_CONNECT 3
+
+// a request waiting for the response, keyed by session
+struct request {
+	struct request * next;
+	uint32_t session;
+	uint32_t source;	// the caller (client side)
+	int reply;	// the session of caller (client side) or remote session (server side)
+	int fd;
+	char * buffer;	// multi part message
+	int size;
+	int offset;
+};
+
+struct reqmap {
+	struct request * slot[HASH_SIZE];
+};
+
+// multi part request from remote node
+struct largereq {
+	struct largereq * next;
+	uint32_t session;
+	uint32_t addr;
+	char * name;
+	char * buffer;
+	int size;
+	int offset;
+};
+
+struct connection {
+	int id;
+	int type;
+	int node;	// index of node (CONN_CONNECT), -1 if node is reset
+	struct databuffer buffer;
+	struct largereq * large;
+};
+
+struct node {
+	char * name;
+	char * host;
+	int port;
+	int last;
+	int * channel;	// [0, channels) for normal requests, [channels] for multi part requests
+};
+
+struct clustergate {
+	struct skynet_context * ctx;
+	uint32_t clusterd;
+	int channels;
+	uint32_t session;
+	int nnode;
+	int cap;
+	struct node * node;
+	struct hashid hash;
+	struct connection conn[MAX_CONNECTION];
+	struct messagepool mp;
+	struct reqmap client;	// remote session -> local caller
+	struct reqmap server;	// local session -> remote caller
+};
+
+static void
+fill_uint32(uint8_t * buf, uint32_t n) {
+	buf[0] = n & 0xff;
+	buf[1] = (n >> 8) & 0xff;
+	buf[2] = (n >> 16) & 0xff;
+	buf[3] = (n >> 24) & 0xff;
+}
+
+static inline uint32_t
+unpack_uint32(const uint8_t * buf) {
+	return buf[0] | buf[1]<<8 | buf[2]<<16 | buf[3]<<24;
+}
+
+static void
+fill_header(uint8_t *buf, int sz) {
+	assert(sz < 0x10000);
+	buf[0] = (sz >> 8) & 0xff;
+	buf[1] = sz & 0xff;
+}
+
+// request map
+
+static struct request *
+reqmap_insert(struct reqmap *m, uint32_t session) {
+	struct request * r = skynet_malloc(sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	r->session = session;
+	struct request ** slot = &m->slot[session % HASH_SIZE];
+	r->next = *slot;
+	*slot = r;
+	return r;
+}
+
+static struct request *
+reqmap_find(struct reqmap *m, uint32_t session) {
+	struct request * r = m->slot[session % HASH_SIZE];
+	while (r) {
+		if (r->session == session)
+			return r;
+		r = r->next;
+	}
+	return NULL;
+}
+
+// remove and return the request, caller should free it
+static struct request *
+reqmap_remove(struct reqmap *m, uint32_t session) {
+	struct request ** ptr = &m->slot[session % HASH_SIZE];
+	while (*ptr) {
+		struct request * r = *ptr;
+		if (r->session == session) {
+			*ptr = r->next;
+			return r;
+		}
+		ptr = &r->next;
+	}
+	return NULL;
+}
+
+static void
+request_free(struct request *r) {
+	skynet_free(r->buffer);
+	skynet_free(r);
+}
+
+static void
+reqmap_clear(struct reqmap *m) {
+	int i;
+	for (i=0;i<HASH_SIZE;i++) {
+		struct request * r = m->slot[i];
+		while (r) {
+			struct request * next = r->next;
+			request_free(r);
+			r = next;
+		}
+		m->slot[i] = NULL;
+	}
+}
+
+// connections
+
+static struct connection *
+conn_find(struct clustergate *g, int id) {
+	int i = hashid_lookup(&g->hash, id);
+	if (i < 0)
+		return NULL;
+	return &g->conn[i];
+}
+
+static struct connection *
+conn_new(struct clustergate *g, int id, int type) {
+	if (hashid_full(&g->hash)) {
+		return NULL;
+	}
+	struct connection * c = &g->conn[hashid_insert(&g->hash, id)];
+	memset(c, 0, sizeof(*c));
+	c->id = id;
+	c->type = type;
+	c->node = -1;
+	return c;
+}
+
+static void
+conn_clear(struct clustergate *g, struct connection *c) {
+	databuffer_clear(&c->buffer, &g->mp);
+	struct largereq * lr = c->large;
+	while (lr) {
+		struct largereq * next = lr->next;
+		skynet_free(lr->name);
+		skynet_free(lr->buffer);
+		skynet_free(lr);
+		lr = next;
+	}
+	hashid_remove(&g->hash, c->id);
+	memset(c, 0, sizeof(*c));
+	c->id = -1;
+}
+
+// nodes
+
+static struct node *
+node_find(struct clustergate *g, const char * name, size_t sz) {
+	int i;
+	for (i=0;i<g->nnode;i++) {
+		struct node * n = &g->node[i];
+		if (strncmp(n->name, name, sz) == 0 && n->name[sz] == '\0')
+			return n;
+	}
+	return NULL;
+}
+
+// close all the channels of the node, the pending requests will fail when the sockets close.
+static void
+node_reset(struct clustergate *g, struct node *n) {
+	int i;
+	for (i=0;i<=g->channels;i++) {
+		int id = n->channel[i];
+		if (id >= 0) {
+			struct connection * c = conn_find(g, id);
+			if (c) {
+				c->node = -1;
+			}
+			skynet_socket_close(g->ctx, id);
+			n->channel[i] = -1;
+		}
+	}
+}
+
+static void
+node_update(struct clustergate *g, const char * name, char * address) {
+	char * portstr = strrchr(address, ':');
+	if (portstr == NULL) {
+		skynet_error(g->ctx, "[clustergate] Invalid address %s for node %s", address, name);
+		return;
+	}
+	*portstr = '\0';
+	int port = strtol(portstr+1, NULL, 10);
+	struct node * n = node_find(g, name, strlen(name));
+	if (n) {
+		if (n->port == port && strcmp(n->host, address) == 0)
+			return;
+		node_reset(g, n);
+		skynet_free(n->host);
+	} else {
+		if (g->nnode >= g->cap) {
+			g->cap = g->cap ? g->cap * 2 : 16;
+			g->node = skynet_realloc(g->node, g->cap * sizeof(struct node));
+		}
+		n = &g->node[g->nnode++];
+		n->name = skynet_strdup(name);
+		n->last = 0;
+		n->channel = skynet_malloc((g->channels + 1) * sizeof(int));
+		int i;
+		for (i=0;i<=g->channels;i++) {
+			n->channel[i] = -1;
+		}
+	}
+	n->host = skynet_strdup(address);
+	n->port = port;
+}
+
+// requests are spread over the channels of node, large (multi part) requests use the last (bulk) channel
+static int
+node_channel(struct clustergate *g, struct node *n, int bulk) {
+	int index;
+	if (bulk) {
+		index = g->channels;
+	} else {
+		index = n->last;
+		n->last = (index + 1) % g->channels;
+	}
+	int id = n->channel[index];
+	if (id >= 0)
+		return id;
+	// The messages sent to a connecting socket are queued by socket server.
+	id = skynet_socket_connect(g->ctx, n->host, n->port);
+	if (id < 0)
+		return -1;
+	struct connection * c = conn_new(g, id, CONN_CONNECT);
+	if (c == NULL) {
+		skynet_socket_close(g->ctx, id);
+		skynet_error(g->ctx, "[clustergate] Too many connections");
+		return -1;
+	}
+	c->node = n - g->node;
+	n->channel[index] = id;
+	return id;
+}
+
+// client side, request to remote node
+
+static void
+send_request(struct clustergate *g, int fd, uint32_t session, const uint8_t * name, int namelen, uint32_t addr, const uint8_t * msg, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	int hsz = namelen ? 6 + namelen : 9;
+	if (sz < MULTI_PART) {
+		uint8_t * buf = skynet_malloc(hsz + 2 + sz);
+		fill_header(buf, hsz + sz);
+		if (namelen) {
+			buf[2] = 0x80;
+			buf[3] = (uint8_t)namelen;
+			memcpy(buf+4, name, namelen);
+			fill_uint32(buf+4+namelen, session);
+		} else {
+			buf[2] = 0;
+			fill_uint32(buf+3, addr);
+			fill_uint32(buf+7, session);
+		}
+		memcpy(buf+2+hsz, msg, sz);
+		skynet_socket_send(ctx, fd, buf, hsz + 2 + sz);
+		return;
+	}
+	uint8_t * buf = skynet_malloc(hsz + 6);
+	fill_header(buf, hsz + 4);
+	if (namelen) {
+		buf[2] = 0x81;
+		buf[3] = (uint8_t)namelen;
+		memcpy(buf+4, name, namelen);
+		fill_uint32(buf+4+namelen, session);
+		fill_uint32(buf+8+namelen, sz);
+	} else {
+		buf[2] = 1;
+		fill_uint32(buf+3, addr);
+		fill_uint32(buf+7, session);
+		fill_uint32(buf+11, sz);
+	}
+	skynet_socket_send(ctx, fd, buf, hsz + 6);
+	while (sz > 0) {
+		int s = sz > MULTI_PART ? MULTI_PART : sz;
+		buf = skynet_malloc(s + 7);
+		fill_header(buf, s + 5);
+		buf[2] = sz > MULTI_PART ? 2 : 3;	// 3 : the last multi part
+		fill_uint32(buf+3, session);
+		memcpy(buf+7, msg, s);
+		skynet_socket_send(ctx, fd, buf, s + 7);
+		msg += s;
+		sz -= s;
+	}
+}
+
+static void
+forward_request(struct clustergate *g, uint32_t source, int session, const uint8_t * msg, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	int nodelen = sz > 0 ? msg[0] : 0;
+	if (sz < nodelen + 2 || sz < nodelen + 2 + (msg[nodelen+1] ? msg[nodelen+1] : 4)) {
+		skynet_error(ctx, "[clustergate] Invalid request from %x", source);
+		skynet_send(ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
+		return;
+	}
+	const char * nodename = (const char *)msg + 1;
+	struct node * n = node_find(g, nodename, nodelen);
+	if (n == NULL) {
+		skynet_error(ctx, "[clustergate] Invalid node %.*s", nodelen, nodename);
+		skynet_send(ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
+		return;
+	}
+	msg += nodelen + 1;
+	sz -= nodelen + 1;
+	int namelen = msg[0];
+	const uint8_t * name = msg + 1;
+	uint32_t addr = 0;
+	if (namelen == 0) {
+		addr = unpack_uint32(msg + 1);
+		msg += 5;
+		sz -= 5;
+	} else {
+		msg += namelen + 1;
+		sz -= namelen + 1;
+	}
+	int fd = node_channel(g, n, sz >= MULTI_PART);
+	if (fd < 0) {
+		skynet_error(ctx, "[clustergate] Connect to node %s (%s:%d) failed", n->name, n->host, n->port);
+		skynet_send(ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
+		return;
+	}
+	uint32_t remote = g->session;
+	if (++g->session == 0 || g->session > 0x7fffffff) {
+		g->session = 1;
+	}
+	struct request * r = reqmap_insert(&g->client, remote);
+	r->source = source;
+	r->reply = session;
+	r->fd = fd;
+	send_request(g, fd, remote, name, namelen, addr, msg, sz);
+}
+
+// err (or NULL) is the error message to the caller, it's raised by skynet.call
+static void
+response_error(struct clustergate *g, struct request *r, const char * err, int sz) {
+	skynet_send(g->ctx, 0, r->source, PTYPE_ERROR, r->reply, (void *)err, err ? sz : 0);
+	request_free(r);
+}
+
+// the connection to node is closed, all the requests on it fail.
+static void
+client_abort(struct clustergate *g, int fd) {
+	int i;
+	for (i=0;i<HASH_SIZE;i++) {
+		struct request ** ptr = &g->client.slot[i];
+		while (*ptr) {
+			struct request * r = *ptr;
+			if (r->fd == fd) {
+				*ptr = r->next;
+				response_error(g, r, NULL, 0);
+			} else {
+				ptr = &r->next;
+			}
+		}
+	}
+}
+
+/*
+	DWORD session
+	BYTE type
+		0: error
+		1: ok
+		2: multi begin
+		3: multi part
+		4: multi end
+	PADDING msg
+ */
+static void
+dispatch_response(struct clustergate *g, struct connection *c, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	uint8_t header[5];
+	if (sz < 5) {
+		skynet_error(ctx, "[clustergate] Invalid response (size=%d) from %d", sz, c->id);
+		char tmp[5];
+		databuffer_read(&c->buffer, &g->mp, tmp, sz);
+		return;
+	}
+	databuffer_read(&c->buffer, &g->mp, (char *)header, 5);
+	sz -= 5;
+	uint32_t session = unpack_uint32(header);
+	struct request * r = reqmap_find(&g->client, session);
+	char * data = NULL;
+	if (sz > 0) {
+		data = skynet_malloc(sz);
+		databuffer_read(&c->buffer, &g->mp, data, sz);
+	}
+	if (r == NULL) {
+		skynet_error(ctx, "[clustergate] Unknown response session %u from %d", session, c->id);
+		skynet_free(data);
+		return;
+	}
+	switch (header[4]) {
+	case 0:
+		response_error(g, reqmap_remove(&g->client, session), data, sz);
+		skynet_free(data);
+		return;
+	case 1:
+		reqmap_remove(&g->client, session);
+		skynet_send(ctx, 0, r->source, PTYPE_RESPONSE | PTYPE_TAG_DONTCOPY, r->reply, data, sz);
+		request_free(r);
+		return;
+	case 2:
+		if (sz == 4 && r->buffer == NULL) {
+			r->size = unpack_uint32((const uint8_t *)data);
+			r->offset = 0;
+			r->buffer = skynet_malloc(r->size);
+			skynet_free(data);
+			return;
+		}
+		break;
+	case 3:
+	case 4:
+		if (r->buffer && r->offset + sz <= r->size) {
+			memcpy(r->buffer + r->offset, data, sz);
+			r->offset += sz;
+			skynet_free(data);
+			if (header[4] == 4) {
+				reqmap_remove(&g->client, session);
+				if (r->offset != r->size) {
+					response_error(g, r, NULL, 0);
+					return;
+				}
+				skynet_send(ctx, 0, r->source, PTYPE_RESPONSE | PTYPE_TAG_DONTCOPY, r->reply, r->buffer, r->size);
+				r->buffer = NULL;
+				request_free(r);
+			}
+			return;
+		}
+		break;
+	}
+	skynet_error(ctx, "[clustergate] Invalid response type %d (session = %u)", header[4], session);
+	skynet_free(data);
+	response_error(g, reqmap_remove(&g->client, session), NULL, 0);
+}
+
+// server side, request from remote node
+
+static void
+reply_errormsg(struct clustergate *g, int fd, uint32_t session, const char * err, int sz) {
+	if (sz > MULTI_PART) {
+		sz = MULTI_PART;
+	}
+	uint8_t * buf = skynet_malloc(sz + 7);
+	fill_header(buf, sz + 5);
+	fill_uint32(buf+2, session);
+	buf[6] = 0;
+	memcpy(buf+7, err, sz);
+	skynet_socket_send(g->ctx, fd, buf, sz + 7);
+}
+
+static void
+reply_error(struct clustergate *g, int fd, uint32_t session, const char * err) {
+	reply_errormsg(g, fd, session, err, strlen(err));
+}
+
+static void
+reply(struct clustergate *g, int fd, uint32_t session, const uint8_t * msg, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	if (sz <= MULTI_PART) {
+		uint8_t * buf = skynet_malloc(sz + 7);
+		fill_header(buf, sz + 5);
+		fill_uint32(buf+2, session);
+		buf[6] = 1;
+		memcpy(buf+7, msg, sz);
+		skynet_socket_send(ctx, fd, buf, sz + 7);
+		return;
+	}
+	uint8_t * buf = skynet_malloc(11);
+	fill_header(buf, 9);
+	fill_uint32(buf+2, session);
+	buf[6] = 2;
+	fill_uint32(buf+7, (uint32_t)sz);
+	skynet_socket_send(ctx, fd, buf, 11);
+	while (sz > 0) {
+		int s = sz > MULTI_PART ? MULTI_PART : sz;
+		buf = skynet_malloc(s + 7);
+		fill_header(buf, s + 5);
+		fill_uint32(buf+2, session);
+		buf[6] = sz > MULTI_PART ? 3 : 4;
+		memcpy(buf+7, msg, s);
+		skynet_socket_send(ctx, fd, buf, s + 7);
+		msg += s;
+		sz -= s;
+	}
+}
+
+// msg is owned by clustergate
+static void
+call_local(struct clustergate *g, int fd, uint32_t remote, uint32_t addr, const char * name, void * msg, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	int type = PTYPE_RESERVED_LUA | PTYPE_TAG_DONTCOPY | PTYPE_TAG_ALLOCSESSION;
+	int session;
+	if (name) {
+		session = skynet_sendname(ctx, 0, name, type, 0, msg, sz);
+	} else if (addr == 0) {
+		// query name
+		session = skynet_send(ctx, 0, g->clusterd, PTYPE_TEXT | PTYPE_TAG_DONTCOPY | PTYPE_TAG_ALLOCSESSION, 0, msg, sz);
+	} else {
+		session = skynet_send(ctx, 0, addr, type, 0, msg, sz);
+	}
+	if (session < 0) {
+		reply_error(g, fd, remote, "Invalid address");
+		return;
+	}
+	struct request * r = reqmap_insert(&g->server, session);
+	r->fd = fd;
+	r->reply = remote;
+}
+
+static void
+large_request(struct clustergate *g, struct connection *c, uint32_t session, uint32_t addr, char * name, int size) {
+	struct largereq * lr = skynet_malloc(sizeof(*lr));
+	lr->session = session;
+	lr->addr = addr;
+	lr->name = name;
+	lr->size = size;
+	lr->offset = 0;
+	lr->buffer = skynet_malloc(size);
+	lr->next = c->large;
+	c->large = lr;
+}
+
+static void
+large_part(struct clustergate *g, struct connection *c, uint32_t session, int last, int sz) {
+	struct largereq ** ptr = &c->large;
+	while (*ptr) {
+		struct largereq * lr = *ptr;
+		if (lr->session == session) {
+			if (lr->offset + sz > lr->size) {
+				break;
+			}
+			databuffer_read(&c->buffer, &g->mp, lr->buffer + lr->offset, sz);
+			lr->offset += sz;
+			if (!last)
+				return;
+			*ptr = lr->next;
+			if (lr->offset == lr->size) {
+				call_local(g, c->id, session, lr->addr, lr->name, lr->buffer, lr->size);
+			} else {
+				skynet_free(lr->buffer);
+				reply_error(g, c->id, session, "Invalid large req");
+			}
+			skynet_free(lr->name);
+			skynet_free(lr);
+			return;
+		}
+		ptr = &lr->next;
+	}
+	// skip the part
+	while (sz > 0) {
+		char tmp[256];
+		int s = sz > (int)sizeof(tmp) ? (int)sizeof(tmp) : sz;
+		databuffer_read(&c->buffer, &g->mp, tmp, s);
+		sz -= s;
+	}
+	if (last) {
+		reply_error(g, c->id, session, "Invalid large req");
+	}
+}
+
+// returns -1 if the package is invalid
+static int
+dispatch_request(struct clustergate *g, struct connection *c, int sz) {
+	uint8_t header[268];
+	if (sz < 1)
+		return -1;
+	databuffer_read(&c->buffer, &g->mp, (char *)header, 1);
+	--sz;
+	int type = header[0];
+	switch (type) {
+	case 0:
+	case 1: {
+		if ((type == 0 && sz < 8) || (type == 1 && sz != 12))
+			return -1;
+		databuffer_read(&c->buffer, &g->mp, (char *)header, 8);
+		sz -= 8;
+		uint32_t addr = unpack_uint32(header);
+		uint32_t session = unpack_uint32(header+4);
+		if (type == 1) {
+			databuffer_read(&c->buffer, &g->mp, (char *)header, 4);
+			large_request(g, c, session, addr, NULL, unpack_uint32(header));
+		} else {
+			void * msg = skynet_malloc(sz);
+			databuffer_read(&c->buffer, &g->mp, msg, sz);
+			call_local(g, c->id, session, addr, NULL, msg, sz);
+		}
+		return 0;
+	}
+	case 2:
+	case 3:
+		if (sz < 4)
+			return -1;
+		databuffer_read(&c->buffer, &g->mp, (char *)header+1, 4);
+		large_part(g, c, unpack_uint32(header+1), type == 3, sz - 4);
+		return 0;
+	case 0x80:
+	case 0x81: {
+		if (sz < 1)
+			return -1;
+		databuffer_read(&c->buffer, &g->mp, (char *)header, 1);
+		--sz;
+		int namelen = header[0];
+		if (namelen == 0 || sz < namelen + 4 || (type == 0x81 && sz != namelen + 8))
+			return -1;
+		databuffer_read(&c->buffer, &g->mp, (char *)header, namelen + 4);
+		sz -= namelen + 4;
+		char * name = skynet_malloc(namelen + 1);
+		memcpy(name, header, namelen);
+		name[namelen] = '\0';
+		uint32_t session = unpack_uint32(header + namelen);
+		if (type == 0x81) {
+			databuffer_read(&c->buffer, &g->mp, (char *)header, 4);
+			large_request(g, c, session, 0, name, unpack_uint32(header));
+		} else {
+			void * msg = skynet_malloc(sz);
+			databuffer_read(&c->buffer, &g->mp, msg, sz);
+			call_local(g, c->id, session, 0, name, msg, sz);
+			skynet_free(name);
+		}
+		return 0;
+	}
+	default:
+		return -1;
+	}
+}
+
+static void
+dispatch_message(struct clustergate *g, struct connection *c, void * data, int sz) {
+	databuffer_push(&c->buffer, &g->mp, data, sz);
+	for (;;) {
+		int size = databuffer_readheader(&c->buffer, &g->mp, 2);
+		if (size < 0)
+			return;
+		int left = c->buffer.size - size;
+		if (c->type == CONN_CONNECT) {
+			dispatch_response(g, c, size);
+		} else if (dispatch_request(g, c, size)) {
+			skynet_error(g->ctx, "[clustergate] Invalid request package from %d", c->id);
+			skynet_socket_close(g->ctx, c->id);
+			databuffer_clear(&c->buffer, &g->mp);
+			return;
+		}
+		assert(c->buffer.size == left);
+		databuffer_reset(&c->buffer);
+	}
+}
+
+static void
+dispatch_socket_message(struct clustergate *g, const struct skynet_socket_message * message, int sz) {
+	struct skynet_context * ctx = g->ctx;
+	switch(message->type) {
+	case SKYNET_SOCKET_TYPE_DATA: {
+		struct connection * c = conn_find(g, message->id);
+		if (c && c->type != CONN_LISTEN) {
+			dispatch_message(g, c, message->buffer, message->ud);
+		} else {
+			skynet_error(ctx, "[clustergate] Drop unknown connection %d message", message->id);
+			skynet_socket_close(ctx, message->id);
+			skynet_free(message->buffer);
+		}
+		break;
+	}
+	case SKYNET_SOCKET_TYPE_CONNECT: {
+		struct connection * c = conn_find(g, message->id);
+		if (c == NULL) {
+			skynet_error(ctx, "[clustergate] Close unknown connection %d", message->id);
+			skynet_socket_close(ctx, message->id);
+		} else if (c->type != CONN_LISTEN) {
+			skynet_socket_nodelay(ctx, message->id);
+		}
+		break;
+	}
+	case SKYNET_SOCKET_TYPE_CLOSE:
+	case SKYNET_SOCKET_TYPE_ERROR: {
+		struct connection * c = conn_find(g, message->id);
+		if (c == NULL)
+			break;
+		if (c->type == CONN_CONNECT) {
+			if (c->node >= 0) {
+				struct node * n = &g->node[c->node];
+				int i;
+				for (i=0;i<=g->channels;i++) {
+					if (n->channel[i] == c->id) {
+						n->channel[i] = -1;
+					}
+				}
+			}
+			client_abort(g, c->id);
+		}
+		skynet_error(ctx, "[clustergate] socket %s %d", message->type == SKYNET_SOCKET_TYPE_CLOSE ? "close" : "error", c->id);
+		conn_clear(g, c);
+		break;
+	}
+	case SKYNET_SOCKET_TYPE_ACCEPT: {
+		struct connection * c = conn_new(g, message->ud, CONN_ACCEPT);
+		if (c == NULL) {
+			skynet_socket_close(ctx, message->ud);
+			break;
+		}
+		skynet_error(ctx, "[clustergate] socket accept from %.*s", sz, (const char *)(message+1));
+		skynet_socket_start(ctx, message->ud);
+		break;
+	}
+	case SKYNET_SOCKET_TYPE_WARNING:
+		skynet_error(ctx, "[clustergate] fd (%d) send buffer (%d)K", message->id, message->ud);
+		break;
+	}
+}
+
+// response from local service
+static void
+dispatch_reply(struct clustergate *g, int type, int session, const void * msg, size_t sz) {
+	struct request * r = reqmap_remove(&g->server, session);
+	if (r == NULL) {
+		return;
+	}
+	// the connection may be closed
+	if (conn_find(g, r->fd)) {
+		if (type == PTYPE_RESPONSE) {
+			reply(g, r->fd, r->reply, msg, (int)sz);
+		} else if (sz > 0) {
+			// the error message of PTYPE_ERROR, see skynet.lua
+			reply_errormsg(g, r->fd, r->reply, msg, (int)sz);
+		} else {
+			reply_error(g, r->fd, r->reply, "call failed");
+		}
+	}
+	request_free(r);
+}
+
+// returns NULL, or the error message
+static const char *
+start_listen(struct clustergate *g, const char * host, int port) {
+	struct skynet_context * ctx = g->ctx;
+	int id = skynet_socket_listen(ctx, host, port, BACKLOG);
+	if (id < 0) {
+		skynet_error(ctx, "[clustergate] Listen %s:%d failed", host, port);
+		return "listen failed";
+	}
+	if (conn_new(g, id, CONN_LISTEN) == NULL) {
+		skynet_socket_close(ctx, id);
+		return "too many connections";
+	}
+	skynet_socket_start(ctx, id);
+	return NULL;
+}
+
+// the commands with a session (skynet.call) get a response, or an error with the message
+static void
+_ctrl(struct clustergate *g, uint32_t source, int session, const char * msg, int sz) {
+	char tmp[sz+1];
+	memcpy(tmp, msg, sz);
+	tmp[sz] = '\0';
+	char * args = tmp;
+	char * command = strsep(&args, " ");
+	if (strcmp(command, "node") == 0) {
+		char * name = strsep(&args, " ");
+		if (args) {
+			node_update(g, name, args);
+			return;
+		}
+	} else if (strcmp(command, "listen") == 0) {
+		char * host = strsep(&args, " ");
+		if (args) {
+			const char * err = start_listen(g, host, strtol(args, NULL, 10));
+			if (session != 0) {
+				if (err) {
+					skynet_send(g->ctx, 0, source, PTYPE_ERROR, session, (void *)err, strlen(err));
+				} else {
+					skynet_send(g->ctx, 0, source, PTYPE_RESPONSE, session, NULL, 0);
+				}
+			}
+			return;
+		}
+	}
+	skynet_error(g->ctx, "[clustergate] Invalid command : %s", msg);
+	if (session != 0) {
+		skynet_send(g->ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
+	}
+}
+
+static int
+_cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
+	struct clustergate *g = ud;
+	switch(type) {
+	case PTYPE_TEXT:
+		_ctrl(g, source, session, msg, (int)sz);
+		break;
+	case PTYPE_RESERVED_LUA:
+		forward_request(g, source, session, msg, (int)sz);
+		break;
+	case PTYPE_RESPONSE:
+	case PTYPE_ERROR:
+		dispatch_reply(g, type, session, msg, sz);
+		break;
+	case PTYPE_SOCKET:
+		dispatch_socket_message(g, msg, (int)(sz-sizeof(struct skynet_socket_message)));
+		break;
+	}
+	return 0;
+}
+
+struct clustergate *
+clustergate_create(void) {
+	struct clustergate * g = skynet_malloc(sizeof(*g));
+	memset(g, 0, sizeof(*g));
+	g->session = 1;
+	int i;
+	for (i=0;i<MAX_CONNECTION;i++) {
+		g->conn[i].id = -1;
+	}
+	return g;
+}
+
+void
+clustergate_release(struct clustergate *g) {
+	int i;
+	for (i=0;i<MAX_CONNECTION;i++) {
+		struct connection * c = &g->conn[i];
+		if (c->id >= 0) {
+			skynet_socket_close(g->ctx, c->id);
+			conn_clear(g, c);
+		}
+	}
+	for (i=0;i<g->nnode;i++) {
+		struct node * n = &g->node[i];
+		skynet_free(n->name);
+		skynet_free(n->host);
+		skynet_free(n->channel);
+	}
+	skynet_free(g->node);
+	reqmap_clear(&g->client);
+	reqmap_clear(&g->server);
+	messagepool_free(&g->mp);
+	hashid_clear(&g->hash);
+	skynet_free(g);
+}
+
+// parm : clusterd channels
+int
+clustergate_init(struct clustergate *g, struct skynet_context * ctx, const char * parm) {
+	if (parm == NULL)
+		return 1;
+	int sz = strlen(parm) + 1;
+	char clusterd[sz];
+	int channels = 1;
+	int n = sscanf(parm, "%s %d", clusterd, &channels);
+	if (n < 1) {
+		skynet_error(ctx, "[clustergate] Invalid parm %s", parm);
+		return 1;
+	}
+	g->clusterd = skynet_queryname(ctx, clusterd);
+	if (g->clusterd == 0) {
+		skynet_error(ctx, "[clustergate] Invalid clusterd %s", clusterd);
+		return 1;
+	}
+	g->ctx = ctx;
+	g->channels = channels > 0 ? channels : 1;
+	hashid_init(&g->hash, MAX_CONNECTION);
+	skynet_callback(ctx, g, _cb);
+	return 0;
+}
@@ -144,6 +144,25 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 		}
 		return;
 	}
+	// water high low [drop|close|pause] : the water marks of send buffer, inherited by the sockets accepted later
+	if (memcmp(command, "water", i) == 0) {
+		_parm(tmp, sz, i);
+		char * arg = tmp;
+		int high = strtol(strsep(&arg, " "), NULL, 10);
+		int low = arg ? strtol(strsep(&arg, " "), NULL, 10) : high / 2;
+		int policy = SKYNET_SOCKET_WATER_DROP;
+		if (arg) {
+			if (strcmp(arg, "close") == 0) {
+				policy = SKYNET_SOCKET_WATER_CLOSE;
+			} else if (strcmp(arg, "pause") == 0) {
+				policy = SKYNET_SOCKET_WATER_PAUSE;
+			}
+		}
+		if (g->listen_id >= 0) {
+			skynet_socket_setwater(ctx, g->listen_id, high, low, policy);
+		}
+		return;
+	}
 	if (memcmp(command, "close", i) == 0) {
 		if (g->listen_id >= 0) {
 			skynet_socket_close(ctx, g->listen_id);
@@ -194,11 +213,102 @@ _forward(struct gate *g, struct connection * c, int size) {
 	}
 }
 
+/*
+	Forward a packet which is contiguous in the socket buffer (data + offset).
+	If own is true, the buffer holds only this packet, and it is handed over instead of a new copy.
+	The receiver frees the message by skynet_free, so the packet must be moved to the head of the buffer.
+ */
+static void
+_forward_slice(struct gate *g, struct connection * c, char * data, int offset, int size, int own) {
+	struct skynet_context * ctx = g->ctx;
+	uint32_t source = 0;
+	uint32_t dest = g->broker;
+	if (dest == 0) {
+		source = c->client;
+		dest = c->agent;
+	}
+	if (dest) {
+		void * temp;
+		if (own) {
+			memmove(data, data + offset, size);
+			temp = data;
+		} else {
+			temp = skynet_malloc(size);
+			memcpy(temp, data + offset, size);
+		}
+		skynet_send(ctx, source, dest, g->client_tag | PTYPE_TAG_DONTCOPY, 0, temp, size);
+		return;
+	}
+	if (g->watchdog) {
+		char * tmp = skynet_malloc(size + 32);
+		int n = snprintf(tmp,32,"%d data ",c->id);
+		memcpy(tmp+n, data + offset, size);
+		skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT | PTYPE_TAG_DONTCOPY, 0, tmp, size + n);
+	}
+	if (own) {
+		skynet_free(data);
+	}
+}
+
+static inline int
+_packet_size(const uint8_t * plen, int header_size) {
+	// big-endian
+	if (header_size == 2) {
+		return plen[0] << 8 | plen[1];
+	} else {
+		return plen[0] << 24 | plen[1] << 16 | plen[2] << 8 | plen[3];
+	}
+}
+
+/*
+	The databuffer of connection is empty, so the packets in data needn't be copied into the message chain.
+	Complete packets are sliced from data, and the rest (a part of packet) is left in databuffer.
+ */
+static void
+_slice_message(struct gate *g, struct connection *c, int id, char * data, int sz) {
+	int header_size = g->header_size;
+	int offset = 0;
+	while (sz - offset >= header_size) {
+		int size = _packet_size((const uint8_t *)data + offset, header_size);
+		if (size >= 0x1000000) {
+			struct skynet_context * ctx = g->ctx;
+			skynet_free(data);
+			skynet_socket_close(ctx, id);
+			skynet_error(ctx, "Recv socket message > 16M");
+			return;
+		}
+		if (sz - offset - header_size < size) {
+			break;
+		}
+		offset += header_size;
+		if (size > 0) {
+			if (offset == header_size && offset + size == sz) {
+				// the most common case : exactly one packet in the socket buffer
+				_forward_slice(g, c, data, offset, size, 1);
+				return;
+			}
+			_forward_slice(g, c, data, offset, size, 0);
+			offset += size;
+		}
+	}
+	if (offset == sz) {
+		skynet_free(data);
+	} else {
+		databuffer_push(&c->buffer, &g->mp, data, sz);
+		c->buffer.offset = offset;
+		c->buffer.size -= offset;
+	}
+}
 
 /* յݣ@idΪ */
 static void
 dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
-	databuffer_push(&c->buffer,&g->mp, data, sz);//½յӵconnectionӦdatabuffer
+	if (c->buffer.size == 0 && c->buffer.header == 0) {
+		_slice_message(g, c, id, data, sz);
+		return;
+	} else {
+		databuffer_push(&c->buffer,&g->mp, data, sz);//½յӵconnectionӦdatabuffer
+	}
 	for (;;) {
 		int size = databuffer_readheader(&c->buffer, &g->mp, g->header_size);//ȡݰsize
 		if (size < 0) {//ʾݲȫ
@@ -277,7 +387,9 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		}
 		break;
 	case SKYNET_SOCKET_TYPE_WARNING:
-		skynet_error(ctx, "fd (%d) send buffer (%d)K", message->id, message->ud);
+		if (message->ud > 0) {
+			skynet_error(ctx, "fd (%d) send buffer (%d)K", message->id, message->ud);
+		}
 		break;
 	}
 }
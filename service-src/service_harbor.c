@@ -11,6 +11,11 @@
 
 	If the fd is disconnected, send message to slave in PTYPE_TEXT.  D id
 	If we don't known a globalname, send message to slave in PTYPE_TEXT. Q name
+
+	The small messages to a harbor are packed into a batch (harbor_batch bytes in config, default 64K, 0 disables it),
+	and the batch is sent by one socket send when it's full, or after harbor_delay (in 1/100 second, default 0).
+	Delay 0 means it's sent after the messages already in the message queue of harbor service are handled.
+	A batch is a sequence of packages, so the receiver doesn't know it.
  */
 
 #include <stdio.h>
@@ -22,10 +27,15 @@
 #include <unistd.h>
 
 #define HASH_SIZE 4096
-#define DEFAULT_QUEUE_SIZE 1024
+#define QUEUE_CHUNK_SIZE 256
+#define DEFAULT_BATCH_SIZE (64 * 1024)
+// the larger messages are sent without copying
+#define BATCH_MESSAGE_MAX 1024
 
 // 12 is sizeof(struct remote_message_header)
 #define HEADER_COOKIE_LENGTH 12
+// a package is 4 bytes length (big endian, includes the cookie), the cookie and the message
+#define HEADER_LENGTH (4 + HEADER_COOKIE_LENGTH)
 
 /*
 	message type (8bits) is in destination high 8bits
@@ -43,11 +53,17 @@ struct harbor_msg {
 	size_t size;
 };
 
-struct harbor_msg_queue {
-	int size;
+// The queue is a list of chunks, it never moves the messages when it grows.
+struct harbor_msg_chunk {
+	struct harbor_msg_chunk * next;
 	int head;
 	int tail;
-	struct harbor_msg * data;
+	struct harbor_msg msg[QUEUE_CHUNK_SIZE];
+};
+
+struct harbor_msg_queue {
+	struct harbor_msg_chunk * head;
+	struct harbor_msg_chunk * tail;
 };
 
 struct keyvalue {
@@ -74,8 +90,11 @@ struct slave {
 	int status;
 	int length;
 	int read;
-	uint8_t size[4];
+	uint8_t header[HEADER_LENGTH];
+	struct remote_message_header cookie;
 	char * recv_buffer;
+	uint8_t * batch;
+	int batch_sz;
 };
 
 struct harbor {
@@ -83,6 +102,9 @@ struct harbor {
 	int id;
 	uint32_t slave;
 	struct hashmap * map;
+	int batch_size;	// 0 : don't batch
+	int batch_delay;
+	bool flush;	// the flush of batches is scheduled
 	struct slave s[REMOTE_MAX];
 };
 
@@ -90,23 +112,20 @@ struct harbor {
 
 static void
 push_queue_msg(struct harbor_msg_queue * queue, struct harbor_msg * m) {
-	// If there is only 1 free slot which is reserved to distinguish full/empty
-	// of circular buffer, expand it.
-	if (((queue->tail + 1) % queue->size) == queue->head) {
-		struct harbor_msg * new_buffer = skynet_malloc(queue->size * 2 * sizeof(struct harbor_msg));
-		int i;
-		for (i=0;i<queue->size-1;i++) {
-			new_buffer[i] = queue->data[(i+queue->head) % queue->size];
+	struct harbor_msg_chunk * c = queue->tail;
+	if (c == NULL || c->tail == QUEUE_CHUNK_SIZE) {
+		c = skynet_malloc(sizeof(*c));
+		c->next = NULL;
+		c->head = 0;
+		c->tail = 0;
+		if (queue->tail) {
+			queue->tail->next = c;
+		} else {
+			queue->head = c;
 		}
-		skynet_free(queue->data);
-		queue->data = new_buffer;
-		queue->head = 0;
-		queue->tail = queue->size - 1;
-		queue->size *= 2;
+		queue->tail = c;
 	}
-	struct harbor_msg * slot = &queue->data[queue->tail];
-	*slot = *m;
-	queue->tail = (queue->tail + 1) % queue->size;
+	c->msg[c->tail++] = *m;
 }
 
 static void
@@ -118,23 +137,49 @@ push_queue(struct harbor_msg_queue * queue, void * buffer, size_t sz, struct rem
 	push_queue_msg(queue, &m);
 }
 
-static struct harbor_msg *
-pop_queue(struct harbor_msg_queue * queue) {
-	if (queue->head == queue->tail) {
-		return NULL;
+// copy the message out, because the chunk may be freed
+static bool
+pop_queue(struct harbor_msg_queue * queue, struct harbor_msg * m) {
+	for (;;) {
+		struct harbor_msg_chunk * c = queue->head;
+		if (c == NULL) {
+			return false;
+		}
+		if (c->head < c->tail) {
+			*m = c->msg[c->head++];
+			return true;
+		}
+		if (c->next == NULL) {
+			if (c->tail == QUEUE_CHUNK_SIZE) {
+				skynet_free(c);
+				queue->head = queue->tail = NULL;
+			}
+			return false;
+		}
+		queue->head = c->next;
+		skynet_free(c);
 	}
-	struct harbor_msg * slot = &queue->data[queue->head];
-	queue->head = (queue->head + 1) % queue->size;
-	return slot;
+}
+
+// move all the messages of src to the end of queue, only the chunk list is linked.
+static void
+concat_queue(struct harbor_msg_queue * queue, struct harbor_msg_queue * src) {
+	if (src->head == NULL)
+		return;
+	if (queue->tail) {
+		queue->tail->next = src->head;
+	} else {
+		queue->head = src->head;
+	}
+	queue->tail = src->tail;
+	src->head = src->tail = NULL;
 }
 
 static struct harbor_msg_queue *
 new_queue() {
 	struct harbor_msg_queue * queue = skynet_malloc(sizeof(*queue));
-	queue->size = DEFAULT_QUEUE_SIZE;
-	queue->head = 0;
-	queue->tail = 0;
-	queue->data = skynet_malloc(DEFAULT_QUEUE_SIZE * sizeof(struct harbor_msg));
+	queue->head = NULL;
+	queue->tail = NULL;
 
 	return queue;
 }
@@ -143,11 +188,11 @@ static void
 release_queue(struct harbor_msg_queue *queue) {
 	if (queue == NULL)
 		return;
-	struct harbor_msg * m;
-	while ((m=pop_queue(queue)) != NULL) {
-		skynet_free(m->buffer);
+	struct harbor_msg m;
+	while (pop_queue(queue, &m)) {
+		skynet_free(m.buffer);
 	}
-	skynet_free(queue->data);
+	skynet_free(queue->head);
 	skynet_free(queue);
 }
 
@@ -238,6 +283,9 @@ close_harbor(struct harbor *h, int id) {
 		release_queue(s->queue);
 		s->queue = NULL;
 	}
+	skynet_free(s->batch);
+	s->batch = NULL;
+	s->batch_sz = 0;
 }
 
 static void
@@ -287,58 +335,114 @@ header_to_message(const struct remote_message_header * header, uint8_t * message
 }
 
 static inline uint32_t
-from_bigendian(uint32_t n) {
-	union {
-		uint32_t big;
-		uint8_t bytes[4];
-	} u;
-	u.big = n;
-	return u.bytes[0] << 24 | u.bytes[1] << 16 | u.bytes[2] << 8 | u.bytes[3];
+from_bigendian(const uint8_t *buffer) {
+	return (uint32_t)buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
 }
 
 static inline void
-message_to_header(const uint32_t *message, struct remote_message_header *header) {
-	header->source = from_bigendian(message[0]);
-	header->destination = from_bigendian(message[1]);
-	header->session = from_bigendian(message[2]);
+message_to_header(const uint8_t *message, struct remote_message_header *header) {
+	header->source = from_bigendian(message);
+	header->destination = from_bigendian(message+4);
+	header->session = from_bigendian(message+8);
 }
 
 // socket package
 
 static void
-forward_local_messsage(struct harbor *h, void *msg, int sz) {
-	const char * cookie = msg;
-	cookie += sz - HEADER_COOKIE_LENGTH;
-	struct remote_message_header header;
-	message_to_header((const uint32_t *)cookie, &header);
-
-	uint32_t destination = header.destination;
+forward_local_messsage(struct harbor *h, void *msg, int sz, const struct remote_message_header * header) {
+	uint32_t destination = header->destination;
 	int type = destination >> HANDLE_REMOTE_SHIFT;
 	destination = (destination & HANDLE_MASK) | ((uint32_t)h->id << HANDLE_REMOTE_SHIFT);
 
-	if (skynet_send(h->ctx, header.source, destination, type | PTYPE_TAG_DONTCOPY , (int)header.session, (void *)msg, sz-HEADER_COOKIE_LENGTH) < 0) {
+	if (skynet_send(h->ctx, header->source, destination, type | PTYPE_TAG_DONTCOPY , (int)header->session, msg, sz) < 0) {
 		if (type != PTYPE_ERROR) {
 			// don't need report error when type is error
-			skynet_send(h->ctx, destination, header.source , PTYPE_ERROR, (int)header.session, NULL, 0);
+			skynet_send(h->ctx, destination, header->source , PTYPE_ERROR, (int)header->session, NULL, 0);
 		}
-		skynet_error(h->ctx, "Unknown destination :%x from :%x type(%d)", destination, header.source, type);
+		skynet_error(h->ctx, "Unknown destination :%x from :%x type(%d)", destination, header->source, type);
 	}
 }
 
 static void
-send_remote(struct skynet_context * ctx, int fd, const char * buffer, size_t sz, struct remote_message_header * cookie) {
+flush_batch(struct harbor *h, struct slave *s) {
+	if (s->batch_sz == 0)
+		return;
+	// the socket frees the batch, the next one is allocated when a message is batched (see send_remote).
+	// ignore send error, because if the connection is broken, the mainloop will recv a message.
+	skynet_socket_send(h->ctx, s->fd, s->batch, s->batch_sz);
+	s->batch = NULL;
+	s->batch_sz = 0;
+}
+
+static void
+flush_all(struct harbor *h) {
+	int i;
+	h->flush = false;
+	for (i=1;i<REMOTE_MAX;i++) {
+		struct slave *s = &h->s[i];
+		if (s->batch_sz > 0 && s->fd != 0) {
+			flush_batch(h, s);
+		}
+	}
+}
+
+static void
+schedule_flush(struct harbor *h) {
+	if (h->flush)
+		return;
+	h->flush = true;
+	char ti[16];
+	sprintf(ti, "%d", h->batch_delay);
+	// see mainloop
+	skynet_command(h->ctx, "TIMEOUT", ti);
+}
+
+// The buffer is sent after the length and cookie without copying (the socket frees it), or copied into the batch if it's small.
+static void
+send_remote(struct harbor *h, struct slave *s, void * buffer, size_t sz, struct remote_message_header * cookie) {
 	size_t sz_header = sz+sizeof(*cookie);
-	if (sz_header > UINT32_MAX) {
-		skynet_error(ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
+	// the first byte of length must be 0, see push_socket_data
+	if (sz_header > 0xffffff) {
+		skynet_error(h->ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
+		skynet_free(buffer);
 		return;
 	}
-	uint8_t * sendbuf = skynet_malloc(sz_header+4);
-	to_bigendian(sendbuf, (uint32_t)sz_header);
-	memcpy(sendbuf+4, buffer, sz);
-	header_to_message(cookie, sendbuf+4+sz);
+	if (sz <= BATCH_MESSAGE_MAX && HEADER_LENGTH + sz <= h->batch_size) {
+		if (s->batch_sz + HEADER_LENGTH + sz > h->batch_size) {
+			flush_batch(h, s);
+		}
+		if (s->batch == NULL) {
+			s->batch = skynet_malloc(h->batch_size);
+		}
+		uint8_t * ptr = s->batch + s->batch_sz;
+		to_bigendian(ptr, (uint32_t)sz_header);
+		header_to_message(cookie, ptr+4);
+		memcpy(ptr+HEADER_LENGTH, buffer, sz);
+		s->batch_sz += HEADER_LENGTH + sz;
+		skynet_free(buffer);
+		schedule_flush(h);
+		return;
+	}
+	// keep the order of messages
+	flush_batch(h, s);
 
-	// ignore send error, because if the connection is broken, the mainloop will recv a message.
-	skynet_socket_send(ctx, fd, sendbuf, sz_header+4);
+	uint8_t head[HEADER_LENGTH];
+	to_bigendian(head, (uint32_t)sz_header);
+	header_to_message(cookie, head+4);
+
+	skynet_socket_send_head(h->ctx, s->fd, head, HEADER_LENGTH, buffer, (int)sz);
+}
+
+// the messages queued by name don't know the handle before
+static void
+queue_set_handle(struct harbor_msg_queue * queue, uint32_t handle) {
+	struct harbor_msg_chunk * c;
+	for (c = queue->head; c; c = c->next) {
+		int i;
+		for (i=c->head;i<c->tail;i++) {
+			c->msg[i].header.destination |= (handle & HANDLE_MASK);
+		}
+	}
 }
 
 static void
@@ -349,6 +453,7 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 	struct skynet_context * context = h->ctx;
 	struct slave *s = &h->s[harbor_id];
 	int fd = s->fd;
+	queue_set_handle(queue, handle);
 	if (fd == 0) {
 		if (s->status == STATUS_DOWN) {
 			char tmp [GLOBALNAME_LENGTH+1];
@@ -360,17 +465,15 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 				s->queue = node->queue;
 				node->queue = NULL;
 			} else {
-				struct harbor_msg * m;
-				while ((m = pop_queue(queue))!=NULL) {
-					push_queue_msg(s->queue, m);
-				}
+				concat_queue(s->queue, queue);
 			}
 			if (harbor_id == (h->slave >> HANDLE_REMOTE_SHIFT)) {
 				// the harbor_id is local
-				struct harbor_msg * m;
-				while ((m = pop_queue(s->queue)) != NULL) {
-					int type = m->header.destination >> HANDLE_REMOTE_SHIFT;
-					skynet_send(context, m->header.source, handle , type | PTYPE_TAG_DONTCOPY, m->header.session, m->buffer, m->size);
+				struct harbor_msg m;
+				while (pop_queue(s->queue, &m)) {
+					int type = m.header.destination >> HANDLE_REMOTE_SHIFT;
+					uint32_t destination = (m.header.destination & HANDLE_MASK) | ((uint32_t)harbor_id << HANDLE_REMOTE_SHIFT);
+					skynet_send(context, m.header.source, destination , type | PTYPE_TAG_DONTCOPY, m.header.session, m.buffer, m.size);
 				}
 				release_queue(s->queue);
 				s->queue = NULL;
@@ -378,11 +481,9 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 		}
 		return;
 	}
-	struct harbor_msg * m;
-	while ((m = pop_queue(queue)) != NULL) {
-		m->header.destination |= (handle & HANDLE_MASK);
-		send_remote(context, fd, m->buffer, m->size, &m->header);
-		skynet_free(m->buffer);
+	struct harbor_msg m;
+	while (pop_queue(queue, &m)) {
+		send_remote(h, s, m.buffer, m.size, &m.header);
 	}
 }
 
@@ -396,10 +497,9 @@ dispatch_queue(struct harbor *h, int id) {
 	if (queue == NULL)
 		return;
 
-	struct harbor_msg * m;
-	while ((m = pop_queue(queue)) != NULL) {
-		send_remote(h->ctx, fd, m->buffer, m->size, &m->header);
-		skynet_free(m->buffer);
+	struct harbor_msg m;
+	while (pop_queue(queue, &m)) {
+		send_remote(h, s, m.buffer, m.size, &m.header);
 	}
 	release_queue(queue);
 	s->queue = NULL;
@@ -449,24 +549,37 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 			// go though
 		}
 		case STATUS_HEADER: {
-			// big endian 4 bytes length, the first one must be 0.
-			int need = 4 - s->read;
+			// big endian 4 bytes length (the first one must be 0), and the cookie.
+			int need = HEADER_LENGTH - s->read;
 			if (size < need) {
-				memcpy(s->size + s->read, buffer, size);
+				memcpy(s->header + s->read, buffer, size);
 				s->read += size;
 				return;
 			} else {
-				memcpy(s->size + s->read, buffer, need);
+				memcpy(s->header + s->read, buffer, need);
 				buffer += need;
 				size -= need;
+				s->read = 0;
 
-				if (s->size[0] != 0) {
+				if (s->header[0] != 0) {
 					skynet_error(h->ctx, "Message is too long from harbor %d", id);
 					close_harbor(h,id);
 					return;
 				}
-				s->length = s->size[1] << 16 | s->size[2] << 8 | s->size[3];
-				s->read = 0;
+				int length = s->header[1] << 16 | s->header[2] << 8 | s->header[3];
+				if (length < HEADER_COOKIE_LENGTH) {
+					skynet_error(h->ctx, "Invalid message length (%d) from harbor %d", length, id);
+					close_harbor(h,id);
+					return;
+				}
+				message_to_header(s->header + 4, &s->cookie);
+				s->length = length - HEADER_COOKIE_LENGTH;
+				if (s->length == 0) {
+					forward_local_messsage(h, NULL, 0, &s->cookie);
+					if (size == 0)
+						return;
+					break;
+				}
 				s->recv_buffer = skynet_malloc(s->length);
 				s->status = STATUS_CONTENT;
 				if (size == 0) {
@@ -483,7 +596,7 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 				return;
 			}
 			memcpy(s->recv_buffer + s->read, buffer, need);
-			forward_local_messsage(h, s->recv_buffer, s->length);
+			forward_local_messsage(h, s->recv_buffer, s->length, &s->cookie);
 			s->length = 0;
 			s->read = 0;
 			s->recv_buffer = NULL;
@@ -547,7 +660,8 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 		cookie.source = source;
 		cookie.destination = (destination & HANDLE_MASK) | ((uint32_t)type << HANDLE_REMOTE_SHIFT);
 		cookie.session = (uint32_t)session;
-		send_remote(context, s->fd, msg,sz,&cookie);
+		send_remote(h, s, (void *)msg,sz,&cookie);
+		return 1;
 	}
 
 	return 0;
@@ -692,6 +806,11 @@ mainloop(struct skynet_context * context, void * ud, int type, int session, uint
 		return 0;
 	}
 	default: {
+		if (msg == NULL) {
+			// the timeout (PTYPE_RESPONSE) scheduled to flush the batches
+			flush_all(h);
+			return 0;
+		}
 		// remote message out
 		const struct remote_message *rmsg = msg;
 		if (rmsg->destination.handle == 0) {
@@ -722,6 +841,10 @@ harbor_init(struct harbor *h, struct skynet_context *ctx, const char * args) {
 	}
 	h->id = harbor_id;
 	h->slave = slave;
+	const char * batch = skynet_command(ctx, "GETENV", "harbor_batch");
+	h->batch_size = batch ? strtol(batch, NULL, 10) : DEFAULT_BATCH_SIZE;
+	const char * delay = skynet_command(ctx, "GETENV", "harbor_delay");
+	h->batch_delay = delay ? strtol(delay, NULL, 10) : 0;
 	skynet_callback(ctx, h, mainloop);
 	skynet_harbor_start(ctx);
 
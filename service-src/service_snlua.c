@@ -1,4 +1,5 @@
 #include "skynet.h"
+#include "smallpool.h"
 
 #include <lua.h>
 #include <lualib.h>
@@ -8,6 +9,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+
+#if defined(__APPLE__)
+#include <sys/time.h>
+#endif
 
 #define MEMORY_WARNING_REPORT (1024 * 1024 * 32)
 
@@ -18,6 +24,13 @@ struct snlua {
 	size_t mem;
 	size_t mem_report;
 	size_t mem_limit;
+	struct smallpool * pool;	// lualloc = "pool" in config
+	int gc_depth;	// > 0 during gc step
+	uint64_t gc_start;
+	uint64_t gc_time;	// microseconds
+	uint64_t gc_maxpause;
+	size_t gc_step;
+	size_t gc_freed;
 };
 
 // LUA_CACHELIB may defined in patched lua for shared proto
@@ -47,6 +60,47 @@ codecache(lua_State *L) {
 
 #endif
 
+// gc statistics collected by gchook and lalloc
+static int
+lgcstat(lua_State *L) {
+	void * ud = NULL;
+	lua_getallocf(L, &ud);
+	struct snlua *l = ud;
+	lua_createtable(L, 0, 4);
+	lua_pushnumber(L, (double)l->gc_time / 1000000);
+	lua_setfield(L, -2, "time");
+	lua_pushnumber(L, (double)l->gc_maxpause / 1000000);
+	lua_setfield(L, -2, "maxpause");
+	lua_pushinteger(L, l->gc_step);
+	lua_setfield(L, -2, "step");
+	lua_pushinteger(L, l->gc_freed);
+	lua_setfield(L, -2, "freed");
+	return 1;
+}
+
+static int
+lgcreset(lua_State *L) {
+	void * ud = NULL;
+	lua_getallocf(L, &ud);
+	struct snlua *l = ud;
+	l->gc_time = 0;
+	l->gc_maxpause = 0;
+	l->gc_step = 0;
+	l->gc_freed = 0;
+	return 0;
+}
+
+static int
+gcstat(lua_State *L) {
+	luaL_Reg l[] = {
+		{ "stat", lgcstat },
+		{ "reset", lgcreset },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+	return 1;
+}
+
 static int 
 traceback (lua_State *L) {
 	const char *msg = lua_tostring(L, 1);
@@ -88,6 +142,8 @@ init_cb(struct snlua *l, struct skynet_context *ctx, const char * args, size_t s
 	lua_pushlightuserdata(L, ctx);//ѷΪһûԶݱ浽ע
 	lua_setfield(L, LUA_REGISTRYINDEX, "skynet_context");/* registry["skynet_context"]=ctx  */
 	luaL_requiref(L, "skynet.codecache", codecache , 0);/* skynet.codecache */
+	lua_pop(L,1);
+	luaL_requiref(L, "skynet.gcstat", gcstat , 0);
 	lua_pop(L,1);//
 
 	/* snlua->Lȫֱֵ */
@@ -193,9 +249,58 @@ lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 		l->mem_report *= 2;
 		skynet_error(l->ctx, "Memory warning %.2f M", (float)l->mem / (1024 * 1024));
 	}
+	if (l->gc_depth && nsize == 0 && ptr) {
+		l->gc_freed += osize;
+	}
+	if (l->pool) {
+		return smallpool_lalloc(l->pool, ptr, osize, nsize);
+	}
 	return skynet_lalloc(ptr, osize, nsize);
 }
 
+static uint64_t
+gettime() {
+	uint64_t t;
+#if !defined(__APPLE__)
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	t = (uint64_t)ti.tv_sec * 1000000;
+	t += ti.tv_nsec / 1000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	t = (uint64_t)tv.tv_sec * 1000000;
+	t += tv.tv_usec;
+#endif
+	return t;
+}
+
+#ifdef lua_checksig
+
+// skynet_gchook is in patched lua (see 3rd/lua/lgc.c), it's shared by all the lua_State
+static void
+gchook(lua_State *L, int stop) {
+	void * ud = NULL;
+	if (lua_getallocf(L, &ud) != lalloc) {
+		return;
+	}
+	struct snlua *l = ud;
+	if (!stop) {
+		if (l->gc_depth++ == 0) {
+			l->gc_start = gettime();
+		}
+	} else if (--l->gc_depth == 0) {
+		uint64_t t = gettime() - l->gc_start;
+		l->gc_time += t;
+		if (t > l->gc_maxpause) {
+			l->gc_maxpause = t;
+		}
+		++l->gc_step;
+	}
+}
+
+#endif
+
 /* snluacreateԴʹõ */
 struct snlua *
 snlua_create(void) {
@@ -203,6 +308,14 @@ snlua_create(void) {
 	memset(l,0,sizeof(*l));
 	l->mem_report = MEMORY_WARNING_REPORT;//ڴ澯ֵ32Mb
 	l->mem_limit = 0;
+	const char * alloc = skynet_command(NULL, "GETENV", "lualloc");
+	if (alloc && strcmp(alloc, "pool") == 0) {
+		l->pool = skynet_malloc(sizeof(struct smallpool));
+		smallpool_init(l->pool);
+	}
+#ifdef lua_checksig
+	skynet_gchook = gchook;
+#endif
 	l->L = lua_newstate(lalloc, l);/* ʹһʹõڴ亯Ϊlalloc */
 	return l;
 }
@@ -210,6 +323,10 @@ snlua_create(void) {
 void
 snlua_release(struct snlua *l) {
 	lua_close(l->L);
+	if (l->pool) {
+		smallpool_release(l->pool);
+		skynet_free(l->pool);
+	}
 	skynet_free(l);
 }
 
@@ -223,5 +340,8 @@ snlua_signal(struct snlua *l, int signal) {
 #endif
 	} else if (signal == 1) {
 		skynet_error(l->ctx, "Current Memory %.3fK", (float)l->mem / 1024);
+		if (l->pool) {
+			skynet_error(l->ctx, "Small object pool %.3fK", (float)l->pool->bytes / 1024);
+		}
 	}
 }
@@ -0,0 +1,157 @@
+#ifndef skynet_smallpool_h
+#define skynet_smallpool_h
+
+#include "skynet_malloc.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// Size class free lists for small lua objects (<= SMALLPOOL_MAX).
+// It's not thread safe, use one pool per lua_State.
+
+#define SMALLPOOL_ALIGN 8
+#define SMALLPOOL_MAX 256
+#define SMALLPOOL_CLASS (SMALLPOOL_MAX / SMALLPOOL_ALIGN)
+#define SMALLPOOL_PAGE_MIN 1024
+#define SMALLPOOL_PAGE_MAX 16384
+
+#define SMALLPOOL_INDEX(sz) (((sz) - 1) / SMALLPOOL_ALIGN)
+
+struct smallpool_node {
+	struct smallpool_node * next;
+};
+
+struct smallpool_page {
+	struct smallpool_page * next;
+	size_t sz;
+};
+
+struct smallpool {
+	struct smallpool_node * freelist[SMALLPOOL_CLASS];
+	char * ptr;	// unused space of the last page, shared by all the classes
+	char * end;
+	struct smallpool_page * page;
+	int npage;
+	size_t bytes;	// total size of pages
+};
+
+static void
+smallpool_init(struct smallpool *p) {
+	memset(p, 0, sizeof(*p));
+}
+
+// free all the pages, objects in the pool are all released.
+static void
+smallpool_release(struct smallpool *p) {
+	struct smallpool_page * page = p->page;
+	while (page) {
+		struct smallpool_page * next = page->next;
+		skynet_lalloc(page, page->sz, 0);
+		page = next;
+	}
+	smallpool_init(p);
+}
+
+// page size grows with the number of pages, so an idle service keeps small
+static int
+smallpool_newpage(struct smallpool *p) {
+	int shift = p->npage < 4 ? p->npage : 4;
+	size_t sz = SMALLPOOL_PAGE_MIN << shift;
+	struct smallpool_page * page = skynet_lalloc(NULL, 0, sz);
+	if (page == NULL) {
+		return 1;
+	}
+	page->next = p->page;
+	page->sz = sz;
+	p->page = page;
+	p->bytes += sz;
+	++p->npage;
+	p->ptr = (char *)(page + 1);
+	p->end = (char *)page + sz;
+	return 0;
+}
+
+static inline void
+smallpool_free(struct smallpool *p, void *ptr, size_t sz) {
+	int c = SMALLPOOL_INDEX(sz);
+	struct smallpool_node * n = ptr;
+	n->next = p->freelist[c];
+	p->freelist[c] = n;
+}
+
+static inline void *
+smallpool_alloc(struct smallpool *p, size_t sz) {
+	int c = SMALLPOOL_INDEX(sz);
+	struct smallpool_node * n = p->freelist[c];
+	if (n) {
+		p->freelist[c] = n->next;
+		return n;
+	}
+	size_t size = (c + 1) * SMALLPOOL_ALIGN;
+	if (p->ptr + size > p->end) {
+		// cut the rest of the page into free objects, the biggest class first
+		while (p->ptr + SMALLPOOL_ALIGN <= p->end) {
+			size_t left = p->end - p->ptr;
+			if (left > SMALLPOOL_MAX) {
+				left = SMALLPOOL_MAX;
+			}
+			smallpool_free(p, p->ptr, left - left % SMALLPOOL_ALIGN);
+			p->ptr += left - left % SMALLPOOL_ALIGN;
+		}
+		if (smallpool_newpage(p)) {
+			return NULL;
+		}
+	}
+	void * ret = p->ptr;
+	p->ptr += size;
+	return ret;
+}
+
+// the same semantic as lua_Alloc, bigger objects go to skynet_lalloc
+static void *
+smallpool_lalloc(struct smallpool *p, void *ptr, size_t osize, size_t nsize) {
+	if (ptr == NULL) {
+		osize = 0;	// osize is the type of object when ptr is NULL
+	}
+	if (osize > SMALLPOOL_MAX) {
+		if (nsize > SMALLPOOL_MAX || nsize == 0) {
+			return skynet_lalloc(ptr, osize, nsize);
+		}
+		void * n = smallpool_alloc(p, nsize);
+		if (n == NULL) {
+			// lua assumes shrinking never fails, the big block can be used as a small one.
+			return ptr;
+		}
+		memcpy(n, ptr, nsize);
+		skynet_lalloc(ptr, osize, 0);
+		return n;
+	}
+	if (nsize == 0) {
+		if (ptr) {
+			smallpool_free(p, ptr, osize);
+		}
+		return NULL;
+	}
+	if (nsize <= SMALLPOOL_MAX) {
+		if (ptr && SMALLPOOL_INDEX(osize) == SMALLPOOL_INDEX(nsize)) {
+			return ptr;
+		}
+		void * n = smallpool_alloc(p, nsize);
+		if (n == NULL) {
+			return nsize < osize ? ptr : NULL;
+		}
+		if (ptr) {
+			memcpy(n, ptr, osize < nsize ? osize : nsize);
+			smallpool_free(p, ptr, osize);
+		}
+		return n;
+	}
+	void * n = skynet_lalloc(NULL, 0, nsize);
+	if (n && ptr) {
+		memcpy(n, ptr, osize);
+		smallpool_free(p, ptr, osize);
+	}
+	return n;
+}
+
+#endif
@@ -1,5 +1,5 @@
 local skynet = require "skynet"
-local cluster = require "cluster"
+local core = require "cluster.core"
 require "skynet.manager"	-- inject skynet.forward_type
 
 local node, address = ...
@@ -18,11 +18,13 @@ local forward_map = {
 
 skynet.forward_type( forward_map ,function()
 	local clusterd = skynet.uniqueservice("clusterd")
+	local gate = skynet.call(clusterd, "lua", "gateway")
 	local n = tonumber(address)
 	if n then
 		address = n
 	end
 	skynet.dispatch("system", function (session, source, msg, sz)
-		skynet.ret(skynet.rawcall(clusterd, "lua", skynet.pack("req", node, address, msg, sz)))
+		-- msg is freed by cluster.core.packcall
+		skynet.ret(skynet.rawcall(gate, "lua", core.packcall(node, address, msg, sz)))
 	end)
 end)
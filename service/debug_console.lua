@@ -141,6 +141,8 @@ function COMMAND.help()
 		kill = "kill address : kill service",
 		mem = "mem : show memory status",
 		gc = "gc : force every lua service do garbage collect",
+		gcstat = "gcstat [address] [reset] : show gc statistics",
+		gcset = "gcset address mode/pause/stepmul value [idlestep] : tune gc of a lua service",
 		start = "lanuch a new lua service",
 		snax = "lanuch a new snax service",
 		clearcache = "clear lua code cache",
@@ -230,6 +232,19 @@ function COMMAND.gc()
 	return skynet.call(".launcher", "lua", "GC")
 end
 
+function COMMAND.gcstat(address, reset)
+	if address == nil then
+		return skynet.call(".launcher", "lua", "GCSTAT")
+	end
+	address = adjust_address(address)
+	return skynet.call(address, "debug", "GCSTAT", reset == "reset")
+end
+
+function COMMAND.gcset(address, key, value, step)
+	address = adjust_address(address)
+	return skynet.call(address, "debug", "GCSET", key, value, step)
+end
+
 function COMMAND.exit(address)
 	skynet.send(adjust_address(address), "debug", "EXIT")
 end
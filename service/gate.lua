@@ -41,6 +41,7 @@ end
 
 local function unforward(c)
 	if c.agent then
+		gateserver.route(c.fd)
 		forwarding[c.agent] = nil
 		c.agent = nil
 		c.client = nil
@@ -77,6 +78,7 @@ function CMD.forward(source, fd, client, address)
 	c.client = client or 0
 	c.agent = address or source
 	forwarding[c.agent] = c
+	gateserver.route(fd, c.agent, c.client)
 	gateserver.openclient(fd)
 end
 
@@ -91,6 +93,9 @@ function CMD.kick(source, fd)
 	gateserver.closeclient(fd)
 end
 
+-- the commands of a client fd, they go to the shard of fd (see gateserver CMD.open)
+handler.fdcommand = { forward = true, accept = true, kick = true }
+
 function handler.command(cmd, source, ...)
 	local f = assert(CMD[cmd])
 	return f(source, ...)
@@ -6,6 +6,8 @@ local string = string
 local services = {}
 local command = {}
 local instance = {} -- for confirm (function command.LAUNCH / command.ERROR / command.LAUNCHOK)
+local pool = {}	-- service name -> { low = , high = , warming = , [1..n] = warm instance }
+local warming = {}	-- warm instance (not ready yet) -> service name
 
 local function handle_to_address(handle)
 	return tonumber("0x" .. string.sub(handle , 2))
@@ -54,6 +56,20 @@ function command.MEM()
 	return list
 end
 
+function command.GCSTAT()
+	local list = {}
+	for k,v in pairs(services) do
+		local ok, stat = pcall(skynet.call,k,"debug","GCSTAT")
+		if not ok then
+			list[skynet.address(k)] = string.format("ERROR (%s)",v)
+		else
+			list[skynet.address(k)] = string.format("%s gc %.3fs max %.3fms step %d freed %.2fKb (%s)",
+				stat.mode, stat.time, stat.maxpause * 1000, stat.step, stat.freed / 1024, v)
+		end
+	end
+	return list
+end
+
 function command.GC()
 	for k,v in pairs(services) do
 		skynet.send(k,"debug","GC")
@@ -61,8 +77,36 @@ function command.GC()
 	return command.MEM()
 end
 
+-- remove a dead instance (warm or warming) from pool, returns the service name
+local function pool_remove(handle)
+	local name = warming[handle]
+	if name then
+		-- it exits before WARMOK or ERROR, ie. killed in init
+		warming[handle] = nil
+		local p = pool[name]
+		if p then
+			p.warming = p.warming - 1
+		end
+		return name
+	end
+	for name, p in pairs(pool) do
+		for i = 1, #p do
+			if p[i] == handle then
+				table.remove(p, i)
+				return name
+			end
+		end
+	end
+end
+
+local refill
+
 function command.REMOVE(_, handle, kill)
 	services[handle] = nil
+	local name = pool_remove(handle)
+	if name then
+		refill(name)
+	end
 	local response = instance[handle]
 	if response then
 		-- instance is dead
@@ -74,10 +118,88 @@ function command.REMOVE(_, handle, kill)
 	return NORET
 end
 
+-- keep (#p + p.warming) between low and high, warm instances init in their own threads
+function refill(name)
+	local p = pool[name]
+	if p == nil or #p + p.warming >= p.low then
+		return
+	end
+	for i = #p + p.warming + 1, p.high do
+		-- see lualib/loader.lua, "@warm" loads the service but doesn't run it
+		local inst = skynet.launch("snlua", "@warm", name)
+		if inst then
+			warming[inst] = name
+			p.warming = p.warming + 1
+		end
+	end
+end
+
+-- bind a warm instance of snlua service name, it runs main with param
+local function bind_warm(name, param)
+	local p = pool[name]
+	local inst = p and table.remove(p)
+	if inst then
+		skynet.send(inst, "lua", param)
+		refill(name)
+		return inst
+	end
+end
+
+function command.POOL(_, name, low, high)
+	if name == nil then
+		local list = {}
+		for k,p in pairs(pool) do
+			list[k] = string.format("ready %d warming %d (low %d high %d)", #p, p.warming, p.low, p.high)
+		end
+		return list
+	end
+	low = tonumber(low) or 0
+	high = math.max(tonumber(high) or low, low)
+	local p = pool[name]
+	if high == 0 then
+		if p then
+			pool[name] = nil
+			for _, inst in ipairs(p) do
+				skynet.kill(inst)
+			end
+		end
+		return
+	end
+	if p == nil then
+		p = { warming = 0 }
+		pool[name] = p
+	end
+	p.low = low
+	p.high = high
+	while #p > high do
+		skynet.kill(table.remove(p))
+	end
+	refill(name)
+end
+
+-- warm instance is ready, see lualib/loader.lua
+function command.WARMOK(address)
+	local name = warming[address]
+	if name == nil then
+		return NORET
+	end
+	warming[address] = nil
+	local p = pool[name]
+	if p then
+		p.warming = p.warming - 1
+		if #p < p.high then
+			table.insert(p, address)
+			return NORET
+		end
+	end
+	skynet.kill(address)
+	return NORET
+end
+
 --lua
 local function launch_service(service, ...)
 	local param = table.concat({...}, " ") 
-	local inst = skynet.launch(service, param) --serviceΪͨΪsnluacmaster paramΪ
+	local inst = service == "snlua" and bind_warm(..., param) or skynet.launch(service, param) --serviceΪͨΪsnluacmaster paramΪ
 	local response = skynet.response()         --ٴεcoroutine_resumeĲΪֵ  
 	                                           --жЭ̣coroutine_resumetrue"RESPONSE"skynet.pack	                                    
 	if inst then
@@ -107,6 +229,17 @@ end
 function command.ERROR(address)
 	-- see serivce-src/service_lua.c
 	-- init failed
+	local name = warming[address]
+	if name then
+		-- don't refill here, or a broken service would be launched again and again
+		warming[address] = nil
+		local p = pool[name]
+		if p then
+			p.warming = p.warming - 1
+		end
+		skynet.error(string.format("Warm instance of %s init failed", name))
+		return NORET
+	end
 	local response = instance[address]
 	if response then
 		response(false)
@@ -160,4 +293,12 @@ skynet.dispatch("lua", function(session, address, cmd , ...)
 	end
 end)
 
-skynet.start(function() end)
+skynet.start(function()
+	-- servicepool = "agent:8:32;..."	-- name:low:high
+	local config = skynet.getenv "servicepool"
+	if config then
+		for name, low, high in string.gmatch(config, "([^:;%s]+):(%d+):(%d+)") do
+			command.POOL(nil, name, low, high)
+		end
+	end
+end)
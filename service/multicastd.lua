@@ -26,6 +26,7 @@ function command.NEW()
 	end
 	channel[channel_id] = {}
 	channel_n[channel_id] = 0
+	mc.newchannel(channel_id)
 	local ret = channel_id
 	channel_id = mc.nextid(channel_id)
 	return ret
@@ -35,6 +36,7 @@ end
 function command.DELR(source, c)
 	channel[c] = nil
 	channel_n[c] = nil
+	mc.delchannel(c)
 	return NORET
 end
 
@@ -50,6 +52,7 @@ function command.DEL(source, c)
 	channel[c] = nil
 	channel_n[c] = nil
 	channel_remote[c] = nil
+	mc.delchannel(c)
 	if remote then
 		for node in pairs(remote) do
 			skynet.send(node_address[node], "lua", "DELR", c)
@@ -63,41 +66,18 @@ local function remote_publish(node, channel, source, ...)
 	skynet.redirect(node_address[node], source, "multicast", channel, ...)
 end
 
--- publish a message, for local node, use the message pointer (call mc.bind to add the reference)
--- for remote node, call remote_publish. (call mc.unpack and skynet.tostring to convert message pointer to string)
-local function publish(c , source, pack, size)
-	local remote = channel_remote[c]
-	if remote then
-		-- remote publish should unpack the pack, because we should not publish the pointer out.
-		local _, msg, sz = mc.unpack(pack, size)
-		local msg = skynet.tostring(msg,sz)
-		for node in pairs(remote) do
-			remote_publish(node, c, source, msg)
-		end
-	end
-
-	local group = channel[c]
-	if group == nil or next(group) == nil then
-		-- dead channel, delete the pack. mc.bind returns the pointer in pack and free the pack (struct mc_package **)
-		local pack = mc.bind(pack, 1)
-		mc.close(pack)
-		return
-	end
-	local msg = skynet.tostring(pack, size)	-- copy (pack,size) to a string
-	mc.bind(pack, channel_n[c])	-- mc.bind will free the pack(struct mc_package **)
-	for k in pairs(group) do
-		-- the msg is a pointer to the real message, publish pointer in local is ok.
-		skynet.redirect(k, source, "multicast", c , msg)
-	end
-end
-
+-- the message from a remote node : publish it to the local subscribers (and the remote nodes if the channel
+-- is created by this node). The subscribers are kept in multicast.core (see mc.subscribe), the local
+-- subscribers share the message, and each remote node gets a copy.
 skynet.register_protocol {
 	name = "multicast",
 	id = skynet.PTYPE_MULTICAST,
 	unpack = function(msg, sz)
-		return mc.packremote(msg, sz)
+		return msg, sz
+	end,
+	dispatch = function(c, source, msg, sz)
+		mc.deliver(c, source, msg, sz)
 	end,
-	dispatch = publish,
 }
 
 -- publish a message, if the caller is remote, forward the message to the owner node (by remote_publish)
@@ -109,7 +89,8 @@ function command.PUB(source, c, pack, size)
 		-- remote publish
 		remote_publish(node, c, source, mc.remote(pack))
 	else
-		publish(c, source, pack,size)
+		local msg, sz = mc.remote(pack)
+		mc.deliver(c, source, msg, sz, true)
 	end
 end
 
@@ -130,6 +111,7 @@ function command.SUBR(source, c)
 		channel_remote[c] = group
 	end
 	group[node] = true
+	mc.subscribe(c, source, true, true)
 end
 
 -- the service (source) subscribe a channel
@@ -153,6 +135,7 @@ function command.SUB(source, c)
 	if group and not group[source] then
 		channel_n[c] = channel_n[c] + 1
 		group[source] = true
+		mc.subscribe(c, source, true)
 	end
 end
 
@@ -162,6 +145,7 @@ function command.USUBR(source, c)
 	assert(node ~= harbor_id)
 	local group = assert(channel_remote[c])
 	group[node] = nil
+	mc.subscribe(c, source, false, true)
 	return NORET
 end
 
@@ -171,12 +155,14 @@ function command.USUB(source, c)
 	if group[source] then
 		group[source] = nil
 		channel_n[c] = channel_n[c] - 1
+		mc.subscribe(c, source, false)
 		if channel_n[c] == 0 then
 			local node = c % 256
 			if node ~= harbor_id then
 				-- remote group
 				channel[c] = nil
 				channel_n[c] = nil
+				mc.delchannel(c)
 				skynet.send(node_address[node], "lua", "USUBR", c)
 			end
 		end
@@ -10,9 +10,9 @@ local pool_count = {}
 local objmap = {}
 local collect_tick = 600
 
-local function newobj(name, tbl)
+-- tbl is the source of cobj, or nil if cobj is loaded from an image
+local function newobj(name, tbl, cobj)
 	assert(pool[name] == nil)
-	local cobj = sharedata.host.new(tbl)
 	sharedata.host.incref(cobj)
 	local v = { value = tbl , obj = cobj, watch = {} }
 	objmap[cobj] = v
@@ -50,7 +50,7 @@ local CMD = {}
 
 local env_mt = { __index = _ENV }
 
-function CMD.new(name, t, ...)
+local function load_value(name, t, ...)
 	local dt = type(t)
 	local value
 	if dt == "table" then
@@ -73,7 +73,12 @@ function CMD.new(name, t, ...)
 	else
 		error ("Unknown data type " .. dt)
 	end
-	newobj(name, value)
+	return value
+end
+
+function CMD.new(name, t, ...)
+	local value = load_value(name, t, ...)
+	newobj(name, value, sharedata.host.new(value))
 end
 
 function CMD.delete(name)
@@ -102,18 +107,30 @@ function CMD.confirm(cobj)
 	return NORET
 end
 
-function CMD.update(name, t, ...)
+-- convert(oldcobj) returns the source and the new version
+local function update(name, convert)
 	local v = pool[name]
+	local count = pool_count[name]
 	local watch, oldcobj
 	if v then
 		watch = v.watch
 		oldcobj = v.obj
-		objmap[oldcobj] = true
-		sharedata.host.decref(oldcobj)
 		pool[name] = nil
 		pool_count[name] = nil
 	end
-	CMD.new(name, t, ...)
+	local ok, err = pcall(function()
+		newobj(name, convert(oldcobj))
+	end)
+	if not ok then
+		-- keep the old version
+		pool[name] = v
+		pool_count[name] = count
+		error(err)
+	end
+	if v then
+		objmap[oldcobj] = true
+		sharedata.host.decref(oldcobj)
+	end
 	local newobj = pool[name].obj
 	if watch then
 		sharedata.host.markdirty(oldcobj)
@@ -124,6 +141,105 @@ function CMD.update(name, t, ...)
 	collect10sec()	-- collect in 10 sec
 end
 
+-- the subtables with the same content as the old version are shared (see sharedata.core.new)
+function CMD.update(name, t, ...)
+	local value = load_value(name, t, ...)
+	update(name, function(oldcobj)
+		return value, sharedata.host.new(value, oldcobj)
+	end)
+end
+
+-- new or update by an image file (see lualib/sharedata/compile.lua), it's mapped and shared by the processes
+function CMD.load(name, filename)
+	if pool[name] then
+		update(name, function()
+			return nil, sharedata.host.load(filename)
+		end)
+	else
+		newobj(name, nil, sharedata.host.load(filename))
+	end
+end
+
+local function mark_all(dirty, t)
+	dirty[t] = true
+	for _, v in pairs(t) do
+		if type(v) == "table" and not dirty[v] then
+			mark_all(dirty, v)
+		end
+	end
+end
+
+-- the writable copy of t, the copies and the new tables are in the dirty set
+local function clone(dirty, t)
+	if dirty[t] then
+		return t
+	end
+	local c = {}
+	for k, v in pairs(t) do
+		c[k] = v
+	end
+	dirty[c] = true
+	return c
+end
+
+local function merge(dirty, t, set)
+	for k, v in pairs(set) do
+		local old = t[k]
+		if type(v) == "table" and type(old) == "table" then
+			old = clone(dirty, old)
+			t[k] = old
+			merge(dirty, old, v)
+		else
+			if type(v) == "table" then
+				mark_all(dirty, v)
+			end
+			t[k] = v
+		end
+	end
+end
+
+local function exist(t, path)
+	local n = #path
+	for i = 1, n - 1 do
+		t = t[path[i]]
+		if type(t) ~= "table" then
+			return false
+		end
+	end
+	return t[path[n]] ~= nil
+end
+
+--[[
+	Apply a delta to the data : merge the table set into it (the subtables are merged recursively),
+	then remove the keys by the list of paths remove, ie. { { "a", "b" } } removes data.a.b .
+	The changed tables (and their ancestors) are copied and converted again, the others are shared with
+	the old version. The source of the old version isn't changed, so a failed patch keeps it.
+]]
+function CMD.patch(name, set, remove)
+	local v = assert(pool[name])
+	if v.value == nil then
+		error(string.format("%s is loaded from an image, it can't be patched", name))
+	end
+	local dirty = {}
+	local value = clone(dirty, v.value)
+	merge(dirty, value, set or {})
+	for _, path in ipairs(remove or {}) do
+		if exist(value, path) then
+			local t = value
+			local n = #path
+			for i = 1, n - 1 do
+				local sub = clone(dirty, t[path[i]])
+				t[path[i]] = sub
+				t = sub
+			end
+			t[path[n]] = nil
+		end
+	end
+	update(name, function(oldcobj)
+		return value, sharedata.host.new(value, oldcobj, dirty)
+	end)
+end
+
 local function check_watch(queue)
 	local n = 0
 	for k,response in pairs(queue) do
@@ -136,7 +252,11 @@ local function check_watch(queue)
 end
 
 function CMD.monitor(name, obj)
-	local v = assert(pool[name])
+	local v = pool[name]
+	if v == nil then
+		-- deleted before monitoring
+		return
+	end
 	if obj ~= v.obj then
 		return v.obj
 	end
@@ -0,0 +1,218 @@
+local skynet = require "skynet"
+local mc = require "multicast"
+local datacenter = require "datacenter"
+
+--[[
+	The topic router of a node, see lualib/topic.lua .
+
+	The events are published to one multicast channel (created by the standalone node), the topicd of each
+	node subscribes it, so a remote node gets one copy of an event. topicd matches the topic (the words
+	separated by '.') with the patterns subscribed by the local services, and sends the events to each
+	subscriber in batches : the events queued in this service now, or BATCH events.
+
+	The patterns are in a trie of words, '*' matches one word, and '#' (the last word only) matches zero or
+	more words, ie. "scene.*.combat" and "scene.#" .
+]]
+
+local BATCH = 256
+
+local command = {}
+local NORET = {}
+local channel
+
+local root = { children = {}, subs = {} }
+local subscription = {}	-- id -> { node, address }
+local subscriber = {}	-- address -> { id = true }
+local subscription_id = 0
+
+local cache = {}	-- topic -> matched (id, address, ...)
+local cache_n = 0
+local CACHE_MAX = 4096
+
+local batch = {}	-- address -> { id, topic, payload, ... }
+local flushing = false
+
+local function split(name)
+	local words = {}
+	for w in name:gmatch "[^%.]+" do
+		words[#words+1] = w
+	end
+	return words
+end
+
+local function collect(subs, out)
+	for id, address in pairs(subs) do
+		out[#out+1] = id
+		out[#out+1] = address
+	end
+end
+
+local function match_node(node, words, i, out)
+	local any = node.any
+	if any then
+		collect(any.subs, out)
+	end
+	local w = words[i]
+	if w == nil then
+		collect(node.subs, out)
+		return
+	end
+	local child = node.children[w]
+	if child then
+		match_node(child, words, i + 1, out)
+	end
+	if node.one then
+		match_node(node.one, words, i + 1, out)
+	end
+end
+
+local function match(name)
+	local out = cache[name]
+	if out == nil then
+		out = {}
+		match_node(root, split(name), 1, out)
+		if cache_n >= CACHE_MAX then
+			cache = {}
+			cache_n = 0
+		end
+		cache[name] = out
+		cache_n = cache_n + 1
+	end
+	return out
+end
+
+local function unsubscribe(id)
+	local s = subscription[id]
+	if s then
+		subscription[id] = nil
+		s.node.subs[id] = nil
+		local ids = subscriber[s.address]
+		ids[id] = nil
+		if next(ids) == nil then
+			subscriber[s.address] = nil
+		end
+		cache = {}
+		cache_n = 0
+	end
+end
+
+local function send(address, b)
+	if not skynet.send(address, "topic", b) then
+		-- the subscriber is dead
+		for id in pairs(subscriber[address] or {}) do
+			unsubscribe(id)
+		end
+	end
+end
+
+local function flush()
+	local b = batch
+	batch = {}
+	flushing = false
+	for address, events in pairs(b) do
+		send(address, events)
+	end
+end
+
+local function route(_, source, name, payload)
+	local out = match(name)
+	for i = 1, #out, 2 do
+		local address = out[i+1]
+		local b = batch[address]
+		if b == nil then
+			b = {}
+			batch[address] = b
+		end
+		local n = #b
+		b[n+1] = out[i]
+		b[n+2] = name
+		b[n+3] = payload
+		if n + 3 >= BATCH * 3 then
+			batch[address] = nil
+			send(address, b)
+		end
+	end
+	if not flushing and next(batch) then
+		flushing = true
+		-- after the events queued now
+		skynet.timeout(0, flush)
+	end
+end
+
+function command.CHANNEL()
+	return channel.channel
+end
+
+function command.SUB(source, pattern)
+	local words = split(pattern)
+	local node = root
+	for i, w in ipairs(words) do
+		if w == "#" then
+			assert(i == #words, "'#' should be the last word of the pattern")
+			node.any = node.any or { children = {}, subs = {} }
+			node = node.any
+		elseif w == "*" then
+			node.one = node.one or { children = {}, subs = {} }
+			node = node.one
+		else
+			local child = node.children[w]
+			if child == nil then
+				child = { children = {}, subs = {} }
+				node.children[w] = child
+			end
+			node = child
+		end
+	end
+	subscription_id = subscription_id + 1
+	local id = subscription_id
+	node.subs[id] = source
+	subscription[id] = { node = node, address = source }
+	local ids = subscriber[source]
+	if ids == nil then
+		ids = {}
+		subscriber[source] = ids
+	end
+	ids[id] = true
+	cache = {}
+	cache_n = 0
+	return id
+end
+
+function command.USUB(source, id)
+	local s = subscription[id]
+	if s and s.address == source then
+		unsubscribe(id)
+	end
+	return NORET
+end
+
+skynet.register_protocol {
+	name = "topic",
+	id = skynet.PTYPE_TOPIC,
+	pack = skynet.pack,
+}
+
+skynet.start(function()
+	local id
+	if skynet.getenv "standalone" then
+		id = datacenter.get("topic", "channel")
+		if id == nil then
+			id = mc.new().channel
+			datacenter.set("topic", "channel", id)
+		end
+	else
+		id = datacenter.wait("topic", "channel")
+	end
+	channel = mc.new {
+		channel = id,
+		dispatch = route,
+	}
+	channel:subscribe()
+	skynet.dispatch("lua", function(_, source, cmd, ...)
+		local f = assert(command[cmd])
+		local result = f(source, ...)
+		if result ~= NORET then
+			skynet.ret(skynet.pack(result))
+		end
+	end)
+end)
@@ -20,6 +20,8 @@
 #define PTYPE_RESERVED_DEBUG 9
 #define PTYPE_RESERVED_LUA 10
 #define PTYPE_RESERVED_SNAX 11
+// read lualib/topic.lua
+#define PTYPE_RESERVED_TOPIC 12
 
 #define PTYPE_TAG_DONTCOPY 0x10000 /* ʶڶ */
 #define PTYPE_TAG_ALLOCSESSION 0x20000 /* session־ */
@@ -102,6 +102,9 @@ skynet_socket_poll() {
 	case SOCKET_UDP:
 		forward_message(SKYNET_SOCKET_TYPE_UDP, false, &result);
 		break;
+	case SOCKET_WARNING:
+		forward_message(SKYNET_SOCKET_TYPE_WARNING, false, &result);
+		break;
 	default:
 		skynet_error(NULL, "Unknown socket message type %d.",type);
 		return -1;
@@ -135,11 +138,37 @@ skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz) {
 	return check_wsz(ctx, id, buffer, wsz);
 }
 
+int
+skynet_socket_send_head(struct skynet_context *ctx, int id, const void *head, int hsz, void *buffer, int sz) {
+	int64_t wsz = socket_server_send_head(SOCKET_SERVER, id, head, hsz, buffer, sz);
+	return check_wsz(ctx, id, buffer, wsz);
+}
+
 void
 skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz) {
 	socket_server_send_lowpriority(SOCKET_SERVER, id, buffer, sz);
 }
 
+void
+skynet_socket_setwater(struct skynet_context *ctx, int id, int high, int low, int policy) {
+	socket_server_setwater(SOCKET_SERVER, id, high, low, policy);
+}
+
+void
+skynet_socket_readsize(struct skynet_context *ctx, int id, int sz) {
+	socket_server_readsize(SOCKET_SERVER, id, sz);
+}
+
+int
+skynet_socket_writable(struct skynet_context *ctx, int id) {
+	return socket_server_writable(SOCKET_SERVER, id);
+}
+
+void
+skynet_socket_broadcast(struct skynet_context *ctx, const int *ids, int n, void *buffer, int sz) {
+	socket_server_broadcast(SOCKET_SERVER, ids, n, buffer, sz);
+}
+
 
 /* skynetsocketļlistenӿڣsocket server׽ */
 int 
@@ -11,6 +11,11 @@ struct skynet_context;
 #define SKYNET_SOCKET_TYPE_UDP 6
 #define SKYNET_SOCKET_TYPE_WARNING 7
 
+// policy of skynet_socket_setwater, the same as SOCKET_WATER_* in socket_server.h
+#define SKYNET_SOCKET_WATER_DROP 0
+#define SKYNET_SOCKET_WATER_CLOSE 1
+#define SKYNET_SOCKET_WATER_PAUSE 2
+
 /* skynetsocketϢ */
 struct skynet_socket_message {
 	int type;//socketϢ
@@ -26,6 +31,8 @@ int skynet_socket_poll();
 
 int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);
 void skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz);
+int skynet_socket_send_head(struct skynet_context *ctx, int id, const void *head, int hsz, void *buffer, int sz);
+void skynet_socket_broadcast(struct skynet_context *ctx, const int *ids, int n, void *buffer, int sz);
 int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog);
 int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);
 int skynet_socket_bind(struct skynet_context *ctx, int fd);
@@ -33,6 +40,9 @@ void skynet_socket_close(struct skynet_context *ctx, int id);
 void skynet_socket_shutdown(struct skynet_context *ctx, int id);
 void skynet_socket_start(struct skynet_context *ctx, int id);
 void skynet_socket_nodelay(struct skynet_context *ctx, int id);
+void skynet_socket_setwater(struct skynet_context *ctx, int id, int high, int low, int policy);
+int skynet_socket_writable(struct skynet_context *ctx, int id);
+void skynet_socket_readsize(struct skynet_context *ctx, int id, int sz);
 
 int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
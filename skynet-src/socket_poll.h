@@ -3,13 +3,23 @@
 
 #include <stdbool.h>
 
+#if defined(__linux__) && defined(USE_IO_URING)
+typedef struct uring_poll * poll_fd;
+#else
 typedef int poll_fd;
+#endif
 
 /* epoll¼װɸýṹ */
 struct event {
 	void * s;//¼Դ
 	bool read;//ɶ
 	bool write;//д
+#if defined(__linux__) && defined(USE_IO_URING)
+	bool complete;// (socket_uring.h)
+	int size;//ֽ, acceptfd, С0Ϊ-errno
+	int buffer;
+	char * data;
+#endif
 };
 
 static bool sp_invalid(poll_fd fd);
@@ -22,8 +32,12 @@ static int sp_wait(poll_fd, struct event *e, int max);
 static void sp_nonblocking(int sock);
 
 #ifdef __linux__
+#ifdef USE_IO_URING
+#include "socket_uring.h"
+#else
 #include "socket_epoll.h"
 #endif
+#endif
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #include "socket_kqueue.h"
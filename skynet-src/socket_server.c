@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	// for recvmmsg
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
@@ -6,6 +10,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -18,9 +23,23 @@
 
 #define MAX_INFO 128
 // MAX_SOCKET will be 2^MAX_SOCKET_P
-#define MAX_SOCKET_P 16
+#define MAX_SOCKET_P 20
+// The slot table grows by pages of 2^SLOT_PAGE_P sockets, so the address of socket never changes.
+#define SLOT_PAGE_P 12
+// reserve_id doubles the slots in use when it meets more than MAX_PROBE sockets in use
+#define MAX_PROBE 16
 #define MAX_EVENT 64
+// the write buffers gathered by one writev
+#define MAX_SEND_IOV 64
 #define MIN_READ_BUFFER 64
+#define MAX_READ_BUFFER (256 * 1024)
+// read a socket again before the next event when the read buffer is full, at most MAX_READ_LOOP times
+#define MAX_READ_LOOP 16
+
+#if defined(__linux__) && !defined(USE_IO_URING)
+// read udp packages by recvmmsg, UDP_BATCH packages at most in one call (the io_uring backend receives them itself)
+#define UDP_BATCH 16
+#endif
 
 /* socket_serversocket */
 #define SOCKET_TYPE_INVALID 0
@@ -33,12 +52,13 @@
 #define SOCKET_TYPE_PACCEPT 7 //acceptclient socketͣδӵepollмio
 #define SOCKET_TYPE_BIND 8
 
-#define MAX_SOCKET (1<<MAX_SOCKET_P) /* 2^16 65536 */
+#define MAX_SOCKET (1<<MAX_SOCKET_P)
+#define SLOT_PAGE (1<<SLOT_PAGE_P)
 
 #define PRIORITY_HIGH 0
 #define PRIORITY_LOW 1
 
-#define HASH_ID(id) (((unsigned)id) % MAX_SOCKET) /* ȡ16λ */
+#define HASH_ID(id) (((unsigned)id) % MAX_SOCKET) /* ȡ20λ */
 
 #define PROTOCOL_TCP 0
 #define PROTOCOL_UDP 1
@@ -62,6 +82,7 @@ struct write_buffer {
 	char *ptr;//ݵ׵ַ
 	int sz;//ݵĴС
 	bool userobject;
+	bool broadcast;	// buffer is struct socket_broadcast, shared by the sockets
 	uint8_t udp_address[UDP_ADDRESS_SIZE];
 };
 
@@ -79,16 +100,40 @@ struct socket {
 	struct wb_list high;
 	struct wb_list low;
 	int64_t wb_size;
+	int high_water;	// 0 : no limit of wb_size
+	int low_water;
+	uint8_t water_policy;
+	volatile bool blocked;	// wb_size reached high_water, and not drained below low_water yet
+	int read_avg;	// ewma of the bytes per read (tcp)
 	int fd; /* ʵsocket */
 	int id; /* socket_server׽ */
 	uint16_t protocol;/* ׽Э */
 	uint16_t type;/* ׽ͣʼΪSOCKET_TYPE_INVALID */
 	union {
-		int size;
+		int size;	// read buffer size of tcp, the initial size of the accepted sockets for listen socket
 		uint8_t udp_address[UDP_ADDRESS_SIZE];
 	} p;
 };
 
+union sockaddr_all {
+	struct sockaddr s;
+	struct sockaddr_in v4;
+	struct sockaddr_in6 v6;
+};
+
+#ifdef UDP_BATCH
+// the received packages of one udp socket, the buffers are reused by all the udp sockets
+struct udp_batch {
+	int id;
+	int n;
+	int current;
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all addr[UDP_BATCH];
+	uint8_t buffer[UDP_BATCH][MAX_UDP_PACKAGE];
+};
+#endif
+
 /* socketṹ */
 struct socket_server {
 	int recvctrl_fd; /* pipe */
@@ -100,9 +145,16 @@ struct socket_server {
 	int event_index;
 	struct socket_object_interface soi;
 	struct event ev[MAX_EVENT];
-	struct socket slot[MAX_SOCKET];/* 65536socket飬Թеsocket */
+	int slot_cap;	// the slots [0, slot_cap) are in use, it doubles when they are crowded
+	struct socket * slot[MAX_SOCKET / SLOT_PAGE];	// pages of sockets, allocated when it's used first time
+	struct socket invalid;	// returned by get_socket for the id out of the pages
 	char buffer[MAX_INFO];//ڻsocketĳЩʱ
+	int read_loop;	// times of reading the current event again
+#ifdef UDP_BATCH
+	struct udp_batch udp;
+#else
 	uint8_t udpbuffer[MAX_UDP_PACKAGE];
+#endif
 	fd_set rfds;//select|pollfd_set
 };
 
@@ -123,6 +175,13 @@ struct request_send {
 	char * buffer;
 };
 
+// the head is copied into the request, and sent before the buffer
+struct request_send_head {
+	struct request_send send;
+	int hsz;
+	uint8_t head[SOCKET_HEAD_MAX];
+};
+
 struct request_send_udp {
 	struct request_send send;
 	uint8_t address[UDP_ADDRESS_SIZE];
@@ -139,6 +198,20 @@ struct request_close {
 	uintptr_t opaque;
 };
 
+// One buffer for many sockets, the write buffers of sockets share it by ref.
+// It's only touched by socket thread after the request is sent.
+struct socket_broadcast {
+	int ref;
+	int sz;
+	void * buffer;
+	int n;
+	int id[1];
+};
+
+struct request_broadcast {
+	struct socket_broadcast * broadcast;
+};
+
 /* pipe "L"ݸʽ */
 struct request_listen {
 	int id;//socket_serverе
@@ -165,6 +238,13 @@ struct request_setopt {
 	int value;
 };
 
+struct request_setwater {
+	int id;
+	int high;
+	int low;
+	int policy;
+};
+
 struct request_udp {
 	int id;
 	int fd;
@@ -183,6 +263,7 @@ struct request_udp {
 	X Exit
 	D Send package (high)
 	P Send package (low)
+	G Send package with head (high)
 	A Send UDP package
 	T Set opt
 	U Create UDP socket
@@ -195,6 +276,7 @@ struct request_package {
 		char buffer[256];
 		struct request_open open;
 		struct request_send send;
+		struct request_send_head send_head;
 		struct request_send_udp send_udp;
 		struct request_close close;
 		struct request_listen listen;
@@ -203,16 +285,12 @@ struct request_package {
 		struct request_setopt setopt;
 		struct request_udp udp;
 		struct request_setudp set_udp;
+		struct request_broadcast broadcast;
+		struct request_setwater setwater;
 	} u;
 	uint8_t dummy[256];
 };
 
-union sockaddr_all {
-	struct sockaddr s;
-	struct sockaddr_in v4;
-	struct sockaddr_in6 v6;
-};
-
 struct send_object {
 	void * buffer;
 	int sz;
@@ -238,9 +316,19 @@ send_object_init(struct socket_server *ss, struct send_object *so, void *object,
 	}
 }
 
+static void
+broadcast_release(struct socket_broadcast *b) {
+	if (--b->ref == 0) {
+		FREE(b->buffer);
+		FREE(b);
+	}
+}
+
 static inline void
 write_buffer_free(struct socket_server *ss, struct write_buffer *wb) {
-	if (wb->userobject) {
+	if (wb->broadcast) {
+		broadcast_release(wb->buffer);
+	} else if (wb->userobject) {
 		ss->soi.free(wb->buffer);
 	} else {
 		FREE(wb->buffer);
@@ -256,16 +344,52 @@ socket_keepalive(int fd) {
 	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&keepalive , sizeof(keepalive));  
 }
 
-/* ȫsocketеsocket arrayзһַreturnַе */
+static inline struct socket *
+get_socket(struct socket_server *ss, int id) {
+	unsigned h = HASH_ID(id);
+	struct socket * page = ss->slot[h >> SLOT_PAGE_P];
+	if (page == NULL) {
+		return &ss->invalid;
+	}
+	return &page[h & (SLOT_PAGE - 1)];
+}
+
+// the slot of hash h, allocate the page if it doesn't exist. It can be called by any thread.
+static struct socket *
+new_slot(struct socket_server *ss, unsigned h) {
+	struct socket ** page = &ss->slot[h >> SLOT_PAGE_P];
+	if (*page == NULL) {
+		// SOCKET_TYPE_INVALID is 0, and the wb_list is empty
+		struct socket * p = MALLOC(sizeof(struct socket) * SLOT_PAGE);
+		memset(p, 0, sizeof(struct socket) * SLOT_PAGE);
+		if (!ATOM_CAS_POINTER(page, NULL, p)) {
+			FREE(p);
+		}
+	}
+	return &(*page)[h & (SLOT_PAGE - 1)];
+}
+
+/*
+	ȫsocketеsocket arrayзһַreturnַе
+	The id increases, and the low MAX_SOCKET_P bits of id is the slot. The ids whose slot is out of
+	[0, slot_cap) are skipped, so an id keeps its slot when the table grows.
+ */
 static int
 reserve_id(struct socket_server *ss) {
 	int i;
+	int probe = 0;
 	for (i=0;i<MAX_SOCKET;i++) {
 		int id = ATOM_INC(&(ss->alloc_id));/* ss->alloc_id,0ʼ */
 		if (id < 0) {
 			id = ATOM_AND(&(ss->alloc_id), 0x7fffffff);
 		}
-		struct socket *s = &ss->slot[HASH_ID(id)];/* ʹidĵ16λΪϣֵ,slotеֵ */
+		int cap = ss->slot_cap;
+		if (HASH_ID(id) >= cap) {
+			// skip to the next round
+			ATOM_CAS(&(ss->alloc_id), id, id | (MAX_SOCKET - 1));
+			continue;
+		}
+		struct socket *s = new_slot(ss, HASH_ID(id));
 		if (s->type == SOCKET_TYPE_INVALID) {
 			if (ATOM_CAS(&s->type, SOCKET_TYPE_INVALID, SOCKET_TYPE_RESERVE)) {/* slotãΪreserve */
 				s->id = id;
@@ -275,6 +399,9 @@ reserve_id(struct socket_server *ss) {
 				// retry
 				--i;
 			}
+		} else if (++probe > MAX_PROBE && cap < MAX_SOCKET) {
+			ATOM_CAS(&(ss->slot_cap), cap, cap * 2);
+			probe = 0;
 		}
 	}
 	return -1;
@@ -291,7 +418,6 @@ clear_wb_list(struct wb_list *list) {
 /* socket server */
 struct socket_server * 
 socket_server_create() {
-	int i;
 	int fd[2];
 	poll_fd efd = sp_create();/* epoll */
 	if (sp_invalid(efd)) {
@@ -318,15 +444,30 @@ socket_server_create() {
 	ss->sendctrl_fd = fd[1];/* pipe write fd */
 	ss->checkctrl = 1;
 
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
-		s->type = SOCKET_TYPE_INVALID;
-		clear_wb_list(&s->high);
-		clear_wb_list(&s->low);
-	}
+	ss->slot_cap = SLOT_PAGE;
+	memset(ss->slot, 0, sizeof(ss->slot));
+	memset(&ss->invalid, 0, sizeof(ss->invalid));
+	ss->invalid.type = SOCKET_TYPE_INVALID;
+	ss->invalid.id = -1;
 	ss->alloc_id = 0;/* id0ʼ */
 	ss->event_n = 0;
 	ss->event_index = 0;/* event0ʼ */
+	ss->read_loop = 0;
+#ifdef UDP_BATCH
+	int i;
+	ss->udp.id = -1;
+	ss->udp.n = 0;
+	ss->udp.current = 0;
+	for (i=0;i<UDP_BATCH;i++) {
+		struct msghdr *h = &ss->udp.msg[i].msg_hdr;
+		memset(h, 0, sizeof(*h));
+		h->msg_name = &ss->udp.addr[i];
+		h->msg_iov = &ss->udp.iov[i];
+		h->msg_iovlen = 1;
+		ss->udp.iov[i].iov_base = ss->udp.buffer[i];
+		ss->udp.iov[i].iov_len = MAX_UDP_PACKAGE;
+	}
+#endif
 	memset(&ss->soi, 0, sizeof(ss->soi));
 	FD_ZERO(&ss->rfds);
 	assert(ss->recvctrl_fd < FD_SETSIZE);
@@ -358,6 +499,13 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_message *r
 	assert(s->type != SOCKET_TYPE_RESERVE);
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
+#ifdef UDP_BATCH
+	if (ss->udp.id == s->id) {
+		// discard the packages not dispatched
+		ss->udp.id = -1;
+		ss->udp.n = 0;
+	}
+#endif
 	if (s->type != SOCKET_TYPE_PACCEPT && s->type != SOCKET_TYPE_PLISTEN) {
 		sp_del(ss->event_fd, s->fd);
 	}
@@ -374,11 +522,19 @@ socket_server_release(struct socket_server *ss) {
 	int i;
 	struct socket_message dummy;
 	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
+		struct socket *page = ss->slot[i >> SLOT_PAGE_P];
+		if (page == NULL) {
+			i |= SLOT_PAGE - 1;
+			continue;
+		}
+		struct socket *s = &page[i & (SLOT_PAGE - 1)];
 		if (s->type != SOCKET_TYPE_RESERVE) {
 			force_close(ss, s , &dummy);
 		}
 	}
+	for (i=0;i<MAX_SOCKET / SLOT_PAGE;i++) {
+		FREE(ss->slot[i]);
+	}
 	close(ss->sendctrl_fd);
 	close(ss->recvctrl_fd);
 	sp_release(ss->event_fd);
@@ -395,7 +551,7 @@ check_wb_list(struct wb_list *s) {
 /* òsocket */
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool add) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	assert(s->type == SOCKET_TYPE_RESERVE);
 
 	if (add) {//truesockӵepoll
@@ -411,6 +567,11 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	s->p.size = MIN_READ_BUFFER;//socketȡʱĴС
 	s->opaque = opaque;
 	s->wb_size = 0;
+	s->high_water = 0;
+	s->low_water = 0;
+	s->water_policy = SOCKET_WATER_DROP;
+	s->blocked = false;
+	s->read_avg = 0;
 	check_wb_list(&s->high);
 	check_wb_list(&s->low);
 	return s;
@@ -491,16 +652,25 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 	return -1;
 _failed:
 	freeaddrinfo( ai_list );
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	get_socket(ss, id)->type = SOCKET_TYPE_INVALID;
 	return SOCKET_ERROR;
 }
 
+// gather up to MAX_SEND_IOV write buffers of the list in one writev
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+	struct iovec iov[MAX_SEND_IOV];
 	while (list->head) {
-		struct write_buffer * tmp = list->head;
+		int n = 0;
+		struct write_buffer * tmp;
+		for (tmp = list->head; tmp && n < MAX_SEND_IOV; tmp = tmp->next) {
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			++n;
+		}
+		ssize_t sz;
 		for (;;) {
-			int sz = write(s->fd, tmp->ptr, tmp->sz);
+			sz = writev(s->fd, iov, n);
 			if (sz < 0) {
 				switch(errno) {
 				case EINTR: //жϴҪ·
@@ -511,16 +681,20 @@ send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 				force_close(ss,s, result);
 				return SOCKET_CLOSE;
 			}
-			s->wb_size -= sz;
-			if (sz != tmp->sz) {//ǰwrite_bufferδȫ
+			break;
+		}
+		s->wb_size -= sz;
+		while (n-- > 0) {
+			tmp = list->head;
+			if (sz < tmp->sz) {//ǰwrite_bufferδȫ
 				tmp->ptr += sz;
 				tmp->sz -= sz;
 				return -1;
 			}
-			break;
+			sz -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);//ͷwrite_bufferԼ
 		}
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);//ͷwrite_bufferԼ
 	}
 	list->tail = NULL;
 
@@ -665,6 +839,7 @@ append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_s
 	struct write_buffer * buf = MALLOC(size);
 	struct send_object so;
 	buf->userobject = send_object_init(ss, &so, request->buffer, request->sz);
+	buf->broadcast = false;
 	buf->ptr = (char*)so.buffer+n;
 	buf->sz = so.sz - n;
 	buf->buffer = request->buffer;
@@ -695,6 +870,16 @@ append_sendbuffer(struct socket_server *ss, struct socket *s, struct request_sen
 	s->wb_size += buf->sz;
 }
 
+// the head is copied, because it's in the request
+static inline void
+append_sendhead(struct socket_server *ss, struct socket *s, const uint8_t *head, int hsz) {
+	struct request_send request;
+	request.sz = hsz;
+	request.buffer = MALLOC(hsz);
+	memcpy(request.buffer, head, hsz);
+	append_sendbuffer(ss, s, &request, 0);
+}
+
 static inline void
 append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_send * request) {
 	struct write_buffer *buf = append_sendbuffer_(ss, &s->low, request, SIZEOF_TCPBUFFER, 0);
@@ -706,17 +891,69 @@ send_buffer_empty(struct socket *s) {
 	return (s->high.head == NULL && s->low.head == NULL);
 }
 
+static void
+drop_low(struct socket_server *ss, struct socket *s) {
+	struct write_buffer *wb = s->low.head;
+	while (wb) {
+		struct write_buffer *next = wb->next;
+		s->wb_size -= wb->sz;
+		write_buffer_free(ss, wb);
+		wb = next;
+	}
+	s->low.head = s->low.tail = NULL;
+}
+
+/*
+	Check wb_size with the water marks, returns SOCKET_WARNING when the socket becomes blocked or writable again,
+	SOCKET_CLOSE when the socket is closed by policy SOCKET_WATER_CLOSE, otherwise -1.
+	The warning carries wb_size in K bytes (ud), 0 means the socket is writable again.
+ */
+static int
+check_water(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	if (s->high_water == 0) {
+		return -1;
+	}
+	if (!s->blocked) {
+		if (s->wb_size < s->high_water) {
+			return -1;
+		}
+		s->blocked = true;
+		switch (s->water_policy) {
+		case SOCKET_WATER_CLOSE:
+			fprintf(stderr, "socket-server: close %d, %d K bytes need to send out.\n", s->id, (int)(s->wb_size / 1024));
+			force_close(ss, s, result);
+			return SOCKET_CLOSE;
+		case SOCKET_WATER_DROP:
+			drop_low(ss, s);
+			break;
+		}
+		result->ud = (int)(s->wb_size / 1024) + 1;
+	} else {
+		if (s->wb_size > s->low_water) {
+			return -1;
+		}
+		s->blocked = false;
+		result->ud = 0;
+	}
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->data = NULL;
+	return SOCKET_WARNING;
+}
+
 /* SEND
 	When send a package , we can assign the priority : PRIORITY_HIGH or PRIORITY_LOW
 
 	If socket buffer is empty, write to fd directly.
 		If write a part, append the rest part to high list. (Even priority is PRIORITY_LOW)
 	Else append package to high (PRIORITY_HIGH) or low (PRIORITY_LOW) list.
+
+	If the socket is blocked by the water marks with policy SOCKET_WATER_DROP, the low priority package is dropped.
  */
 static int
 send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	struct send_object so;
 	send_object_init(ss, &so, request->buffer, request->sz);//ʼsend
 	if (s->type == SOCKET_TYPE_INVALID || s->id != id  
@@ -772,6 +1009,10 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 		}
 		sp_write(ss->event_fd, s->fd, s, true); //д¼
 	} else {
+		if (priority == PRIORITY_LOW && s->blocked && s->water_policy == SOCKET_WATER_DROP) {
+			so.free_func(request->buffer);
+			return -1;
+		}
 		if (s->protocol == PROTOCOL_TCP) {
 			if (priority == PRIORITY_LOW) {
 				append_sendbuffer_low(ss, s, request);
@@ -785,9 +1026,126 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			append_sendbuffer_udp(ss,s,priority,request,udp_address);
 		}
 	}
-	return -1;
+	return check_water(ss, s, result);
 }
 
+/*
+	SEND with head : a small head (in the request) and the buffer are sent by one writev, the buffer isn't copied.
+	The rest parts are appended to high list as two write buffers, only for tcp.
+ */
+static int
+send_socket_head(struct socket_server *ss, struct request_send_head * request, struct socket_message *result) {
+	struct request_send * send = &request->send;
+	int id = send->id;
+	struct socket * s = get_socket(ss, id);
+	struct send_object so;
+	send_object_init(ss, &so, send->buffer, send->sz);
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id
+		|| s->type == SOCKET_TYPE_HALFCLOSE
+		|| s->type == SOCKET_TYPE_PACCEPT
+		|| s->type == SOCKET_TYPE_PLISTEN || s->type == SOCKET_TYPE_LISTEN
+		|| s->protocol != PROTOCOL_TCP) {
+		so.free_func(send->buffer);
+		return -1;
+	}
+	int hsz = request->hsz;
+	if (send_buffer_empty(s) && s->type == SOCKET_TYPE_CONNECTED) {
+		struct iovec iov[2];
+		iov[0].iov_base = request->head;
+		iov[0].iov_len = hsz;
+		iov[1].iov_base = so.buffer;
+		iov[1].iov_len = so.sz;
+		int n;
+		for (;;) {
+			n = (int)writev(s->fd, iov, 2);
+			if (n < 0) {
+				switch(errno) {
+				case EINTR:
+					continue;
+				case AGAIN_WOULDBLOCK:
+					n = 0;
+					break;
+				default:
+					fprintf(stderr, "socket-server: write to %d (fd=%d) error :%s.\n",id,s->fd,strerror(errno));
+					force_close(ss,s,result);
+					so.free_func(send->buffer);
+					return SOCKET_CLOSE;
+				}
+			}
+			break;
+		}
+		if (n == hsz + so.sz) {
+			so.free_func(send->buffer);
+			return -1;
+		}
+		if (n < hsz) {
+			append_sendhead(ss, s, request->head + n, hsz - n);
+			n = 0;
+		} else {
+			n -= hsz;
+		}
+		append_sendbuffer(ss, s, send, n);
+		sp_write(ss->event_fd, s->fd, s, true);
+	} else {
+		append_sendhead(ss, s, request->head, hsz);
+		append_sendbuffer(ss, s, send, 0);
+	}
+	return check_water(ss, s, result);
+}
+
+/*
+	BROADCAST : send one buffer to each socket in the list.
+	The rest part of buffer is appended to the high list of socket with a ref of the broadcast.
+	A write error doesn't close the socket here (there is only one result), it will be raised by the next write event.
+	So does the water marks check, but a socket blocked with policy SOCKET_WATER_DROP is skipped as low priority.
+ */
+static int
+broadcast_socket(struct socket_server *ss, struct request_broadcast * request) {
+	struct socket_broadcast * b = request->broadcast;
+	int i;
+	for (i=0;i<b->n;i++) {
+		int id = b->id[i];
+		struct socket * s = get_socket(ss, id);
+		if (s->id != id || s->protocol != PROTOCOL_TCP) {
+			continue;
+		}
+		if (s->type != SOCKET_TYPE_CONNECTED && s->type != SOCKET_TYPE_CONNECTING) {
+			continue;
+		}
+		if (s->blocked && s->water_policy == SOCKET_WATER_DROP) {
+			continue;
+		}
+		int n = 0;
+		if (send_buffer_empty(s) && s->type == SOCKET_TYPE_CONNECTED) {
+			n = write(s->fd, b->buffer, b->sz);
+			if (n == b->sz) {
+				continue;
+			}
+			if (n < 0) {
+				n = 0;
+			}
+			sp_write(ss->event_fd, s->fd, s, true);
+		}
+		struct write_buffer * buf = MALLOC(sizeof(*buf));
+		buf->userobject = false;
+		buf->broadcast = true;
+		buf->buffer = b;
+		buf->ptr = (char *)b->buffer + n;
+		buf->sz = b->sz - n;
+		buf->next = NULL;
+		++b->ref;
+		struct wb_list *list = &s->high;
+		if (list->head == NULL) {
+			list->head = list->tail = buf;
+		} else {
+			list->tail->next = buf;
+			list->tail = buf;
+		}
+		s->wb_size += buf->sz;
+	}
+	broadcast_release(b);
+	return -1;
+}
 
 /* listen-1Ϊɹ */
 static int
@@ -806,7 +1164,7 @@ _failed:
 	result->id = id;
 	result->ud = 0;
 	result->data = "reach skynet socket number limit";
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	get_socket(ss, id)->type = SOCKET_TYPE_INVALID;
 
 	return SOCKET_ERROR;
 }
@@ -814,7 +1172,7 @@ _failed:
 static int
 close_socket(struct socket_server *ss, struct request_close *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id != id) {
 		result->id = id;
 		result->opaque = request->opaque;
@@ -864,7 +1222,7 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 	result->opaque = request->opaque;
 	result->ud = 0;
 	result->data = NULL;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		result->data = "invalid socket";
 		return SOCKET_ERROR;
@@ -895,7 +1253,7 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 static void
 setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return;
 	}
@@ -904,6 +1262,37 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 }
 
 
+static void
+setwater_socket(struct socket_server *ss, struct request_setwater *request) {
+	int id = request->id;
+	struct socket *s = get_socket(ss, id);
+	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
+		return;
+	}
+	s->high_water = request->high;
+	s->low_water = request->low;
+	s->water_policy = request->policy;
+	if (s->high_water == 0) {
+		s->blocked = false;
+	}
+}
+
+static void
+setreadsize_socket(struct socket_server *ss, struct request_setopt *request) {
+	int id = request->id;
+	struct socket *s = get_socket(ss, id);
+	if (s->type == SOCKET_TYPE_INVALID || s->id !=id || s->protocol != PROTOCOL_TCP) {
+		return;
+	}
+	int sz = request->value;
+	if (sz < MIN_READ_BUFFER) {
+		sz = MIN_READ_BUFFER;
+	} else if (sz > MAX_READ_BUFFER) {
+		sz = MAX_READ_BUFFER;
+	}
+	s->p.size = sz;
+}
+
 /* pipe */
 static void
 block_readpipe(int pipefd, void *buffer, int sz) {
@@ -962,7 +1351,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 	struct socket *ns = new_fd(ss, id, udp->fd, protocol, udp->opaque, true);
 	if (ns == NULL) {
 		close(udp->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		get_socket(ss, id)->type = SOCKET_TYPE_INVALID;
 		return;
 	}
 	ns->type = SOCKET_TYPE_CONNECTED;
@@ -972,7 +1361,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 static int
 set_udp_address(struct socket_server *ss, struct request_setudp *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = get_socket(ss, id);
 	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return -1;
 	}
@@ -1030,6 +1419,10 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 		return send_socket(ss, (struct request_send *)buffer, result, PRIORITY_HIGH, NULL);
 	case 'P':
 		return send_socket(ss, (struct request_send *)buffer, result, PRIORITY_LOW, NULL);
+	case 'G':
+		return send_socket_head(ss, (struct request_send_head *)buffer, result);
+	case 'W':
+		return broadcast_socket(ss, (struct request_broadcast *)buffer);
 	case 'A': {
 		struct request_send_udp * rsu = (struct request_send_udp *)buffer;
 		return send_socket(ss, &rsu->send, result, PRIORITY_HIGH, rsu->address);
@@ -1042,6 +1435,12 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	case 'U':
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
+	case 'H':
+		setwater_socket(ss, (struct request_setwater *)buffer);
+		return -1;
+	case 'R':
+		setreadsize_socket(ss, (struct request_setopt *)buffer);
+		return -1;
 	default:
 		fprintf(stderr, "socket-server: Unknown ctrl %c.\n",type);
 		return -1;
@@ -1084,9 +1483,15 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_me
 		return -1;
 	}
 
-	if (n == sz) {//ݶȡֵС̬ȡĴС
-		s->p.size *= 2;
-	} else if (sz > MIN_READ_BUFFER && n*2 < sz) {
+	// The read buffer grows fast when it's full (bulk transfer), and shrinks when the ewma of the read bytes is small,
+	// so a short read in a bulk transfer doesn't shrink it.
+	s->read_avg += (n - s->read_avg) / 8;
+	if (n == sz) {
+		if (sz < MAX_READ_BUFFER) {
+			sz *= 4;
+			s->p.size = sz < MAX_READ_BUFFER ? sz : MAX_READ_BUFFER;
+		}
+	} else if (sz > MIN_READ_BUFFER && s->read_avg * 4 < sz) {
 		s->p.size /= 2;
 	}
 
@@ -1115,37 +1520,61 @@ gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	return addrsz;
 }
 
+#ifdef UDP_BATCH
+
+// the next package of socket s in ss->udp, read a batch by recvmmsg when it's empty. returns the size of package
 static int
-forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_message * result) {
-	union sockaddr_all sa;
-	socklen_t slen = sizeof(sa);
-	int n = recvfrom(s->fd, ss->udpbuffer,MAX_UDP_PACKAGE,0,&sa.s,&slen);
-	if (n<0) {
-		switch(errno) {
-		case EINTR:
-		case AGAIN_WOULDBLOCK:
-			break;
-		default:
-			// close when error
-			force_close(ss, s, result);
-			result->data = strerror(errno);
-			return SOCKET_ERROR;
+read_udp(struct socket_server *ss, struct socket *s, union sockaddr_all **sa, socklen_t *slen, uint8_t **buffer) {
+	struct udp_batch *b = &ss->udp;
+	if (b->id != s->id || b->current >= b->n) {
+		int i;
+		for (i=0;i<UDP_BATCH;i++) {
+			b->msg[i].msg_hdr.msg_namelen = sizeof(union sockaddr_all);
+		}
+		b->id = s->id;
+		b->current = 0;
+		b->n = recvmmsg(s->fd, b->msg, UDP_BATCH, 0, NULL);
+		if (b->n < 0) {
+			b->n = 0;
+			return -1;
 		}
-		return -1;
 	}
-	uint8_t * data;
-	if (slen == sizeof(sa.v4)) {
+	int i = b->current++;
+	*sa = &b->addr[i];
+	*slen = b->msg[i].msg_hdr.msg_namelen;
+	*buffer = b->buffer[i];
+	return b->msg[i].msg_len;
+}
+
+#else
+
+static int
+read_udp(struct socket_server *ss, struct socket *s, union sockaddr_all **sa, socklen_t *slen, uint8_t **buffer) {
+	static union sockaddr_all addr;	// only the socket thread reads
+	*sa = &addr;
+	*slen = sizeof(addr);
+	*buffer = ss->udpbuffer;
+	return recvfrom(s->fd, ss->udpbuffer,MAX_UDP_PACKAGE,0,&addr.s,slen);
+}
+
+#endif
+
+// the package with the address appended, return -1 (ignore) when the address doesn't match the protocol
+static int
+report_udp(struct socket_server *ss, struct socket *s, struct socket_message * result, union sockaddr_all *sa, socklen_t slen, uint8_t *buffer, int n) {
+	uint8_t *data;
+	if (slen == sizeof(sa->v4)) {
 		if (s->protocol != PROTOCOL_UDP)
 			return -1;
 		data = MALLOC(n + 1 + 2 + 4);
-		gen_udp_address(PROTOCOL_UDP, &sa, data + n);
+		gen_udp_address(PROTOCOL_UDP, sa, data + n);
 	} else {
 		if (s->protocol != PROTOCOL_UDPv6)
 			return -1;
 		data = MALLOC(n + 1 + 2 + 16);
-		gen_udp_address(PROTOCOL_UDPv6, &sa, data + n);
+		gen_udp_address(PROTOCOL_UDPv6, sa, data + n);
 	}
-	memcpy(data, ss->udpbuffer, n);
+	memcpy(data, buffer, n);
 
 	result->opaque = s->opaque;
 	result->id = s->id;
@@ -1155,6 +1584,32 @@ forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_me
 	return SOCKET_UDP;
 }
 
+static int
+forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_message * result) {
+	union sockaddr_all *sa;
+	socklen_t slen;
+	uint8_t *buffer;
+	for (;;) {
+		int n = read_udp(ss, s, &sa, &slen, &buffer);
+		if (n<0) {
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				break;
+			default:
+				// close when error
+				force_close(ss, s, result);
+				result->data = strerror(errno);
+				return SOCKET_ERROR;
+			}
+			return -1;
+		}
+		int type = report_udp(ss, s, result, sa, slen, buffer, n);
+		if (type != -1)
+			return type;
+	}
+}
+
 //ӳɹ
 static int
 report_connect(struct socket_server *ss, struct socket *s, struct socket_message *result) {
@@ -1190,23 +1645,9 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_message
 	}
 }
 
-// ͻreturn 0 when failed, or -1 when file limit
+// ܿͻclient_fd, ַΪu. return 0 when failed
 static int
-report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
-	union sockaddr_all u;
-	socklen_t len = sizeof(u);
-	int client_fd = accept(s->fd, &u.s, &len);/* ͻsocket */
-	if (client_fd < 0) {
-		if (errno == EMFILE || errno == ENFILE) {
-			result->opaque = s->opaque;
-			result->id = s->id;
-			result->ud = 0;
-			result->data = strerror(errno);
-			return -1;
-		} else {
-			return 0;
-		}
-	}
+accept_client(struct socket_server *ss, struct socket *s, struct socket_message *result, int client_fd, union sockaddr_all *u) {
 	int id = reserve_id(ss);/* socketзַ */
 	if (id < 0) {
 		close(client_fd);
@@ -1220,16 +1661,21 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 		return 0;
 	}
 	ns->type = SOCKET_TYPE_PACCEPT;
+	// the water marks of listen socket are inherited
+	ns->high_water = s->high_water;
+	ns->low_water = s->low_water;
+	ns->water_policy = s->water_policy;
+	ns->p.size = s->p.size;
 	result->opaque = s->opaque;
 	result->id = s->id;
 	result->ud = id;/* ͻsocketid */
 	result->data = NULL;
 
 	/* client sockipַͶ˿ */
-	void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
-	int sin_port = ntohs((u.s.sa_family == AF_INET) ? u.v4.sin_port : u.v6.sin6_port);
+	void * sin_addr = (u->s.sa_family == AF_INET) ? (void*)&u->v4.sin_addr : (void *)&u->v6.sin6_addr;
+	int sin_port = ntohs((u->s.sa_family == AF_INET) ? u->v4.sin_port : u->v6.sin6_port);
 	char tmp[INET6_ADDRSTRLEN];
-	if (inet_ntop(u.s.sa_family, sin_addr, tmp, sizeof(tmp))) {/* ipַתΪƣ192.168.0.1ʽ */
+	if (inet_ntop(u->s.sa_family, sin_addr, tmp, sizeof(tmp))) {/* ipַתΪƣ192.168.0.1ʽ */
 		snprintf(ss->buffer, sizeof(ss->buffer), "%s:%d", tmp, sin_port);
 		result->data = ss->buffer;
 	}
@@ -1237,6 +1683,97 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	return 1;
 }
 
+static inline int
+report_accept_error(struct socket *s, struct socket_message *result, int err) {
+	if (err == EMFILE || err == ENFILE) {
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = 0;
+		result->data = strerror(err);
+		return -1;
+	}
+	return 0;
+}
+
+// ͻreturn 0 when failed, or -1 when file limit
+static int
+report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	union sockaddr_all u;
+	socklen_t len = sizeof(u);
+	int client_fd = accept(s->fd, &u.s, &len);/* ͻsocket */
+	if (client_fd < 0) {
+		return report_accept_error(s, result, errno);
+	}
+	return accept_client(ss, s, result, client_fd, &u);
+}
+
+#if defined(__linux__) && defined(USE_IO_URING)
+
+// the completion of accept, recv or recvmsg (see socket_uring.h), return -1 (ignore)
+static int
+forward_complete(struct socket_server *ss, struct socket *s, struct event *e, struct socket_message *result) {
+	switch (s->type) {
+	case SOCKET_TYPE_LISTEN: {
+		if (e->size < 0) {
+			return report_accept_error(s, result, -e->size) < 0 ? SOCKET_ERROR : -1;
+		}
+		union sockaddr_all u;
+		socklen_t len = sizeof(u);
+		if (getpeername(e->size, &u.s, &len) != 0) {
+			// reset before it's accepted
+			close(e->size);
+			return -1;
+		}
+		return accept_client(ss, s, result, e->size, &u) ? SOCKET_ACCEPT : -1;
+	}
+	case SOCKET_TYPE_CONNECTING:
+		if (e->size >= 0) {
+			// the data is received before the write event of connect
+			int type = report_connect(ss, s, result);
+			if (type == SOCKET_OPEN) {
+				// forward the data next
+				--ss->event_index;
+			}
+			return type;
+		}
+		break;
+	case SOCKET_TYPE_INVALID:
+		return -1;
+	}
+	if (e->size < 0) {
+		// close when error
+		force_close(ss, s, result);
+		result->data = strerror(-e->size);
+		return SOCKET_ERROR;
+	}
+	if (s->protocol == PROTOCOL_TCP) {
+		if (e->size == 0) {
+			force_close(ss, s, result);
+			return SOCKET_CLOSE;
+		}
+		if (s->type == SOCKET_TYPE_HALFCLOSE) {
+			// discard recv data
+			return -1;
+		}
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = e->size;
+		result->data = sp_take(ss->event_fd, e);
+		return SOCKET_DATA;
+	}
+	union sockaddr_all *sa;
+	socklen_t slen;
+	uint8_t *buffer;
+	int n = sp_udp(ss->event_fd, e, (void **)&sa, &slen, (void **)&buffer);
+	if (n < 0) {
+		// truncated
+		return -1;
+	}
+	return report_udp(ss, s, result, sa, slen, buffer, n);
+}
+
+#endif
+
 static inline void 
 clear_closed_event(struct socket_server *ss, struct socket_message * result, int type) {
 	if (type == SOCKET_CLOSE || type == SOCKET_ERROR) {
@@ -1246,9 +1783,9 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
 			struct event *e = &ss->ev[i];
 			struct socket *s = e->s;
 			if (s) {
+				// a socket may have more than one event (see socket_uring.h)
 				if (s->type == SOCKET_TYPE_INVALID && s->id == id) {
 					e->s = NULL;
-					break;
 				}
 			}
 		}
@@ -1289,6 +1826,14 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			// dispatch pipe message at beginning
 			continue;
 		}
+#if defined(__linux__) && defined(USE_IO_URING)
+		if (e->complete) {
+			int type = forward_complete(ss, s, e, result);
+			if (type == -1)
+				continue;
+			return type;
+		}
+#endif
 		switch (s->type) 
 		{
 		case SOCKET_TYPE_CONNECTING:/* client socket,ӳɹ */
@@ -1314,7 +1859,14 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 				int type;
 				if (s->protocol == PROTOCOL_TCP) 
 				{
+					int sz = s->p.size;
 					type = forward_message_tcp(ss, s, result);//ִ
+					if (type == SOCKET_DATA && result->ud == sz && ++ss->read_loop < MAX_READ_LOOP) {
+						// The buffer is full, read again before the next event. (A short read means EAGAIN next time)
+						--ss->event_index;
+						return SOCKET_DATA;
+					}
+					ss->read_loop = 0;
 				} 
 				else 
 				{
@@ -1336,8 +1888,11 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			}
 			if (e->write) {
 				int type = send_buffer(ss, s, result);
-				if (type == -1)
-					break;
+				if (type == -1) {
+					type = check_water(ss, s, result);
+					if (type == -1)
+						break;
+				}
 				return type;
 			}
 			break;
@@ -1408,7 +1963,7 @@ free_buffer(struct socket_server *ss, const void * buffer, int sz) {
 // ݣʹpipe D return -1 when error
 int64_t 
 socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
@@ -1423,9 +1978,48 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 	return s->wb_size;
 }
 
+int64_t
+socket_server_send_head(struct socket_server *ss, int id, const void * head, int hsz, const void * buffer, int sz) {
+	assert(hsz > 0 && hsz <= SOCKET_HEAD_MAX);
+	struct socket * s = get_socket(ss, id);
+	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
+		free_buffer(ss, buffer, sz);
+		return -1;
+	}
+
+	struct request_package request;
+	request.u.send_head.send.id = id;
+	request.u.send_head.send.sz = sz;
+	request.u.send_head.send.buffer = (char *)buffer;
+	request.u.send_head.hsz = hsz;
+	memcpy(request.u.send_head.head, head, hsz);
+
+	send_request(ss, &request, 'G', offsetof(struct request_send_head, head) + hsz);
+	return s->wb_size;
+}
+
+// send the buffer to n sockets with one request, the buffer is freed after the last write.
+void
+socket_server_broadcast(struct socket_server *ss, const int *ids, int n, const void * buffer, int sz) {
+	if (n <= 0) {
+		FREE((void *)buffer);
+		return;
+	}
+	struct socket_broadcast * b = MALLOC(sizeof(*b) + (n-1) * sizeof(int));
+	b->ref = 1;
+	b->sz = sz;
+	b->buffer = (void *)buffer;
+	b->n = n;
+	memcpy(b->id, ids, n * sizeof(int));
+
+	struct request_package request;
+	request.u.broadcast.broadcast = b;
+	send_request(ss, &request, 'W', sizeof(request.u.broadcast));
+}
+
 void 
 socket_server_send_lowpriority(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return;
@@ -1582,6 +2176,34 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	send_request(ss, &request, 'T', sizeof(request.u.setopt));
 }
 
+void
+socket_server_setwater(struct socket_server *ss, int id, int high, int low, int policy) {
+	struct request_package request;
+	request.u.setwater.id = id;
+	request.u.setwater.high = high;
+	request.u.setwater.low = low < high ? low : high;
+	request.u.setwater.policy = policy;
+	send_request(ss, &request, 'H', sizeof(request.u.setwater));
+}
+
+void
+socket_server_readsize(struct socket_server *ss, int id, int sz) {
+	struct request_package request;
+	request.u.setopt.id = id;
+	request.u.setopt.what = 0;
+	request.u.setopt.value = sz;
+	send_request(ss, &request, 'R', sizeof(request.u.setopt));
+}
+
+int
+socket_server_writable(struct socket_server *ss, int id) {
+	struct socket * s = get_socket(ss, id);
+	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
+		return 0;
+	}
+	return !s->blocked;
+}
+
 void 
 socket_server_userobject(struct socket_server *ss, struct socket_object_interface *soi) {
 	ss->soi = *soi;
@@ -1625,7 +2247,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 
 int64_t 
 socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp_address *addr, const void *buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
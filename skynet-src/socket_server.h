@@ -10,6 +10,14 @@
 #define SOCKET_ERROR 4
 #define SOCKET_EXIT 5
 #define SOCKET_UDP 6
+#define SOCKET_WARNING 7
+
+// policy when the send buffer of a socket reaches the high water mark
+#define SOCKET_WATER_DROP 0	// drop the low priority packages until it drains below the low water mark
+#define SOCKET_WATER_CLOSE 1	// close the socket
+#define SOCKET_WATER_PAUSE 2	// only report it, the producer should pause
+
+#define SOCKET_HEAD_MAX 32
 
 struct socket_server;
 
@@ -33,6 +41,10 @@ void socket_server_start(struct socket_server *, uintptr_t opaque, int id);
 // return -1 when error
 int64_t socket_server_send(struct socket_server *, int id, const void * buffer, int sz);
 void socket_server_send_lowpriority(struct socket_server *, int id, const void * buffer, int sz);
+// tcp only, send a small head (copied, 1 ~ SOCKET_HEAD_MAX bytes) and then the buffer without copying it into one package.
+int64_t socket_server_send_head(struct socket_server *, int id, const void * head, int hsz, const void * buffer, int sz);
+// send one buffer (can't be user object) to n tcp sockets, the buffer is shared by them
+void socket_server_broadcast(struct socket_server *, const int *ids, int n, const void * buffer, int sz);
 
 // ctrl command below returns id
 int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
@@ -41,6 +53,14 @@ int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
 
 // for tcp
 void socket_server_nodelay(struct socket_server *, int id);
+// the read buffer size of a tcp socket adapts to the traffic, it sets the current size (the initial size of the accepted sockets for listen socket).
+void socket_server_readsize(struct socket_server *, int id, int sz);
+
+// set the water marks (in bytes) of send buffer, high == 0 means no limit. The sockets accepted by a listen socket inherit them.
+// SOCKET_WARNING reports (ud is K bytes) when the socket is blocked, and (ud is 0) when it drains below low water mark.
+void socket_server_setwater(struct socket_server *, int id, int high, int low, int policy);
+// it's cheap and can be called in any thread, returns 0 when the socket is blocked or closed.
+int socket_server_writable(struct socket_server *, int id);
 
 struct socket_udp_address;
 
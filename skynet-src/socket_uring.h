@@ -0,0 +1,610 @@
+#ifndef poll_socket_uring_h
+#define poll_socket_uring_h
+
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+
+/*
+	io_uring backend, build with SKYNET_DEFINES=-DUSE_IO_URING (linux 6.0+).
+
+	The sockets are read by the kernel : multishot recv (tcp), multishot recvmsg (udp) and multishot accept (listen),
+	the data is received into a ring of provided buffers. A completion is reported as an event with complete set
+	(See struct event in socket_poll.h), and socket_server takes the data by sp_take/sp_udp instead of read,
+	recvmmsg or accept. The buffers of the events are given back to the ring in the next sp_wait.
+	A large tcp package takes the buffer itself (the ring gets a new one), a small one is copied.
+
+	The writes are done by socket_server as before, the write readiness is reported by one shot poll, which is
+	armed again before the next wait while the write flag is set. The fds which are not sockets (ie. the pipe of
+	socket_server) are polled for reading as well, and the events are the same as socket_epoll.h .
+
+	The operations finished (ie. no buffer in the ring) are armed again before the next io_uring_enter.
+	The changes are queued in the submission ring and submitted by the io_uring_enter which waits the events.
+	sp_del submits at once, because the socket will be closed after it.
+ */
+
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 256	// the size of buffer ring, power of 2
+#define URING_BUFFER_SIZE (64 * 1024 + 64)	// a udp package with the header of recvmsg
+#define URING_GROUP 0
+#define URING_IGNORE (~(uint64_t)0)
+
+// the modes of socket, and the operations in user_data
+#define URING_OP_POLL 0	// readiness of the fd which is not a socket
+#define URING_OP_RECV 1
+#define URING_OP_RECVMSG 2
+#define URING_OP_ACCEPT 3
+#define URING_OP_WRITE 4	// write readiness of the socket read by completions
+
+#define URING_GEN_MASK ((1u << 29) - 1)
+
+struct uring_socket {
+	void * ud;
+	uint32_t gen;	// the completions of the operations before sp_del are discarded
+	uint32_t events;	// POLLIN | POLLOUT (when write enabled), for URING_OP_POLL
+	uint8_t mode;
+	bool used;
+	bool write;	// write flag of sp_write
+	bool reading;	// the poll (URING_OP_POLL) or the multishot read is armed
+	bool writing;	// the write poll is armed
+	bool eof;	// the multishot read is finished by eof or error, don't arm it again
+	bool rearm;	// in the rearm list
+};
+
+struct uring_poll {
+	int fd;
+	unsigned to_submit;
+	// submission ring
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	// completion ring
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void * sq_ptr;
+	size_t sq_sz;
+	void * cq_ptr;
+	size_t cq_sz;
+	size_t sqes_sz;
+	// provided buffers
+	struct io_uring_buf_ring *br;
+	size_t br_sz;
+	unsigned short br_tail;
+	char * buffer[URING_BUFFERS];	// by buffer id, NULL if it's taken by socket_server
+	int handout[URING_BUFFERS];	// the buffers of the events returned by the last sp_wait
+	int handout_n;
+	struct msghdr msg;	// the template of udp recvmsg
+	// sockets indexed by fd
+	struct uring_socket * s;
+	int cap;
+	// the sockets need arm again
+	int * rearm;
+	int rearm_n;
+};
+
+static int
+uring_enter(struct uring_poll *u, unsigned submit, unsigned wait) {
+	return (int)syscall(__NR_io_uring_enter, u->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void
+uring_submit(struct uring_poll *u) {
+	while (u->to_submit > 0) {
+		int n = uring_enter(u, u->to_submit, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			// EBUSY : the completion ring is full, they will be submitted in sp_wait
+			return;
+		}
+		u->to_submit -= n;
+	}
+}
+
+static struct io_uring_sqe *
+uring_sqe(struct uring_poll *u, int op, int fd, uint64_t user_data) {
+	unsigned tail = *u->sq_tail;
+	if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+		uring_submit(u);
+	}
+	unsigned index = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+	u->sq_array[index] = index;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++u->to_submit;
+	return sqe;
+}
+
+static inline uint64_t
+uring_userdata(int sock, int op, uint32_t gen) {
+	return (uint64_t)(gen & URING_GEN_MASK) << 35 | (uint64_t)op << 32 | (uint32_t)sock;
+}
+
+static void
+uring_arm_read(struct uring_poll *u, int sock) {
+	struct uring_socket *s = &u->s[sock];
+	uint64_t ud = uring_userdata(sock, s->mode, s->gen);
+	struct io_uring_sqe *sqe;
+	s->reading = true;
+	switch (s->mode) {
+	case URING_OP_POLL:
+		sqe = uring_sqe(u, IORING_OP_POLL_ADD, sock, ud);
+		sqe->poll32_events = s->events;
+		break;
+	case URING_OP_ACCEPT:
+		sqe = uring_sqe(u, IORING_OP_ACCEPT, sock, ud);
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_NONBLOCK;
+		break;
+	case URING_OP_RECV:
+		sqe = uring_sqe(u, IORING_OP_RECV, sock, ud);
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_GROUP;
+		break;
+	case URING_OP_RECVMSG:
+		sqe = uring_sqe(u, IORING_OP_RECVMSG, sock, ud);
+		sqe->addr = (uint64_t)(uintptr_t)&u->msg;
+		sqe->len = 1;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_GROUP;
+		break;
+	}
+}
+
+static void
+uring_arm_write(struct uring_poll *u, int sock) {
+	struct uring_socket *s = &u->s[sock];
+	s->writing = true;
+	struct io_uring_sqe *sqe = uring_sqe(u, IORING_OP_POLL_ADD, sock, uring_userdata(sock, URING_OP_WRITE, s->gen));
+	sqe->poll32_events = POLLOUT;
+}
+
+static void
+uring_cancel(struct uring_poll *u, int sock, int op) {
+	struct uring_socket *s = &u->s[sock];
+	struct io_uring_sqe *sqe = uring_sqe(u, IORING_OP_ASYNC_CANCEL, -1, URING_IGNORE);
+	sqe->addr = uring_userdata(sock, op, s->gen);
+}
+
+static void
+uring_rearm(struct uring_poll *u, int sock) {
+	struct uring_socket *s = &u->s[sock];
+	if (!s->rearm) {
+		s->rearm = true;
+		u->rearm[u->rearm_n++] = sock;
+	}
+}
+
+// give the buffer back to the ring, the tail is published in sp_wait
+static void
+uring_recycle(struct uring_poll *u, int bid) {
+	char * buffer = u->buffer[bid];
+	if (buffer == NULL) {
+		buffer = skynet_malloc(URING_BUFFER_SIZE);
+		u->buffer[bid] = buffer;
+	}
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (URING_BUFFERS - 1)];
+	b->addr = (uint64_t)(uintptr_t)buffer;
+	b->len = URING_BUFFER_SIZE;
+	b->bid = bid;
+	++u->br_tail;
+}
+
+static inline void
+uring_publish(struct uring_poll *u) {
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+// the socket type decides how it's read
+static int
+uring_mode(int sock) {
+	int type;
+	socklen_t len = sizeof(type);
+	if (getsockopt(sock, SOL_SOCKET, SO_TYPE, &type, &len) != 0) {
+		return URING_OP_POLL;	// not a socket, ie. a pipe
+	}
+	if (type == SOCK_DGRAM) {
+		return URING_OP_RECVMSG;
+	}
+	if (type != SOCK_STREAM) {
+		return URING_OP_POLL;
+	}
+	int listen = 0;
+	len = sizeof(listen);
+	if (getsockopt(sock, SOL_SOCKET, SO_ACCEPTCONN, &listen, &len) == 0 && listen) {
+		return URING_OP_ACCEPT;
+	}
+	return URING_OP_RECV;
+}
+
+static bool
+sp_invalid(poll_fd u) {
+	return u == NULL;
+}
+
+static void
+sp_release(poll_fd u) {
+	int i;
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_sz);
+	if (u->cq_ptr && u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_sz);
+	if (u->sq_ptr)
+		munmap(u->sq_ptr, u->sq_sz);
+	// the buffer ring is unregistered by closing
+	close(u->fd);
+	if (u->br)
+		munmap(u->br, u->br_sz);
+	for (i=0;i<URING_BUFFERS;i++) {
+		skynet_free(u->buffer[i]);
+	}
+	free(u->s);
+	free(u->rearm);
+	free(u);
+}
+
+static int
+uring_setup(struct io_uring_params *p) {
+	memset(p, 0, sizeof(*p));
+	// the task work runs when the socket thread enters the ring, no interrupt for it
+	p->flags = IORING_SETUP_COOP_TASKRUN;
+	int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, p);
+	if (fd < 0 && errno == EINVAL) {
+		memset(p, 0, sizeof(*p));
+		fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, p);
+	}
+	return fd;
+}
+
+static poll_fd
+sp_create() {
+	struct io_uring_params p;
+	int fd = uring_setup(&p);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct uring_poll *u = malloc(sizeof(*u));
+	memset(u, 0, sizeof(*u));
+	u->fd = fd;
+	u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_sz > u->sq_sz)
+			u->sq_sz = u->cq_sz;
+		u->cq_sz = u->sq_sz;
+	}
+	u->sq_ptr = mmap(NULL, u->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED) {
+		u->sq_ptr = NULL;
+		goto _failed;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ptr = u->sq_ptr;
+	} else {
+		u->cq_ptr = mmap(NULL, u->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (u->cq_ptr == MAP_FAILED) {
+			u->cq_ptr = NULL;
+			goto _failed;
+		}
+	}
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		goto _failed;
+	}
+	char *sq = u->sq_ptr;
+	u->sq_head = (unsigned *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(sq + p.sq_off.array);
+	u->sq_entries = p.sq_entries;
+	char *cq = u->cq_ptr;
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	// the ring of provided buffers
+	u->br_sz = URING_BUFFERS * sizeof(struct io_uring_buf);
+	u->br = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (u->br == MAP_FAILED) {
+		u->br = NULL;
+		goto _failed;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+	reg.ring_entries = URING_BUFFERS;
+	reg.bgid = URING_GROUP;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		goto _failed;
+	}
+	int i;
+	for (i=0;i<URING_BUFFERS;i++) {
+		uring_recycle(u, i);
+	}
+	uring_publish(u);
+	u->msg.msg_namelen = sizeof(struct sockaddr_in6);
+	return u;
+_failed:
+	sp_release(u);
+	return NULL;
+}
+
+static int
+sp_add(poll_fd u, int sock, void *ud) {
+	if (sock >= u->cap) {
+		int cap = u->cap ? u->cap : 1024;
+		while (cap <= sock)
+			cap *= 2;
+		struct uring_socket *s = realloc(u->s, cap * sizeof(*s));
+		int *rearm = realloc(u->rearm, cap * sizeof(int));
+		if (s == NULL || rearm == NULL) {
+			if (s) u->s = s;
+			if (rearm) u->rearm = rearm;
+			return 1;
+		}
+		memset(s + u->cap, 0, (cap - u->cap) * sizeof(*s));
+		u->s = s;
+		u->rearm = rearm;
+		u->cap = cap;
+	}
+	struct uring_socket *s = &u->s[sock];
+	if (s->used) {
+		return 1;
+	}
+	s->used = true;
+	s->ud = ud;
+	s->mode = uring_mode(sock);
+	s->events = POLLIN;
+	s->write = false;
+	s->reading = false;
+	s->writing = false;
+	s->eof = false;
+	s->gen = (s->gen + 1) & URING_GEN_MASK;
+	uring_arm_read(u, sock);
+	return 0;
+}
+
+static void
+sp_del(poll_fd u, int sock) {
+	if (sock >= u->cap || !u->s[sock].used)
+		return;
+	struct uring_socket *s = &u->s[sock];
+	if (s->reading) {
+		uring_cancel(u, sock, s->mode);
+		s->reading = false;
+	}
+	if (s->writing) {
+		uring_cancel(u, sock, URING_OP_WRITE);
+		s->writing = false;
+	}
+	s->used = false;
+	s->gen = (s->gen + 1) & URING_GEN_MASK;
+	// the operations keep a reference of the file, cancel them before the socket is closed
+	uring_submit(u);
+}
+
+static void
+sp_write(poll_fd u, int sock, void *ud, bool enable) {
+	if (sock >= u->cap || !u->s[sock].used)
+		return;
+	struct uring_socket *s = &u->s[sock];
+	s->ud = ud;
+	if (s->mode == URING_OP_POLL) {
+		uint32_t events = POLLIN | (enable ? POLLOUT : 0);
+		if (s->events == events)
+			return;
+		s->events = events;
+		if (s->reading) {
+			uring_cancel(u, sock, URING_OP_POLL);
+			s->gen = (s->gen + 1) & URING_GEN_MASK;
+			uring_arm_read(u, sock);
+		}
+		// or it will be armed with the new events in sp_wait
+		return;
+	}
+	s->write = enable;
+	// a write poll armed before is ignored when it's disabled (see sp_wait)
+	if (enable && !s->writing) {
+		uring_arm_write(u, sock);
+	}
+}
+
+/*
+	The data of event e (tcp), the caller owns it and frees it by skynet_free.
+	The buffer is taken if it's large, and the ring gets a new one.
+ */
+static char *
+sp_take(poll_fd u, struct event *e) {
+	int sz = e->size;
+	if (sz * 2 >= URING_BUFFER_SIZE) {
+		u->buffer[e->buffer] = NULL;
+		return e->data;
+	}
+	char * data = skynet_malloc(sz);
+	memcpy(data, e->data, sz);
+	return data;
+}
+
+/*
+	The package of event e (udp), valid until the next sp_wait.
+	Returns the size of package (-1 if it's truncated), the address is in addr (addrlen bytes).
+ */
+static int
+sp_udp(poll_fd u, struct event *e, void **addr, socklen_t *addrlen, void **payload) {
+	struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)e->data;
+	char * name = (char *)(out + 1);
+	*addr = name;
+	*addrlen = out->namelen;
+	*payload = name + u->msg.msg_namelen + u->msg.msg_controllen;
+	if (out->flags & MSG_TRUNC) {
+		return -1;
+	}
+	return (int)out->payloadlen;
+}
+
+// give the buffers of the last events back, and arm the operations finished
+static void
+uring_prepare(struct uring_poll *u) {
+	int i;
+	if (u->handout_n > 0) {
+		for (i=0;i<u->handout_n;i++) {
+			uring_recycle(u, u->handout[i]);
+		}
+		u->handout_n = 0;
+		uring_publish(u);
+	}
+	for (i=0;i<u->rearm_n;i++) {
+		int sock = u->rearm[i];
+		struct uring_socket *s = &u->s[sock];
+		s->rearm = false;
+		if (!s->used)
+			continue;
+		if (!s->reading && !s->eof) {
+			uring_arm_read(u, sock);
+		}
+		if (s->write && !s->writing) {
+			uring_arm_write(u, sock);
+		}
+	}
+	u->rearm_n = 0;
+}
+
+static int
+sp_wait(poll_fd u, struct event *e, int max) {
+	int n = 0;
+	uring_prepare(u);
+	while (n == 0) {
+		unsigned head = *u->cq_head;
+		unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			// no event in the completions reaped, ie. stale or no buffer
+			uring_prepare(u);
+			int r = uring_enter(u, u->to_submit, 1);
+			if (r < 0) {
+				if (errno == EBUSY || errno == EINTR) {
+					// the completion ring is full, reap it first
+					r = 0;
+				} else {
+					return -1;
+				}
+			}
+			u->to_submit -= r;
+			continue;
+		}
+		while (head != tail && n < max) {
+			struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+			++head;
+			if (cqe->user_data == URING_IGNORE)
+				continue;
+			int sock = (int)(uint32_t)cqe->user_data;
+			int op = (int)(cqe->user_data >> 32) & 7;
+			uint32_t gen = (uint32_t)(cqe->user_data >> 35);
+			int res = cqe->res;
+			int bid = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+			if (bid >= 0) {
+				// recycled in the next sp_wait, or when the ring is empty
+				u->handout[u->handout_n++] = bid;
+			}
+			struct uring_socket *s = sock < u->cap ? &u->s[sock] : NULL;
+			if (s == NULL || !s->used || s->gen != gen) {
+				// removed
+				if (op == URING_OP_ACCEPT && res >= 0) {
+					close(res);
+				}
+				continue;
+			}
+			if (op == URING_OP_POLL) {
+				s->reading = false;
+				uring_rearm(u, sock);
+				int flag = res;
+				if (flag < 0) {
+					// let the socket find the error by read or write
+					flag = POLLERR;
+				}
+				if (flag & (POLLERR | POLLHUP)) {
+					flag |= s->events;
+				}
+				e[n].s = s->ud;
+				e[n].read = (flag & POLLIN) != 0;
+				e[n].write = (flag & POLLOUT) != 0;
+				e[n].complete = false;
+				++n;
+				continue;
+			}
+			if (op == URING_OP_WRITE) {
+				s->writing = false;
+				if (s->write) {
+					uring_rearm(u, sock);
+					e[n].s = s->ud;
+					e[n].read = false;
+					e[n].write = true;
+					e[n].complete = false;
+					++n;
+				}
+				continue;
+			}
+			bool retry = res == -ENOBUFS || res == -EAGAIN || res == -EINTR || res == -ECANCELED;
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				// the multishot operation is finished
+				s->reading = false;
+				if (op == URING_OP_RECV && res <= 0 && !retry) {
+					// eof or error, the socket will be closed
+					s->eof = true;
+				}
+				uring_rearm(u, sock);
+			}
+			if (retry) {
+				// ie. no buffer in ring, it's armed again after the buffers are given back
+				continue;
+			}
+			e[n].s = s->ud;
+			e[n].read = true;
+			e[n].write = false;
+			e[n].complete = true;
+			e[n].size = res;
+			e[n].buffer = bid;
+			e[n].data = bid >= 0 ? u->buffer[bid] : NULL;
+			++n;
+		}
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return n;
+}
+
+static void
+sp_nonblocking(int fd) {
+	int flag = fcntl(fd, F_GETFL, 0);
+	if ( -1 == flag ) {
+		return;
+	}
+
+	fcntl(fd, F_SETFL, flag | O_NONBLOCK);
+}
+
+#endif
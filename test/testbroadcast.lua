@@ -0,0 +1,82 @@
+local skynet = require "skynet"
+local socket = require "socket"
+
+-- socket.broadcast vs socket.write in a loop : N connections, ROUND messages of SIZE bytes.
+-- The clients run in another service and count the bytes they receive.
+
+local mode, count, size = ...
+
+local PORT = 8004
+local ROUND = 100
+
+if mode == "CLIENT" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, n, total)
+		local fds = {}
+		for i = 1, n do
+			fds[i] = assert(socket.open("127.0.0.1", PORT))
+		end
+		skynet.ret(skynet.pack(true))
+		local done = 0
+		local co = coroutine.running()
+		for _, fd in ipairs(fds) do
+			skynet.fork(function()
+				local ok = socket.read(fd, total)
+				assert(ok, "broadcast lost")
+				done = done + 1
+				if done == n then
+					skynet.wakeup(co)
+				end
+			end)
+		end
+		skynet.wait()
+		for _, fd in ipairs(fds) do
+			socket.close(fd)
+		end
+	end)
+end)
+
+else
+
+local N = tonumber(mode) or 1000
+local SIZE = tonumber(count) or 64
+
+local function run(name, send)
+	local fds = {}
+	local listen = socket.listen("127.0.0.1", PORT)
+	socket.start(listen, function(fd)
+		socket.start(fd)
+		table.insert(fds, fd)
+	end)
+	local client = skynet.newservice(SERVICE_NAME, "CLIENT")
+	skynet.call(client, "lua", N, ROUND * SIZE)
+	while #fds < N do
+		skynet.sleep(1)
+	end
+	socket.close(listen)
+	local msg = string.rep("x", SIZE)
+	local start_time = skynet.now()
+	for i = 1, ROUND do
+		send(fds, msg)
+	end
+	-- wait for the clients closing the connections after receiving all the data
+	for _, fd in ipairs(fds) do
+		socket.read(fd)
+		socket.close(fd)
+	end
+	local ti = (skynet.now() - start_time) / 100
+	print(string.format("%s : %d connections, %d x %d bytes, %.2fs", name, N, ROUND, SIZE, ti))
+end
+
+skynet.start(function()
+	run("write", function(fds, msg)
+		for _, fd in ipairs(fds) do
+			socket.write(fd, msg)
+		end
+	end)
+	run("broadcast", socket.broadcast)
+	skynet.exit()
+end)
+
+end
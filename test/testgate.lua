@@ -0,0 +1,112 @@
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"	-- import skynet.launch
+
+-- Benchmark of service_gate : packets/sec with N connections (default 10000).
+-- Make sure the limit of open files (ulimit -n) is more than 2*N.
+-- testgate N BATCH [server|client] : run the gate and the clients in two processes,
+-- otherwise the clients share the socket thread with gate.
+
+local mode, count, role = ...
+
+local PORT = 8003
+local PACKET = string.pack(">s2", string.rep("x", 64))
+local ROUND = 100
+
+if mode == "CLIENT" then
+
+local fds = {}
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, n)
+		if cmd == "connect" then
+			for i = 1, n do
+				fds[i] = assert(socket.open("127.0.0.1", PORT))
+				if i % 100 == 0 then
+					skynet.yield()
+				end
+			end
+			skynet.ret(skynet.pack(n))
+		elseif cmd == "run" then
+			-- n packets per write, ROUND writes per connection
+			local data = string.rep(PACKET, n)
+			for i = 1, ROUND do
+				for _, fd in ipairs(fds) do
+					socket.write(fd, data)
+				end
+				skynet.yield()
+			end
+			skynet.ret(skynet.pack(true))
+		end
+	end)
+end)
+
+else
+
+local N = tonumber(mode) or 10000	-- connections
+local BATCH = tonumber(count) or 1	-- packets per write
+local CLIENT = 10
+
+local gate
+local packets = 0
+local total
+local start_time
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(...) return table.concat({...}, " ") end,
+	unpack = skynet.tostring,
+}
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function(msg, sz) return sz end,
+}
+
+local function server()
+	skynet.dispatch("text", function(_,_, msg)
+		local id, cmd = msg:match "^(%d+) (%a+)"
+		if cmd == "open" then
+			skynet.send(gate, "text", "start", id)
+		end
+	end)
+	skynet.dispatch("client", function()
+		packets = packets + 1
+		if packets == 1 then
+			start_time = skynet.now()
+		elseif packets == total then
+			local ti = (skynet.now() - start_time) / 100
+			print(string.format("%d packets in %.2fs, %.0f packets/sec", total, ti, total / ti))
+			skynet.abort()
+		end
+	end)
+	-- gate : header watchdog address client_tag max_connection
+	gate = skynet.launch("gate", "S", skynet.address(skynet.self()), "127.0.0.1:" .. PORT, skynet.PTYPE_CLIENT, N + 64)
+	skynet.send(gate, "text", "broker", skynet.address(skynet.self()))
+end
+
+local function client()
+	local clients = {}
+	for i = 1, CLIENT do
+		clients[i] = skynet.newservice(SERVICE_NAME, "CLIENT")
+		skynet.call(clients[i], "lua", "connect", N // CLIENT)
+	end
+	print(N // CLIENT * CLIENT .. " connections", BATCH .. " packets per write")
+	for i = 1, CLIENT do
+		skynet.fork(skynet.call, clients[i], "lua", "run", BATCH)
+	end
+end
+
+skynet.start(function()
+	total = N // CLIENT * CLIENT * ROUND * BATCH
+	if role ~= "client" then
+		server()
+	end
+	if role ~= "server" then
+		client()
+	end
+end)
+
+end
@@ -0,0 +1,58 @@
+local skynet = require "skynet"
+local harbor = require "skynet.harbor"
+require "skynet.manager"	-- import skynet.register and skynet.abort
+
+-- Messages through harbor, run two nodes (see examples/config) :
+-- node 2 : testharbor sink
+-- node 1 : testharbor [N] [size]
+-- Node 1 sends some messages by name before node 2 starts, then N messages of size bytes and measures the rate.
+
+local mode, size = ...
+
+if mode == "sink" then
+
+local count = 0
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, data)
+		if cmd == "push" then
+			count = count + 1
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count))
+		elseif cmd == "echo" then
+			skynet.ret(skynet.pack(data))
+		end
+	end)
+	skynet.register "HARBORSINK"
+end)
+
+else
+
+local N = tonumber(mode) or 100000
+local SIZE = tonumber(size) or 64
+local QUEUED = 1000
+
+skynet.start(function()
+	-- queued by name until the sink registers it
+	for i = 1, QUEUED do
+		skynet.send("HARBORSINK", "lua", "push")
+	end
+	print("wait for harbor 2")
+	local sink = harbor.queryname "HARBORSINK"
+	assert(skynet.call(sink, "lua", "count") == QUEUED)
+	for _, sz in ipairs { 0, 1, 4096, 65536, 1024 * 1024 } do
+		local data = string.rep("x", sz)
+		assert(skynet.call(sink, "lua", "echo", data) == data)
+	end
+	local data = string.rep("x", SIZE)
+	local start_time = skynet.now()
+	for i = 1, N do
+		skynet.send(sink, "lua", "push", data)
+	end
+	assert(skynet.call(sink, "lua", "count") == QUEUED + N)
+	local ti = (skynet.now() - start_time) / 100
+	print(string.format("harbor : %d messages of %d bytes in %.2fs, %.0f/s", N, SIZE, ti, N / ti))
+	skynet.abort()
+end)
+
+end
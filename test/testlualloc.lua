@@ -0,0 +1,60 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.kill
+
+-- Run it with lualloc = "pool" and without it in config to compare
+
+local mode, count = ...
+
+if mode == "AGENT" then
+
+local function churn(n)
+	local t = {}
+	for i = 1, n do
+		t[i % 64 + 1] = { i, tostring(i), function() return i end }
+	end
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, n)
+		churn(n)
+		skynet.ret(skynet.pack(collectgarbage "count"))
+	end)
+end)
+
+else
+
+local N = tonumber(mode) or 10000	-- agents
+local LOOP = 1000	-- objects per agent
+
+local function rss()
+	local f = io.open "/proc/self/statm"
+	if f then
+		local pages = f:read "n" and f:read "n"
+		f:close()
+		return string.format("%.2fM", pages * 4096 / (1024 * 1024))
+	end
+	return "unknown"
+end
+
+skynet.start(function()
+	print("lualloc", skynet.getenv "lualloc" or "default", "RSS", rss())
+	local agents = {}
+	for i = 1, N do
+		agents[i] = skynet.newservice(SERVICE_NAME, "AGENT")
+	end
+	print(N .. " agents", "RSS", rss())
+	local t = skynet.now()
+	local mem = 0
+	for i = 1, N do
+		mem = mem + skynet.call(agents[i], "lua", LOOP)
+	end
+	local ti = (skynet.now() - t) / 100
+	-- each loop allocates a table, a string, a closure and an array part
+	print(string.format("%.0f allocs/sec", N * LOOP * 4 / ti), "lua mem", string.format("%.2fM", mem / 1024), "RSS", rss())
+	for i = 1, N do
+		skynet.kill(agents[i])
+	end
+	skynet.exit()
+end)
+
+end
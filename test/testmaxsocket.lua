@@ -0,0 +1,65 @@
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"	-- import skynet.abort
+
+-- Open N tcp connections (2N sockets) in one process, more than a page of the socket slot table.
+-- Make sure the limit of open files (ulimit -n) is more than 2*N.
+
+local N = tonumber((...)) or 8000
+local PORT = 8007
+
+local function round(r)
+	local accepted = {}
+	local n = 0
+	local listen = socket.listen("127.0.0.1", PORT)
+	socket.start(listen, function(fd)
+		accepted[fd] = true
+		n = n + 1
+	end)
+	local fds = {}
+	local ids = {}
+	local start_time = skynet.now()
+	for i = 1, N do
+		local fd = assert(socket.open("127.0.0.1", PORT))
+		assert(not ids[fd], "duplicate id")
+		ids[fd] = true
+		fds[i] = fd
+	end
+	while n < N do
+		skynet.sleep(1)
+	end
+	socket.close(listen)
+	local ti = (skynet.now() - start_time) / 100
+	local max = 0
+	for fd in pairs(accepted) do
+		assert(not ids[fd], "duplicate id")
+		if fd > max then
+			max = fd
+		end
+	end
+	print(string.format("round %d : %d connections in %.2fs, max id %d", r, N, ti, max))
+
+	-- one package through each connection
+	for fd in pairs(accepted) do
+		socket.start(fd)
+	end
+	for i, fd in ipairs(fds) do
+		socket.write(fd, string.pack(">I4", i))
+	end
+	local sum = 0
+	for fd in pairs(accepted) do
+		sum = sum + string.unpack(">I4", socket.read(fd, 4))
+		socket.close(fd)
+	end
+	assert(sum == N * (N + 1) // 2)
+	for _, fd in ipairs(fds) do
+		socket.close(fd)
+	end
+end
+
+skynet.start(function()
+	round(1)
+	round(2)
+	print("test max socket ok")
+	skynet.abort()
+end)
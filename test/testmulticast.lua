@@ -2,7 +2,9 @@ local skynet = require "skynet"
 local mc = require "multicast"
 local dc = require "datacenter"
 
-local mode = ...
+-- testmulticast bench [publishes] [max subscribers] : the latency of publish and delivery to N subscribers
+
+local mode, arg1, arg2 = ...
 
 if mode == "sub" then
 
@@ -21,6 +23,73 @@ skynet.start(function()
 	end)
 end)
 
+elseif mode == "benchsub" then
+
+skynet.start(function()
+	local channels = {}
+	skynet.dispatch("lua", function (_,_, channel, n, publisher)
+		local count = 0
+		local c = mc.new {
+			channel = channel,
+			dispatch = function (channel, source, i)
+				count = count + 1
+				if count == n then
+					channel:unsubscribe()
+					skynet.send(publisher, "lua", "done")
+				end
+			end
+		}
+		c:subscribe()
+		channels[channel] = c
+		skynet.ret()
+	end)
+end)
+
+elseif mode == "bench" then
+
+skynet.start(function()
+	local n = tonumber(arg1) or 1000
+	local max = tonumber(arg2) or 1000
+	local subs = {}
+	local done = 0
+	local co
+	skynet.dispatch("lua", function(_,_, cmd)
+		assert(cmd == "done")
+		done = done + 1
+		if done == #subs and co then
+			skynet.wakeup(co)
+		end
+	end)
+	local count = 1
+	while count <= max do
+		while #subs < count do
+			table.insert(subs, skynet.newservice(SERVICE_NAME, "benchsub"))
+		end
+		local channel = mc.new()
+		for _, sub in ipairs(subs) do
+			skynet.call(sub, "lua", channel.channel, n, skynet.self())
+		end
+		done = 0
+		co = coroutine.running()
+		local start_time = skynet.now()
+		for i = 1, n do
+			channel:publish(i)
+		end
+		local publish_time = skynet.now()
+		if done < #subs then
+			skynet.wait()
+		end
+		co = nil
+		local end_time = skynet.now()
+		print(string.format("%4d subscribers : %d publishes, %.1f us per publish, all delivered in %.1f us per message",
+			count, n, (publish_time - start_time) * 10000 / n, (end_time - start_time) * 10000 / n))
+		channel:delete()
+		count = count * 10
+	end
+	require "skynet.manager"
+	skynet.abort()
+end)
+
 else
 
 skynet.start(function()
@@ -0,0 +1,60 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.kill
+
+local mode = ...
+
+if mode == "AGENT" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd)
+		if cmd == "exit" then
+			skynet.exit()
+		else
+			skynet.ret(skynet.pack(cmd))
+		end
+	end)
+end)
+
+else
+
+local N = 200
+
+local function launch(tag)
+	local t = skynet.now()
+	local list = {}
+	for i = 1, N do
+		list[i] = skynet.newservice(SERVICE_NAME, "AGENT")
+		assert(skynet.call(list[i], "lua", i) == i)
+	end
+	print(tag, N .. " launch", (skynet.now() - t) * 10 .. " ms")
+	for _, agent in ipairs(list) do
+		skynet.send(agent, "lua", "exit")
+	end
+end
+
+skynet.start(function()
+	launch("cold")
+	skynet.call(".launcher", "lua", "POOL", SERVICE_NAME, N, N)
+	skynet.sleep(100)	-- wait for warm instances
+	for k,v in pairs(skynet.call(".launcher", "lua", "POOL")) do
+		print(k, v)
+	end
+	launch("warm")
+	skynet.call(".launcher", "lua", "POOL", SERVICE_NAME, 0, 0)
+
+	-- the instances killed in init are removed from pool, and the pool is refilled
+	local last = skynet.newservice(SERVICE_NAME, "AGENT")
+	skynet.send(last, "lua", "exit")
+	skynet.call(".launcher", "lua", "POOL", SERVICE_NAME, 2, 2)
+	-- the handles are allocated in order
+	skynet.kill(last + 1)
+	skynet.kill(last + 2)
+	skynet.sleep(100)
+	local stat = skynet.call(".launcher", "lua", "POOL")[SERVICE_NAME]
+	print("killed in init", stat)
+	assert(stat:find("ready 2 warming 0", 1, true))
+	skynet.call(".launcher", "lua", "POOL", SERVICE_NAME, 0, 0)
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,202 @@
+local skynet = require "skynet"
+local sharedata = require "sharedata"
+local compile = require "sharedata.compile"
+
+-- The updates of sharedata : full update and delta patch share the unchanged subtables with the old version,
+-- and the readers bind to the new version lazily. The data can be loaded from an image file (sharedata.compile).
+-- testsharedata [N] : benchmark of N items, the latency of updates and the peak RSS of the process,
+-- the time of loading from an image, and the field reads/sec compared with a lua table.
+
+local N = tonumber((...)) or 200000
+
+local function rss()
+	local f = io.open "/proc/self/status"
+	if not f then
+		return 0, 0
+	end
+	local s = f:read "a"
+	f:close()
+	return tonumber(s:match "VmRSS:%s*(%d+)") // 1024, tonumber(s:match "VmHWM:%s*(%d+)") // 1024
+end
+
+local function reset_peak()
+	-- reset VmHWM to VmRSS (linux 4.0+)
+	local f = io.open("/proc/self/clear_refs", "w")
+	if f then
+		f:write "5"
+		f:close()
+	end
+end
+
+-- wait for the monitor of sharedata delivering the new version
+local function wait_version(obj, check)
+	while not check(obj) do
+		skynet.sleep(1)
+	end
+end
+
+local function test()
+	sharedata.new("test", { a = 1, b = { x = 1, y = { z = 2 } }, c = { 1, 2, 3 }, d = { k = "v" } })
+	local obj = sharedata.query "test"
+	local b, c = obj.b, obj.c
+	assert(obj.a == 1 and b.y.z == 2 and c[3] == 3 and obj.d.k == "v")
+	local c_pointer = c.__obj
+
+	sharedata.update("test", { a = 2, b = { x = 1, y = { z = 3 } }, c = { 1, 2, 3 }, d = { k = "v" } })
+	wait_version(obj, function(obj) return obj.a == 2 end)
+	-- the old reference of the subtable follows the new version
+	assert(b.y.z == 3 and c[1] == 1)
+	assert(c.__obj == c_pointer, "c should be shared")
+
+	sharedata.patch("test", { b = { x = 10 }, e = { 1 } }, { { "d", "k" }, { "a" } })
+	wait_version(obj, function(obj) return obj.a == nil end)
+	assert(b.x == 10 and b.y.z == 3 and obj.e[1] == 1 and obj.d.k == nil)
+	assert(c.__obj == c_pointer, "c should be shared")
+	local n = 0
+	for k, v in pairs(obj) do
+		n = n + 1
+	end
+	assert(n == 4)	-- b c d e
+
+	-- a failed update keeps the old version
+	assert(not pcall(sharedata.update, "test", { [1.5] = true }))
+	assert(b.x == 10)
+	-- so does a failed patch, the next patch of the same subtable doesn't see it
+	assert(not pcall(sharedata.patch, "test", { b = { bad = { [1.5] = true } } }))
+	sharedata.patch("test", { b = { x = 11 } })
+	wait_version(obj, function(obj) return obj.b.x == 11 end)
+	assert(b.bad == nil and b.y.z == 3)
+	sharedata.delete "test"
+	print("sharedata update ok")
+end
+
+local function test_image()
+	local filename = os.tmpname()
+	compile({ a = 1, b = { x = 1, y = { z = 2 } }, c = { 1, 2, 3 }, [10] = "ten" }, filename)
+	sharedata.load("image", filename)
+	local obj = sharedata.query "image"
+	local b, c = obj.b, obj.c
+	assert(obj.a == 1 and b.y.z == 2 and #c == 3 and c[3] == 3 and obj[10] == "ten")
+	local c_pointer = c.__obj
+
+	-- the new version shares the unchanged subtables of the image
+	sharedata.update("image", { a = 2, b = { x = 1, y = { z = 3 } }, c = { 1, 2, 3 } })
+	wait_version(obj, function(obj) return obj.a == 2 end)
+	assert(b.y.z == 3 and obj[10] == nil)
+	assert(c.__obj == c_pointer, "c should be shared")
+
+	-- update by the image
+	sharedata.load("image", filename)
+	wait_version(obj, function(obj) return obj.a == 1 end)
+	assert(b.y.z == 2 and obj[10] == "ten")
+	assert(not pcall(sharedata.patch, "image", { a = 3 }))
+	sharedata.delete "image"
+	os.remove(filename)
+	print("sharedata image ok")
+end
+
+local function item(i)
+	return { id = i, name = "item" .. i, attrs = { hp = i, atk = i * 2, tags = { "a", "b", "c" } } }
+end
+
+local function config(n)
+	local items = {}
+	for i = 1, n do
+		items[i] = item(i)
+	end
+	return { version = 1, items = items, misc = { motd = "hello" } }
+end
+
+local function bench(name, f)
+	reset_peak()
+	local before = rss()
+	local t = skynet.now()
+	f()
+	local ti = (skynet.now() - t) * 10
+	local now, peak = rss()
+	print(string.format("%-28s : %6d ms, RSS %5d MB, peak +%d MB", name, ti, now, peak - before))
+end
+
+local function benchmark()
+	bench("new " .. N .. " items", function()
+		sharedata.new("bench", config(N))
+	end)
+	local filename = os.tmpname()
+	bench("compile image", function()
+		compile(config(N), filename)
+	end)
+	bench("load image", function()
+		sharedata.load("image", filename)
+	end)
+	local image = sharedata.query "image"
+	for i = 1, N do
+		assert(image.items[i].attrs.hp == i)
+	end
+	sharedata.delete "image"
+	os.remove(filename)
+
+	local obj = sharedata.query "bench"
+	local items = obj.items
+	-- cache the reader's subtables
+	for i = 1, N do
+		assert(items[i].attrs.hp == i)
+	end
+	local version = 1
+	local function read_first(name)
+		version = version + 1
+		-- the monitor gets the new version in the time, and the reader binds to it at the first access
+		skynet.sleep(50)
+		local t = os.clock()
+		assert(items[1].attrs.hp == 1)
+		print(string.format("%-28s : %.3f ms", name, (os.clock() - t) * 1000))
+		assert(obj.version == version)
+	end
+
+	bench("update (1 item changed)", function()
+		local c = config(N)
+		c.version = version + 1
+		c.items[N].attrs.hp = 0
+		sharedata.update("bench", c)
+	end)
+	read_first("reader rebind after update")
+	if sharedata.patch then
+		bench("patch (1 item changed)", function()
+			sharedata.patch("bench", { version = version + 1, items = { [N] = { attrs = { hp = -1 } } } })
+		end)
+		read_first("reader rebind after patch")
+		assert(items[N].attrs.hp == -1)
+	end
+	sharedata.delete "bench"
+end
+
+-- field reads/sec of a sharedata object and a lua table
+local function bench_read()
+	local n, rounds = 1000, 200
+	local t = config(n)
+	sharedata.new("read", t)
+	local obj = sharedata.query "read"
+	local function run(name, root)
+		local items = root.items
+		local sum = 0
+		local start_time = os.clock()
+		for r = 1, rounds do
+			for i = 1, n do
+				local it = items[i]
+				sum = sum + it.attrs.hp + it.id + #it.name
+			end
+		end
+		local ti = os.clock() - start_time
+		print(string.format("%-28s : %10.0f reads/sec", "read " .. name, rounds * n * 5 / ti))
+	end
+	run("lua table", t)
+	run("sharedata", obj)
+	sharedata.delete "read"
+end
+
+skynet.start(function()
+	test()
+	test_image()
+	bench_read()
+	benchmark()
+	skynet.exit()
+end)
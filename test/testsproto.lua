@@ -0,0 +1,238 @@
+local skynet = require "skynet"
+local sproto = require "sproto"
+
+-- Round trip of sproto encode/decode, and a benchmark (ops/sec) of some representative protocols.
+-- testsproto [N] : N times for each benchmark
+
+local N = tonumber((...)) or 100000
+
+local sp = sproto.parse [[
+.package {
+	type 0 : integer
+	session 1 : integer
+}
+
+.Position {
+	x 0 : integer
+	y 1 : integer
+	dir 2 : integer
+}
+
+.Entity {
+	id 0 : integer
+	name 1 : string
+	pos 2 : Position
+	hp 3 : integer
+	buffs 5 : *integer
+	alive 6 : boolean
+}
+
+.Login {
+	account 0 : string
+	token 1 : string
+	version 2 : integer
+	channel 3 : string
+}
+
+.SceneSync {
+	frame 0 : integer
+	entities 1 : *Entity
+	removed 2 : *integer
+	flags 3 : *boolean
+	byid 4 : *Entity(id)
+}
+]]
+
+local function compare(a, b)
+	if type(a) ~= "table" then
+		assert(a == b, tostring(a) .. " ~= " .. tostring(b))
+		return
+	end
+	assert(type(b) == "table")
+	for k,v in pairs(a) do
+		compare(v, b[k])
+	end
+	for k in pairs(b) do
+		assert(a[k] ~= nil, k)
+	end
+end
+
+local function roundtrip(typename, obj)
+	local bin = sp:encode(typename, obj)
+	local r = sp:decode(typename, bin)
+	compare(obj, r)
+	assert(sp:decode(typename, sproto.unpack(sproto.pack(bin))))
+	return bin
+end
+
+local function entity(i)
+	return {
+		id = i,
+		name = "entity" .. i,
+		pos = { x = i * 3, y = -i, dir = i % 360 },
+		hp = 100000 + i,
+		buffs = { 1, 2, i },
+		alive = i % 2 == 0,
+	}
+end
+
+local function test()
+	roundtrip("package", { type = 1, session = 0x7fff })
+	roundtrip("package", { type = -1, session = math.maxinteger })
+	roundtrip("Entity", { id = 0x7ffe, buffs = {}, alive = false })
+	-- 32bit integers are rearranged into 64bit
+	roundtrip("Entity", { buffs = { 1, -1, 0x7fffffff, -0x80000000, 0x100000000, math.mininteger } })
+	roundtrip("Entity", entity(1))
+	local byid = {}
+	for i = 1, 10 do
+		byid[i * 100] = entity(i * 100)
+	end
+	roundtrip("SceneSync", { frame = 1, entities = { entity(1), entity(2) }, removed = { 3, 4 }, flags = { true, false }, byid = byid })
+	assert(not pcall(sp.encode, sp, "Entity", { id = "x" }))
+	assert(not pcall(sp.encode, sp, "Entity", { buffs = 1 }))
+	assert(not pcall(sp.decode, sp, "Entity", "\1\0\0"))
+	print("sproto round trip ok")
+end
+
+-- hot swap of the schema shared by sprotoloader, the session sent with the old version is still decoded
+local function test_share()
+	local sprotoloader = require "sprotoloader"
+	local parser = require "sprotoparser"
+	local SLOT = 15
+	local v1 = sprotoloader.save(parser.parse [[
+.package {
+	type 0 : integer
+	session 1 : integer
+}
+foo 1 {
+	request { a 0 : integer }
+	response { ok 0 : boolean }
+}
+]], SLOT)
+	local sp = sprotoloader.load(SLOT)
+	local server = sp:host "package"
+	local client = sp:host "package"
+	local request = client:attach(sp)
+	local req = request("foo", { a = 1 }, 1)
+
+	local v2text = [[
+.package {
+	type 0 : integer
+	session 1 : integer
+}
+foo 1 {
+	request { a 0 : integer  b 1 : string }
+	response { ok 0 : boolean  msg 1 : string }
+}
+bar 2 {}
+]]
+	local v2 = sprotoloader.save(parser.parse(v2text), SLOT)
+	assert(v2 == v1 + 1 and sprotoloader.version(SLOT) == v2)
+	collectgarbage()
+	local t, name, args, response = server:dispatch(req)
+	assert(t == "REQUEST" and name == "foo" and args.a == 1)
+	assert(sp.__version == v2 and sp:exist_proto "bar")
+	local resp = response { ok = true, msg = "hello" }
+	collectgarbage()
+	-- the response type of session 1 is the old one, without msg
+	local t, session, result = client:dispatch(resp)
+	assert(t == "RESPONSE" and session == 1 and result.ok == true and result.msg == nil)
+	local t, name = server:dispatch(request "bar")
+	assert(t == "REQUEST" and name == "bar")
+	collectgarbage()
+
+	-- the response function keeps its version, the handler may yield while the schema is swapped
+	-- (the remote client doesn't share the schema, so nothing else keeps the version v2)
+	local remote = sproto.parse(v2text)
+	local remote_client = remote:host "package"
+	local t, name, args, response = server:dispatch(remote_client:attach(remote)("foo", { a = 3 }, 3))
+	local v3 = sprotoloader.save(parser.parse [[
+.package {
+	type 0 : integer
+	session 1 : integer
+}
+foo 1 {
+	request { a 0 : integer }
+	response { ok 0 : boolean }
+}
+]], SLOT)
+	server:dispatch(request("foo", { a = 4 }))
+	assert(sp.__version == v3)
+	collectgarbage()
+	local t, session, result = remote_client:dispatch(response { ok = true, msg = "v2" })
+	assert(t == "RESPONSE" and session == 3 and result.msg == "v2")
+	print("sproto hot swap ok")
+end
+
+local function bench(name, typename, obj)
+	local bin = sp:encode(typename, obj)
+	local encode, decode = sp.encode, sp.decode
+	local start_time = os.clock()
+	for i = 1, N do
+		encode(sp, typename, obj)
+	end
+	local ti_encode = os.clock() - start_time
+	start_time = os.clock()
+	for i = 1, N do
+		decode(sp, typename, bin)
+	end
+	local ti_decode = os.clock() - start_time
+	print(string.format("%-10s %5d bytes : encode %8.0f ops/sec, decode %8.0f ops/sec",
+		name, #bin, N / ti_encode, N / ti_decode))
+end
+
+-- a wide type with sparse tags, and lookups of types and protocols in a big schema
+local function bench_wide()
+	local core = require "sproto.core"
+	local text = { ".package {\n type 0 : integer\n session 1 : integer\n}\n.Wide {\n" }
+	local obj = {}
+	for i = 1, 300 do
+		table.insert(text, string.format(" f%d %d : integer\n", i, i * 5))
+		obj["f" .. i] = i
+	end
+	table.insert(text, "}\n")
+	for i = 1, 500 do
+		table.insert(text, string.format(".T%d { a 0 : integer }\np%d %d {}\n", i, i, i * 2))
+	end
+	local wide = sproto.parse(table.concat(text))
+	local bin = wide:encode("Wide", obj)
+	local decode = wide.decode
+	local start_time = os.clock()
+	for i = 1, N // 10 do
+		decode(wide, "Wide", bin)
+	end
+	print(string.format("%-10s %5d bytes : decode %8.0f ops/sec", "wide", #bin, N // 10 / (os.clock() - start_time)))
+
+	local cobj = wide.__cobj
+	local names = {}
+	for i = 1, 500 do
+		names[i] = "T" .. i
+	end
+	local querytype, protocol = core.querytype, core.protocol
+	start_time = os.clock()
+	for i = 1, N do
+		querytype(cobj, names[i % 500 + 1])
+	end
+	local ti_type = os.clock() - start_time
+	start_time = os.clock()
+	for i = 1, N do
+		protocol(cobj, (i % 500 + 1) * 2)
+	end
+	local ti_tag = os.clock() - start_time
+	print(string.format("lookup 500 : querytype %8.0f ops/sec, protocol by tag %8.0f ops/sec", N / ti_type, N / ti_tag))
+end
+
+skynet.start(function()
+	test()
+	test_share()
+	bench("package", "package", { type = 1, session = 100 })
+	bench("login", "Login", { account = "player@example.com", token = string.rep("t", 64), version = 20170101, channel = "ios" })
+	bench("entity", "Entity", entity(1))
+	local entities = {}
+	for i = 1, 50 do
+		entities[i] = entity(i)
+	end
+	bench("scene", "SceneSync", { frame = 12345, entities = entities, removed = { 1, 2, 3 }, flags = { true, false, true } })
+	bench_wide()
+	skynet.exit()
+end)
@@ -0,0 +1,148 @@
+local skynet = require "skynet"
+local core = require "sproto.core"
+
+-- sproto.pack / sproto.unpack (0 packing) of all the implementations the cpu supports :
+-- compare with a reference packer in lua on random buffers, and the throughput in MB/s.
+-- testsprotopack [rounds of fuzz] [MB of benchmark]
+
+local ROUND, MB = ...
+ROUND = tonumber(ROUND) or 2000
+MB = tonumber(MB) or 64
+
+local function padding(s)
+	return s .. string.rep("\0", (8 - #s % 8) % 8)
+end
+
+local function ref_pack(s)
+	s = padding(s)
+	local out = {}
+	local ff_start, ff_n = 0, 0
+	local function flush_ff()
+		table.insert(out, string.char(0xff, ff_n - 1))
+		table.insert(out, s:sub(ff_start, ff_start + ff_n * 8 - 1))
+		ff_n = 0
+	end
+	for i = 1, #s, 8 do
+		local header, bytes = 0, {}
+		for j = 0, 7 do
+			local c = s:byte(i + j)
+			if c ~= 0 then
+				header = header | (1 << j)
+				table.insert(bytes, string.char(c))
+			end
+		end
+		if ff_n > 0 and #bytes >= 6 then
+			ff_n = ff_n + 1
+			if ff_n == 256 then
+				flush_ff()
+			end
+		elseif #bytes == 8 then
+			ff_start, ff_n = i, 1
+		else
+			if ff_n > 0 then
+				flush_ff()
+			end
+			table.insert(out, string.char(header))
+			table.insert(out, table.concat(bytes))
+		end
+	end
+	if ff_n > 0 then
+		flush_ff()
+	end
+	return table.concat(out)
+end
+
+-- runs of segments with different density of zero, the dense ones make the 0xff runs
+local function random_buffer(sz)
+	local t = {}
+	local zero = 0
+	for i = 1, sz do
+		if i % 8 == 1 and math.random(4) == 1 then
+			zero = ({0, 0.1, 0.5, 0.9, 1})[math.random(5)]
+		end
+		t[i] = math.random() < zero and 0 or math.random(255)
+	end
+	return string.char(table.unpack(t))
+end
+
+local function random_size()
+	local r = math.random(10)
+	if r <= 6 then
+		return math.random(0, 64)
+	elseif r <= 9 then
+		return math.random(0, 512)
+	else
+		-- more than 256 segments of 0xff
+		return math.random(2000, 5000)
+	end
+end
+
+local impls = {}
+for _, name in ipairs { "scalar", "ssse3", "avx2" } do
+	if core.packimpl(name) then
+		table.insert(impls, name)
+	end
+end
+
+local function fuzz()
+	for r = 1, ROUND do
+		local s = random_buffer(random_size())
+		local expect = ref_pack(s)
+		for _, name in ipairs(impls) do
+			core.packimpl(name)
+			local p = core.pack(s)
+			assert(p == expect, name .. " pack")
+			assert(core.unpack(p) == padding(s), name .. " unpack")
+		end
+		-- broken streams : the same result or the same error
+		local broken = expect:sub(1, math.random(0, #expect))
+		if math.random(2) == 1 then
+			broken = random_buffer(math.random(0, 64))
+		end
+		local result
+		for _, name in ipairs(impls) do
+			core.packimpl(name)
+			local ok, u = pcall(core.unpack, broken)
+			u = tostring(ok) .. (ok and u or "")
+			assert(result == nil or result == u, name .. " broken stream")
+			result = u
+		end
+	end
+	print(string.format("sproto pack fuzz ok, %d rounds, %s", ROUND, table.concat(impls, " ")))
+end
+
+local function benchmark()
+	local chunk = 4096
+	local data = {}
+	for i = 1, 16 do
+		data[i] = random_buffer(chunk)
+	end
+	local packed = {}
+	for i = 1, 16 do
+		packed[i] = core.pack(data[i])
+	end
+	local n = MB * 1024 * 1024 // chunk
+	for _, name in ipairs(impls) do
+		core.packimpl(name)
+		local pack, unpack = core.pack, core.unpack
+		local t = os.clock()
+		for i = 1, n do
+			pack(data[i % 16 + 1])
+		end
+		local pt = os.clock() - t
+		t = os.clock()
+		for i = 1, n do
+			unpack(packed[i % 16 + 1])
+		end
+		local ut = os.clock() - t
+		print(string.format("%-8s : pack %8.1f MB/s, unpack %8.1f MB/s", name, MB / pt, MB / ut))
+	end
+end
+
+skynet.start(function()
+	local default = core.packimpl()
+	fuzz()
+	benchmark()
+	core.packimpl(default)
+	skynet.exit()
+end)
@@ -1,7 +1,12 @@
 local skynet = require "skynet"
 local stm = require "stm"
 
-local mode = ...
+-- teststm : a reader service reads the object updated by the writer.
+-- teststm bench [readers] [seconds] : reads/sec of the readers polling the objects updated every 10ms,
+-- and check the snapshots of stm.readall : the writer updates the objects in order, so the versions of
+-- a snapshot are non-increasing, and differ by 1 at most.
+
+local mode, arg1, arg2 = ...
 
 if mode == "slave" then
 
@@ -19,6 +24,89 @@ skynet.start(function()
 	end)
 end)
 
+elseif mode == "benchreader" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function (_,_, objs, seconds)
+		for i, obj in ipairs(objs) do
+			objs[i] = stm.newcopy(obj)
+		end
+		local function size(msg, sz)
+			return sz
+		end
+		local function check(ok, ...)
+			if ok then
+				local versions = { ... }
+				for i = 2, #versions do
+					local d = versions[1] - versions[i]
+					assert(versions[i-1] >= versions[i] and d >= 0 and d <= 1, table.concat(versions, " "))
+				end
+			end
+		end
+		local n, updated = 0, 0
+		local stop_time = skynet.now() + seconds * 100
+		while skynet.now() < stop_time do
+			for i = 1, 1000 do
+				for _, obj in ipairs(objs) do
+					if obj(size) then
+						updated = updated + 1
+					end
+				end
+			end
+			n = n + 1000 * #objs
+			check(stm.readall(skynet.unpack, table.unpack(objs)))
+			skynet.yield()
+		end
+		skynet.ret(skynet.pack(n, updated))
+	end)
+end)
+
+elseif mode == "bench" then
+
+skynet.start(function()
+	local readers = tonumber(arg1) or 6
+	local seconds = tonumber(arg2) or 3
+	local objs = {}
+	for i = 1, 4 do
+		objs[i] = stm.new(skynet.pack(i))
+	end
+	local running = true
+	skynet.fork(function()
+		local version = 0
+		while running do
+			version = version + 1
+			for _, obj in ipairs(objs) do
+				obj(skynet.pack(version))
+			end
+			skynet.sleep(1)
+		end
+	end)
+	local total, updated = 0, 0
+	local co = coroutine.running()
+	local working = readers
+	for i = 1, readers do
+		local r = skynet.newservice(SERVICE_NAME, "benchreader")
+		local copies = {}
+		for j, obj in ipairs(objs) do
+			copies[j] = stm.copy(obj)
+		end
+		skynet.fork(function()
+			local n, u = skynet.call(r, "lua", copies, seconds)
+			total = total + n
+			updated = updated + u
+			working = working - 1
+			if working == 0 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait()
+	running = false
+	print(string.format("stm : %d readers, %.0f reads/sec, %d updates read", readers, total / seconds, updated))
+	require "skynet.manager"
+	skynet.abort()
+end)
+
 else
 
 skynet.start(function()
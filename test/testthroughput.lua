@@ -0,0 +1,186 @@
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"	-- import skynet.abort
+
+-- Benchmark of the socket thread reading :
+-- testthroughput tcp [MB] [chunk size] [server|client] : MB/s of one tcp connection
+-- testthroughput udp [N] [size] [server|client] : packets/sec of N udp packages
+-- testthroughput echo [connections] [rounds] [server|client] : round trips/sec and latency of 64 bytes echo
+-- Run the server and the client in two processes for udp, otherwise the sending starves the receiving in socket thread,
+-- and most of the packages are dropped.
+
+local mode, arg1, arg2, role = ...
+
+local PORT = 8006
+
+if mode == "TCPCLIENT" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, total, chunk)
+		skynet.ret(skynet.pack(true))
+		local fd = assert(socket.open("127.0.0.1", PORT))
+		-- pause when 4M bytes are queued in socket thread
+		socket.setwater(fd, 4 * 1024 * 1024, 1024 * 1024, "pause")
+		socket.warning(fd, function() end)
+		local data = string.rep("x", chunk)
+		for i = 1, total // chunk do
+			while not socket.writable(fd) do
+				skynet.yield()
+			end
+			socket.write(fd, data)
+		end
+	end)
+end)
+
+elseif mode == "UDPCLIENT" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, n, size)
+		skynet.ret(skynet.pack(true))
+		local c = socket.udp(function() end)
+		socket.udp_connect(c, "127.0.0.1", PORT)
+		local data = string.rep("x", size)
+		for i = 1, n do
+			socket.write(c, data)
+			if i % 100 == 0 then
+				skynet.yield()
+			end
+		end
+	end)
+end)
+
+elseif mode == "ECHOCLIENT" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, n, rounds)
+		local fds = {}
+		for i = 1, n do
+			fds[i] = assert(socket.open("127.0.0.1", PORT))
+		end
+		local data = string.rep("x", 64)
+		local co = coroutine.running()
+		local working = n
+		local start_time = skynet.now()
+		for i = 1, n do
+			skynet.fork(function()
+				local fd = fds[i]
+				for j = 1, rounds do
+					socket.write(fd, data)
+					assert(socket.read(fd, 64))
+				end
+				socket.close(fd)
+				working = working - 1
+				if working == 0 then
+					skynet.wakeup(co)
+				end
+			end)
+		end
+		skynet.wait()
+		local ti = (skynet.now() - start_time) / 100
+		local total = n * rounds
+		print(string.format("echo : %d connections, %d round trips in %.2fs, %.0f/s, %.1f us per round trip",
+			n, total, ti, total / ti, ti * 1000000 / rounds))
+		skynet.ret(skynet.pack(true))
+	end)
+end)
+
+else
+
+local function echo(n, rounds)
+	local listen = socket.listen("127.0.0.1", PORT)
+	socket.start(listen, function(fd)
+		skynet.fork(function()
+			socket.start(fd)
+			while true do
+				local data = socket.read(fd)
+				if not data then
+					break
+				end
+				socket.write(fd, data)
+			end
+			socket.close(fd)
+		end)
+	end)
+	if role ~= "server" then
+		skynet.call(skynet.newservice(SERVICE_NAME, "ECHOCLIENT"), "lua", n, rounds)
+		skynet.abort()
+	end
+end
+
+local function tcp(total, chunk)
+	local listen = socket.listen("127.0.0.1", PORT)
+	local fd
+	socket.start(listen, function(id)
+		fd = id
+		socket.close(listen)
+		skynet.fork(function()
+			socket.start(fd)
+			local received = 0
+			local start_time
+			while received < total do
+				local data = assert(socket.read(fd))
+				start_time = start_time or skynet.now()
+				received = received + #data
+			end
+			local ti = (skynet.now() - start_time) / 100
+			print(string.format("tcp : %d MB in %.2fs, %.1f MB/s", total // (1024*1024), ti, total / ti / (1024*1024)))
+			socket.close(fd)
+			skynet.abort()
+		end)
+	end)
+	if role ~= "server" then
+		local client = skynet.newservice(SERVICE_NAME, "TCPCLIENT")
+		skynet.call(client, "lua", total, chunk)
+	end
+end
+
+local function udp(n, size)
+	local received = 0
+	local start_time, last_time
+	socket.udp(function(str, from)
+		received = received + 1
+		start_time = start_time or skynet.now()
+		last_time = skynet.now()
+	end, "127.0.0.1", PORT)
+	if role ~= "server" then
+		local client = skynet.newservice(SERVICE_NAME, "UDPCLIENT")
+		skynet.call(client, "lua", n, size)
+	end
+	-- wait until no more package
+	local last
+	repeat
+		last = received
+		skynet.sleep(100)
+	until last == received and received > 0
+	local ti = (last_time - start_time) / 100
+	print(string.format("udp : %d/%d packages in %.2fs, %.0f packets/sec", received, n, ti, received / ti))
+	skynet.abort()
+end
+
+skynet.start(function()
+	if mode == "echo" then
+		local n, rounds = tonumber(arg1) or 100, tonumber(arg2) or 1000
+		if role == "client" then
+			skynet.call(skynet.newservice(SERVICE_NAME, "ECHOCLIENT"), "lua", n, rounds)
+			skynet.abort()
+		else
+			echo(n, rounds)
+		end
+	elseif mode == "udp" then
+		local n, size = tonumber(arg1) or 1000000, tonumber(arg2) or 64
+		if role == "client" then
+			skynet.call(skynet.newservice(SERVICE_NAME, "UDPCLIENT"), "lua", n, size)
+		else
+			udp(n, size)
+		end
+	else
+		local total, chunk = (tonumber(arg1) or 1024) * 1024 * 1024, tonumber(arg2) or 64 * 1024
+		if role == "client" then
+			skynet.call(skynet.newservice(SERVICE_NAME, "TCPCLIENT"), "lua", total, chunk)
+		else
+			tcp(total, chunk)
+		end
+	end
+end)
+
+end
@@ -0,0 +1,114 @@
+local skynet = require "skynet"
+local topic = require "topic"
+
+-- testtopic : the patterns of topic.subscribe
+-- testtopic bench [events] [subscribers] : events/sec delivered to the subscribers of "scene.*.combat"
+
+local mode, arg1, arg2 = ...
+
+if mode == "sub" then
+
+skynet.start(function()
+	local received = {}
+	local batches = 0
+	local count = 0
+	local waiting, waiting_co
+	local id = {}
+	local raw = skynet.dispatch("topic")
+	skynet.dispatch("topic", function(...)
+		batches = batches + 1
+		raw(...)
+	end)
+	skynet.dispatch("lua", function(_,_, cmd, pattern, n)
+		if cmd == "sub" then
+			id[pattern] = topic.subscribe(pattern, function(name, i)
+				table.insert(received, pattern .. "=" .. name)
+				count = count + 1
+				if count == waiting then
+					skynet.wakeup(waiting_co)
+				end
+			end)
+			skynet.ret()
+		elseif cmd == "unsub" then
+			topic.unsubscribe(id[pattern])
+			skynet.ret()
+		elseif cmd == "wait" then
+			waiting = n
+			if count < n then
+				waiting_co = coroutine.running()
+				skynet.wait()
+			end
+			skynet.ret(skynet.pack(count, batches))
+		elseif cmd == "result" then
+			-- wait for the events in the queue of topicd
+			skynet.sleep(10)
+			table.sort(received)
+			skynet.ret(skynet.pack(received))
+			received = {}
+		end
+	end)
+end)
+
+else
+
+local function test()
+	local sub = skynet.newservice(SERVICE_NAME, "sub")
+	for _, pattern in ipairs { "scene.*.combat", "scene.#", "scene.1.chat", "#" } do
+		skynet.call(sub, "lua", "sub", pattern)
+	end
+	for _, name in ipairs { "scene.1.combat", "scene.1.chat", "scene", "other.x", "scene.1.combat.x" } do
+		topic.publish(name, 1)
+	end
+	local r = skynet.call(sub, "lua", "result")
+	local expect = {
+		"#=other.x", "#=scene", "#=scene.1.chat", "#=scene.1.combat", "#=scene.1.combat.x",
+		"scene.#=scene", "scene.#=scene.1.chat", "scene.#=scene.1.combat", "scene.#=scene.1.combat.x",
+		"scene.*.combat=scene.1.combat", "scene.1.chat=scene.1.chat",
+	}
+	assert(table.concat(r, " ") == table.concat(expect, " "), table.concat(r, " "))
+
+	skynet.call(sub, "lua", "unsub", "#")
+	skynet.call(sub, "lua", "unsub", "scene.#")
+	topic.publish("scene.2.combat")
+	topic.publish("other.x")
+	r = skynet.call(sub, "lua", "result")
+	assert(table.concat(r, " ") == "scene.*.combat=scene.2.combat", table.concat(r, " "))
+	print("topic ok")
+end
+
+local function bench(n, m)
+	local subs = {}
+	for i = 1, m do
+		subs[i] = skynet.newservice(SERVICE_NAME, "sub")
+		skynet.call(subs[i], "lua", "sub", "scene.*.combat")
+	end
+	local start_time = skynet.now()
+	for i = 1, n do
+		topic.publish("scene." .. i % 100 .. ".combat", i)
+		if i % 1000 == 0 then
+			-- let the topicd run, or all the events are queued
+			skynet.yield()
+		end
+	end
+	local batches = 0
+	for i = 1, m do
+		local count, b = skynet.call(subs[i], "lua", "wait", nil, n)
+		assert(count == n)
+		batches = batches + b
+	end
+	local ti = (skynet.now() - start_time) / 100
+	print(string.format("topic : %d events to %d subscribers in %.2fs, %.0f events/sec delivered, %.1f events per batch",
+		n, m, ti, n * m / ti, n * m / batches))
+end
+
+skynet.start(function()
+	if mode == "bench" then
+		bench(tonumber(arg1) or 100000, tonumber(arg2) or 10)
+	else
+		test()
+	end
+	require "skynet.manager"
+	skynet.abort()
+end)
+
+end
@@ -0,0 +1,64 @@
+local skynet = require "skynet"
+local socket = require "socket"
+
+-- The water marks of send buffer. The accepted socket isn't started until the writer is blocked,
+-- so nobody reads the data and the send buffer grows.
+
+local PORT = 8005
+local CHUNK = string.rep("x", 64 * 1024)
+local HIGH = 1024 * 1024
+
+local function test(policy)
+	local peer
+	local listen = socket.listen("127.0.0.1", PORT)
+	socket.start(listen, function(fd)
+		peer = fd
+	end)
+	local fd = assert(socket.open("127.0.0.1", PORT))
+	socket.setwater(fd, HIGH, HIGH // 4, policy)
+	local warnings = {}
+	socket.warning(fd, function(id, size)
+		table.insert(warnings, size)
+	end)
+	while not peer do
+		skynet.sleep(1)
+	end
+	socket.close(listen)
+
+	local sent = 0
+	while socket.writable(fd) do
+		socket.write(fd, CHUNK)
+		sent = sent + #CHUNK
+		-- low priority data is dropped when the socket is blocked by "drop"
+		socket.lwrite(fd, CHUNK)
+		skynet.sleep(0)
+	end
+	skynet.sleep(10)
+	print(policy, "blocked after", sent // 1024, "K", "warnings", table.concat(warnings, " "))
+
+	if policy == "close" then
+		assert(socket.invalid(fd) or not socket.write(fd, CHUNK))
+		socket.start(peer)
+		socket.close(peer)
+		return
+	end
+	assert(warnings[1] and warnings[1] > 0)
+	socket.start(peer)
+	local received = 0
+	-- the kernel buffers may absorb some data, so the socket could be blocked more than once
+	while warnings[#warnings] ~= 0 do
+		local data = socket.read(peer)
+		received = received + #data
+	end
+	assert(socket.writable(fd))
+	print(policy, "writable again after", received // 1024, "K")
+	socket.close(fd)
+	socket.close(peer)
+end
+
+skynet.start(function()
+	test "pause"
+	test "drop"
+	test "close"
+	print("test water marks ok")
+end)